@@ -41,10 +41,8 @@
 #include <syscall.h>
 #include <kern/wait.h>
 #include <synch.h>
-#include <kern/procsys.h>
-
- /************ RB:Process table ************/
-struct pdesc* g_pdtable[PID_LIMIT];
+#include <proc.h>
+#include <trace.h>
 
 
 /* in exception.S */
@@ -143,12 +141,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	kprintf("User mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
 
-	struct pdesc *pd = g_pdtable[curthread->t_pid];
-	pd->exitcode = _MKWAIT_SIG(sig);
-	pd->exited = true;
-	lock_acquire(pd->wait_lock);
-	cv_signal(pd->wait_cv,pd->wait_lock);
-	lock_release(pd->wait_lock);
+	proc_exit(_MKWAIT_SIG(sig));
 	thread_exit();
 
 }
@@ -187,10 +180,13 @@ mips_trap(struct trapframe *tf)
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
+		bool old_user;
 		bool doadjust;
 
 		old_in = curthread->t_in_interrupt;
+		old_user = curthread->t_intr_user;
 		curthread->t_in_interrupt = 1;
+		curthread->t_intr_user = !iskern;
 
 		/*
 		 * The processor has turned interrupts off; if the
@@ -230,7 +226,19 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
-		goto done2;
+		curthread->t_intr_user = old_user;
+		if (iskern) {
+			goto done2;
+		}
+
+		/*
+		 * Going back to user mode, which may be where a thread
+		 * of an exiting process is spinning. Put the interrupt
+		 * state back as below so proc_checkkill can sleep.
+		 */
+		spl = splhigh();
+		splx(spl);
+		goto done;
 	}
 
 	/*
@@ -253,8 +261,8 @@ mips_trap(struct trapframe *tf)
 		KASSERT(curthread->t_curspl == 0);
 		KASSERT(curthread->t_iplhigh_count == 0);
 
-		DEBUG(DB_SYSCALL, "syscall: #%d, args %x %x %x %x\n",
-		      tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
+		TRACE(DB_SYSCALL, "syscall #%d, args %x %x",
+		      tf->tf_v0, tf->tf_a0, tf->tf_a1);
 
 		// kprintf("syscall: #%d, args %x %x %x %x\n",tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
 		syscall(tf);
@@ -351,6 +359,14 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * If another thread has made our process exit, leave it instead
+	 * of going back to user mode.
+	 */
+	if (!iskern) {
+		proc_checkkill();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
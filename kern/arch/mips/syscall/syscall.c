@@ -34,6 +34,7 @@
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <syscall.h>
 #include <copyinout.h>
 
@@ -109,6 +110,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 		case SYS_open:
 		{
@@ -132,6 +138,53 @@ syscall(struct trapframe *tf)
 			retval = (int32_t)bytes_read;
 			break;
 		}
+		case SYS_readv:
+		{
+			size_t bytes_read;
+			err = sys_readv(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &bytes_read);
+			retval = (int32_t)bytes_read;
+			break;
+		}
+		case SYS_writev:
+		{
+			size_t bytes_written;
+			err = sys_writev(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &bytes_written);
+			retval = (int32_t)bytes_written;
+			break;
+		}
+		case SYS_pread:
+		{
+			/* the 64-bit offset is past a3, so it's on the stack */
+			off_t pos;
+			err = copyin((const userptr_t)(tf->tf_sp+16), &pos, sizeof(pos));
+			if (err == 0)
+			{
+				size_t bytes_read;
+				err = sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, pos, &bytes_read);
+				retval = (int32_t)bytes_read;
+			}
+			break;
+		}
+		case SYS_pwrite:
+		{
+			off_t pos;
+			err = copyin((const userptr_t)(tf->tf_sp+16), &pos, sizeof(pos));
+			if (err == 0)
+			{
+				size_t bytes_written;
+				err = sys_pwrite(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, pos, &bytes_written);
+				retval = (int32_t)bytes_written;
+			}
+			break;
+		}
+		case SYS_sendfile:
+		{
+			size_t bytes_copied;
+			err = sys_sendfile(tf->tf_a0, tf->tf_a1, (userptr_t)tf->tf_a2,
+				tf->tf_a3, &bytes_copied);
+			retval = (int32_t)bytes_copied;
+			break;
+		}
 		case SYS_close:
 		{
 			err = sys_close(tf->tf_a0);
@@ -177,7 +230,7 @@ syscall(struct trapframe *tf)
 		}
 		case SYS_getpid:
 		{
-			retval = (int32_t)curthread->t_pid;
+			retval = (int32_t)curthread->t_proc->p_pid;
 			err = 0;
 			break;
 		}
@@ -192,18 +245,56 @@ syscall(struct trapframe *tf)
 			break;
 		}
 
-		case SYS_fork:
+		case SYS___fork:
 		{
 			pid_t ret_pid;
 			err = sys_fork(tf, &ret_pid);
 			retval = (int32_t)ret_pid;
 			break;
 		}
-		case SYS_execv:
+		case SYS___execv:
 		{
 			err = sys_execv((userptr_t)tf->tf_a0,(userptr_t)tf->tf_a1);
 			break;
 		}
+		case SYS___spawnv:
+		{
+			pid_t ret_pid;
+			err = sys_spawnv((userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1, &ret_pid);
+			retval = (int32_t)ret_pid;
+			break;
+		}
+		case SYS___threadfork:
+		{
+			pid_t ret_tid;
+			err = sys___threadfork(tf, (userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1, (userptr_t)tf->tf_a2,
+				&ret_tid);
+			retval = (int32_t)ret_tid;
+			break;
+		}
+		case SYS_threadjoin:
+		{
+			err = sys_threadjoin(tf->tf_a0, (userptr_t)tf->tf_a1);
+			break;
+		}
+		case SYS_threadexit:
+		{
+			sys_threadexit(tf->tf_a0);
+			break;
+		}
+		case SYS_futex_wait:
+		{
+			err = sys_futex_wait((userptr_t)tf->tf_a0, tf->tf_a1);
+			break;
+		}
+		case SYS_futex_wake:
+		{
+			err = sys_futex_wake((userptr_t)tf->tf_a0, tf->tf_a1,
+				&retval);
+			break;
+		}
 		case SYS_sbrk:
 		{
 			int ret;
@@ -211,12 +302,40 @@ syscall(struct trapframe *tf)
 			retval = (int32_t)ret;
 			break;
 		}
+		case SYS_mmap:
+		{
+			/* fd and the 64-bit offset are past a3, on the stack */
+			int fd;
+			off_t offset;
+			err = copyin((const userptr_t)(tf->tf_sp+16), &fd, sizeof(fd));
+			if (err == 0)
+			{
+				err = copyin((const userptr_t)(tf->tf_sp+24), &offset, sizeof(offset));
+			}
+			if (err == 0)
+			{
+				err = sys_mmap((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+					tf->tf_a3, fd, offset, &retval);
+			}
+			break;
+		}
+		case SYS_munmap:
+		{
+			err = sys_munmap((userptr_t)tf->tf_a0, tf->tf_a1);
+			break;
+		}
+		case SYS_getrusage:
+		{
+			err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+			break;
+		}
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
 		break;
 	}
 
+	ru_syscall(callno, err, retval);
 
 	if (err) {
 		/*
@@ -45,6 +45,7 @@
 #include <kern/iovec.h>
 #include <uio.h>
 #include <vnode.h>
+#include <trace.h>
 
 /* under dumbvm, always have 48k of user stack */
 // #define DUMBVM_STACKPAGES    12
@@ -193,7 +194,13 @@ free_kpages(vaddr_t addr)
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
 }
 
 void
@@ -201,32 +208,38 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 {
 	int x = splhigh();
 	int index  = tlb_probe(ts->ts_vaddr,0);
-	if (index > 0)
+	if (index >= 0)
 	{
 		tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(),index);
 	}
 	splx(x);
 }
 
+/*
+ * The fault proper, with the address space locked against the other
+ * threads sharing it. The lock is let go while waiting for a busy page
+ * or reading one in, so then we look everything up again.
+ */
+static
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+vm_fault_locked(int faulttype, vaddr_t faultaddress, struct addrspace *as)
 {
 
 	uint32_t ehi, elo;
-	struct addrspace *as;
 	int spl;
+	struct ru_counts *ru = &curthread->t_ru;
 	faultaddress &= PAGE_FRAME;
 	ax_permssion region_perm;
-	as = curthread->t_addrspace;
-	if (as == NULL) {
-		return EFAULT; //as not setup
-	}
-	int result = vm_validitycheck(faultaddress, curthread->t_addrspace, &region_perm);
+	struct region_entry *region;
+	int result;
+ retry:
+	result = vm_validitycheck(faultaddress, as,
+		&region_perm, &region);
 	if (result == false)
 	{
 		return EFAULT;
 	}
-	DEBUG(DB_VM, "VM: fault: 0x%x\n", faultaddress);
+	TRACE(DB_VM, "fault 0x%x type %d", faultaddress, faulttype);
 	switch (faulttype) {
 		case VM_FAULT_READONLY:
 			if (!((region_perm & AX_WRITE) == AX_WRITE))
@@ -262,19 +275,58 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		}
 	}
 
-	/************ RB:Prevent access while swapping ************/
+	/************ RB:Prevent access while swapping or reading in ************/
 	if ((pte->pte_state.pte_lock_ondisk & PTE_LOCKED) == PTE_LOCKED)
 	{
-		wchan_sleep(as->swap_wc);
+		as_waitpte(as, pte);
+		goto retry;
 	}
 
 
 	/************ RB:Check if in memory ************/
 	if (pte->paddr == 0)
 	{
+		/*
+		 * It's a major fault if the page has to be read in. (A TLB
+		 * refill for a page already in memory isn't counted at all.)
+		 */
+		if ((pte->pte_state.pte_lock_ondisk & PTE_ONDISK) == PTE_ONDISK)
+		{
+			ru->rc_majflt++;
+			ru->rc_nswapin++;
+		}
+		else if (region != NULL && region->reg_type == RT_FILE)
+		{
+			ru->rc_majflt++;
+		}
+		else
+		{
+			ru->rc_minflt++;
+		}
+
 		/************ RB:Allocate since it is page fault ************/
 		result = page_alloc(pte,as);
 		if (result !=0) return ENOMEM;
+		if (as->as_nresident > ru->rc_maxrss)
+		{
+			ru->rc_maxrss = as->as_nresident;
+		}
+
+		/************ File mappings are read in on first touch ************/
+		if (region != NULL && region->reg_type == RT_FILE)
+		{
+			result = as_fillpage(as, region, pte);
+			if (result)
+			{
+				page_free(pte);
+				return result;
+			}
+			goto retry;
+		}
+	}
+	if (faulttype != VM_FAULT_READ)
+	{
+		pte->pte_state.pte_lock_ondisk |= PTE_MODIFIED;
 	}
 
 	/* make sure it's page-aligned */
@@ -296,7 +348,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	}else{
 		elo = pte->paddr|TLBLO_VALID;
 	}
-	DEBUG(DB_VM, "VM: 0x%x -> 0x%x\n", faultaddress, pte->paddr);
+	TRACE(DB_VM, "map 0x%x -> 0x%x", faultaddress, pte->paddr);
 
 	// spinlock_acquire(&tlb_lock);
 	int index = tlb_probe(ehi,0);
@@ -311,8 +363,25 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	return 0;
 }
 
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	int result;
+
+	as = curthread->t_addrspace;
+	if (as == NULL) {
+		return EFAULT; //as not setup
+	}
+	lock_acquire(as->as_lock);
+	result = vm_fault_locked(faulttype, faultaddress, as);
+	lock_release(as->as_lock);
+	return result;
+}
+
 bool
-vm_validitycheck(vaddr_t faultaddress,struct addrspace* pas, ax_permssion *perm)
+vm_validitycheck(vaddr_t faultaddress,struct addrspace* pas, ax_permssion *perm,
+	struct region_entry **region)
 {
 	KASSERT(pas != NULL);
 	/* Assert that the address space has been set up properly. */
@@ -323,21 +392,24 @@ vm_validitycheck(vaddr_t faultaddress,struct addrspace* pas, ax_permssion *perm)
 	{
 		vaddr_t base = process_regions->reg_base;
 		vaddr_t top = base + process_regions->bounds;
-		if(faultaddress >= base && faultaddress <= top)
+		if(faultaddress >= base && faultaddress < top)
 		{
 			*perm = process_regions->original_perm;
+			*region = process_regions;
 			return true;
 		}
 		process_regions = process_regions->next;
 	}
+	*region = NULL;
 	if(faultaddress >= pas->heap_start && faultaddress <= pas->heap_end)
 	{
 		*perm = AX_READ|AX_WRITE;
 		return true;
 	}
 	/*********** RR: check for stack range within 4MB from stack top ***********/
+	/* (less the slots at the bottom kept for other threads' stacks) */
 	if((faultaddress >= pas->stack_end - PAGE_SIZE && faultaddress <= USERSPACETOP)&&
-		(faultaddress >= USERSTACKBASE))
+		(faultaddress >= AS_STACKSTOP))
 	{
 		*perm = AX_READ|AX_WRITE;
 		if (faultaddress < pas->stack_end)
@@ -346,6 +418,13 @@ vm_validitycheck(vaddr_t faultaddress,struct addrspace* pas, ax_permssion *perm)
 		}
 		return true;
 	}
+	if (faultaddress >= (USERSTACKBASE) && faultaddress < AS_STACKSTOP &&
+		(pas->as_stacks &
+		 ((uint32_t)1 << ((faultaddress - (USERSTACKBASE)) / AS_STACKSIZE))))
+	{
+		*perm = AX_READ|AX_WRITE;
+		return true;
+	}
 
 	*perm = 0;
 	return false;
@@ -111,9 +111,10 @@ mainbus_bootstrap(void)
 	autoconf_lamebus(lamebus, 0);
 
 	/*
-	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
+	 * Configure the MIPS on-chip timer to interrupt clock_hz times a
+	 * second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(CPU_FREQUENCY / clock_hz);
 }
 
 /*
@@ -269,7 +270,7 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	else if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(CPU_FREQUENCY / clock_hz);
 		/* and call hardclock */
 		hardclock();
 	}
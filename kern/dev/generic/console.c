@@ -48,6 +48,12 @@
  *
  * Note that we have no input buffering; characters typed too rapidly
  * will be lost.
+ *
+ * Output, on the other hand, is buffered: see console.h. A write
+ * returns as soon as its characters are in the ring, and the device's
+ * interrupt handler sends them one at a time. Polled output (from
+ * interrupt handlers, or with interrupts off, as in a panic) first
+ * sends whatever is still in the ring so nothing comes out of order.
  */
 
 #include <types.h>
@@ -57,6 +63,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -111,14 +118,96 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * The output ring. All of these need cs_outlock.
+ */
+
+static
+unsigned
+con_outspace(struct con_softc *cs)
+{
+	return (cs->cs_outbuf_tail + CONSOLE_OUTPUT_BUFFER_SIZE -
+		cs->cs_outbuf_head - 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+}
+
+static
+int
+con_outtake(struct con_softc *cs)
+{
+	int ch;
+
+	KASSERT(cs->cs_outbuf_head != cs->cs_outbuf_tail);
+	ch = cs->cs_outbuf[cs->cs_outbuf_tail];
+	cs->cs_outbuf_tail =
+		(cs->cs_outbuf_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	return ch;
+}
+
+/*
+ * If the device is idle, start it on the next character.
+ */
+static
+void
+con_outkick(struct con_softc *cs)
+{
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	if (!cs->cs_outbusy && cs->cs_outbuf_head != cs->cs_outbuf_tail) {
+		cs->cs_outbusy = true;
+		cs->cs_send(cs->cs_devdata, con_outtake(cs));
+	}
+}
+
+/*
+ * Put LEN characters in the ring, sleeping whenever it's full.
+ */
+static
+void
+con_write(struct con_softc *cs, const char *buf, size_t len)
+{
+	unsigned n;
+
+	spinlock_acquire(&cs->cs_outlock);
+	while (len > 0) {
+		while (con_outspace(cs) == 0) {
+			wchan_lock(cs->cs_outwchan);
+			spinlock_release(&cs->cs_outlock);
+			wchan_sleep(cs->cs_outwchan);
+			spinlock_acquire(&cs->cs_outlock);
+		}
+		for (n = con_outspace(cs); n > 0 && len > 0; n--, len--) {
+			cs->cs_outbuf[cs->cs_outbuf_head] = *buf++;
+			cs->cs_outbuf_head = (cs->cs_outbuf_head + 1) %
+				CONSOLE_OUTPUT_BUFFER_SIZE;
+		}
+		con_outkick(cs);
+	}
+	spinlock_release(&cs->cs_outlock);
+}
+
+//////////////////////////////////////////////////
+
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Flush the ring first so buffered output isn't
+ * overtaken (or, in a panic, lost). If we already hold the ring lock
+ * we're nested inside con_write or con_start; just print.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	if (!spinlock_do_i_hold(&cs->cs_outlock)) {
+		spinlock_acquire(&cs->cs_outlock);
+		if (cs->cs_outbuf_head != cs->cs_outbuf_tail) {
+			while (cs->cs_outbuf_head != cs->cs_outbuf_tail) {
+				cs->cs_sendpolled(cs->cs_devdata,
+						  con_outtake(cs));
+			}
+			wchan_wakeall(cs->cs_outwchan);
+		}
+		spinlock_release(&cs->cs_outlock);
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -143,14 +232,15 @@ putch_complete_polled(struct con_softc *cs)
 //////////////////////////////////////////////////
 
 /*
- * Print a character, using interrupts to wait for I/O completion.
+ * Print a character through the ring.
  */
 static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_write(cs, &c, 1);
 }
 
 /*
@@ -198,13 +288,21 @@ con_input(void *vcs, int ch)
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next character, and once half the ring is free, let the
+ * writers waiting for space have another go.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outbusy = false;
+	con_outkick(cs);
+	if (con_outspace(cs) == CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_outwchan);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -298,6 +396,9 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/* Bytes of a user write to copy in at a time */
+#define CON_IOCHUNK 128
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
@@ -305,6 +406,8 @@ con_io(struct device *dev, struct uio *uio)
 	int result;
 	char ch;
 	struct lock *lk;
+	char inbuf[CON_IOCHUNK], outbuf[2 * CON_IOCHUNK];
+	size_t len, i, j;
 
 	(void)dev;  // unused
 
@@ -334,15 +437,20 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			len = uio->uio_resid < CON_IOCHUNK ?
+				uio->uio_resid : CON_IOCHUNK;
+			result = uiomove(inbuf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
+			for (i = j = 0; i < len; i++) {
+				if (inbuf[i]=='\n') {
+					outbuf[j++] = '\r';
+				}
+				outbuf[j++] = inbuf[i];
 			}
-			putch(ch);
+			con_write(dev->d_data, outbuf, j);
 		}
 	}
 	lock_release(lk);
@@ -398,7 +506,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *outwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -418,29 +527,33 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	outwc = wchan_create("console write");
+	if (outwc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = outwc;
+	cs->cs_outbusy = false;
+	cs->cs_outbuf_head = 0;
+	cs->cs_outbuf_tail = 0;
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -35,9 +35,20 @@
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output goes through a ring buffer. Writers put characters in the
+ * ring and return; the device's write-done interrupt (con_start) sends
+ * the next one. cs_outbusy is true while a character is on its way to
+ * the device, so the interrupt will come. Writers sleep on cs_outwchan
+ * only when the ring is full.
  */
 
+#include <spinlock.h>
+
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+
+struct wchan;
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -49,10 +60,16 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	struct spinlock cs_outlock;	/* protects the output fields */
+	struct wchan *cs_outwchan;	/* writers waiting for space */
+	bool cs_outbusy;		/* device is sending a char */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outbuf_head;	/* next slot to put a char in */
+	unsigned cs_outbuf_tail;	/* next slot to take a char out */
 };
 
 /*
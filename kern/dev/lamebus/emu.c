@@ -48,6 +48,8 @@
 #include <array.h>
 #include <uio.h>
 #include <synch.h>
+#include <wchan.h>
+#include <vm.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -117,20 +119,6 @@ emu_wreg(struct emu_softc *sc, uint32_t reg, uint32_t val)
 	bus_write_register(sc->e_busdata, sc->e_buspos, reg, val);
 }
 
-/*
- * Called by the underlying bus code when an interrupt happens
- */
-void
-emu_irq(void *dev)
-{
-	struct emu_softc *sc = dev;
-
-	sc->e_result = emu_rreg(sc, REG_RESULT);
-	emu_wreg(sc, REG_RESULT, 0);
-
-	V(sc->e_sem);
-}
-
 /*
  * Convert the error codes reported by the "hardware" to errnos.
  * Or, on cases that indicate a programming error in emu.c, panic.
@@ -160,14 +148,305 @@ translate_err(struct emu_softc *sc, uint32_t code)
 }
 
 /*
- * Wait for an operation to complete, and return an errno for the result.
+ * Requests.
+ *
+ * The device does one operation at a time, through one set of
+ * registers and one I/O buffer. Rather than have each caller hold the
+ * device for the whole of its operation, callers fill in a struct
+ * emu_req, with their own buffer, and queue it. The interrupt handler
+ * copies the results out of the I/O buffer into the request and starts
+ * the next request right away. So the device never sits idle waiting
+ * for a thread to wake up, the I/O buffer is only busy while the host
+ * is working, and any number of threads can have requests in flight.
+ *
+ * A request is waited for with emu_wait (emu_sync submits and waits,
+ * for the common case), or has a completion function, which the
+ * interrupt handler calls with e_qlock held just before marking the
+ * request complete. So it must be quick and must not sleep.
+ */
+struct emu_req {
+	uint32_t er_op;			/* EMU_OP_* */
+	uint32_t er_handle;		/* REG_HANDLE */
+	uint32_t er_offset;		/* REG_OFFSET */
+	uint32_t er_len;		/* REG_IOLEN */
+	void *er_buf;			/* data to send, or room for reply */
+
+	/* results, valid once er_complete is set */
+	int er_result;			/* errno */
+	uint32_t er_rhandle;		/* REG_HANDLE afterwards */
+	uint32_t er_roffset;		/* REG_OFFSET afterwards */
+	uint32_t er_rlen;		/* REG_IOLEN afterwards */
+	volatile bool er_complete;
+
+	/* called from the interrupt handler when done, if not NULL */
+	void (*er_done)(struct emu_softc *sc, struct emu_req *req);
+
+	struct emu_req *er_next;	/* in queue */
+};
+
+static
+void
+emu_req_init(struct emu_req *req, uint32_t op, uint32_t handle,
+	     uint32_t offset, uint32_t len, void *buf)
+{
+	req->er_op = op;
+	req->er_handle = handle;
+	req->er_offset = offset;
+	req->er_len = len;
+	req->er_buf = buf;
+	req->er_result = 0;
+	req->er_rhandle = 0;
+	req->er_roffset = 0;
+	req->er_rlen = 0;
+	req->er_complete = false;
+	req->er_done = NULL;
+	req->er_next = NULL;
+}
+
+/*
+ * Start the next queued request, if the device is free.
+ */
+static
+void
+emu_start(struct emu_softc *sc)
+{
+	struct emu_req *req;
+
+	KASSERT(spinlock_do_i_hold(&sc->e_qlock));
+
+	if (sc->e_cur != NULL || sc->e_qhead == NULL) {
+		return;
+	}
+	req = sc->e_qhead;
+	sc->e_qhead = req->er_next;
+	if (sc->e_qhead == NULL) {
+		sc->e_qtail = NULL;
+	}
+	sc->e_cur = req;
+
+	switch (req->er_op) {
+	    case EMU_OP_OPEN:
+	    case EMU_OP_CREATE:
+	    case EMU_OP_EXCLCREATE:
+	    case EMU_OP_WRITE:
+		memcpy(sc->e_iobuf, req->er_buf, req->er_len);
+		break;
+	}
+	emu_wreg(sc, REG_HANDLE, req->er_handle);
+	emu_wreg(sc, REG_IOLEN, req->er_len);
+	emu_wreg(sc, REG_OFFSET, req->er_offset);
+	emu_wreg(sc, REG_OPER, req->er_op);
+}
+
+/*
+ * Queue REQ. Returns at once; see emu_wait.
+ */
+static
+void
+emu_submit(struct emu_softc *sc, struct emu_req *req)
+{
+	KASSERT(req->er_len <= EMU_MAXIO);
+
+	req->er_complete = false;
+	req->er_next = NULL;
+
+	spinlock_acquire(&sc->e_qlock);
+	if (sc->e_qtail != NULL) {
+		sc->e_qtail->er_next = req;
+	}
+	else {
+		sc->e_qhead = req;
+	}
+	sc->e_qtail = req;
+	emu_start(sc);
+	spinlock_release(&sc->e_qlock);
+}
+
+/*
+ * Wait for REQ, which has no completion function, to finish, and
+ * return an errno for the result.
  */
 static
 int
-emu_waitdone(struct emu_softc *sc)
+emu_wait(struct emu_softc *sc, struct emu_req *req)
+{
+	spinlock_acquire(&sc->e_qlock);
+	while (!req->er_complete) {
+		wchan_lock(sc->e_wchan);
+		spinlock_release(&sc->e_qlock);
+		wchan_sleep(sc->e_wchan);
+		spinlock_acquire(&sc->e_qlock);
+	}
+	spinlock_release(&sc->e_qlock);
+	return req->er_result;
+}
+
+static
+int
+emu_sync(struct emu_softc *sc, struct emu_req *req)
+{
+	emu_submit(sc, req);
+	return emu_wait(sc, req);
+}
+
+/*
+ * Called by the underlying bus code when an interrupt happens
+ */
+void
+emu_irq(void *dev)
+{
+	struct emu_softc *sc = dev;
+	struct emu_req *req;
+	uint32_t code;
+
+	spinlock_acquire(&sc->e_qlock);
+
+	code = emu_rreg(sc, REG_RESULT);
+	emu_wreg(sc, REG_RESULT, 0);
+
+	req = sc->e_cur;
+	if (req == NULL) {
+		spinlock_release(&sc->e_qlock);
+		kprintf("emu%d: stray interrupt\n", sc->e_unit);
+		return;
+	}
+	sc->e_cur = NULL;
+
+	req->er_result = translate_err(sc, code);
+	if (req->er_result == 0) {
+		req->er_rhandle = emu_rreg(sc, REG_HANDLE);
+		req->er_roffset = emu_rreg(sc, REG_OFFSET);
+		req->er_rlen = emu_rreg(sc, REG_IOLEN);
+		if (req->er_op == EMU_OP_READ || req->er_op == EMU_OP_READDIR) {
+			KASSERT(req->er_rlen <= req->er_len);
+			memcpy(req->er_buf, sc->e_iobuf, req->er_rlen);
+		}
+	}
+
+	if (req->er_done != NULL) {
+		req->er_done(sc, req);
+	}
+	/* once er_complete is set a waiter may free REQ */
+	req->er_complete = true;
+
+	emu_start(sc);
+	wchan_wakeall(sc->e_wchan);
+	spinlock_release(&sc->e_qlock);
+}
+
+/*
+ * Bounce buffers of EMU_MAXIO bytes for requests to read into and
+ * write from. Up to EMU_NBUFS are made, as needed, and kept.
+ * emu_getbuf waits for one if they're all in use; emu_trygetbuf
+ * returns NULL instead. Both return NULL if out of memory.
+ *
+ * Finished read-aheads keep their buffers until absorbed into the
+ * cache, so emu_getbuf absorbs them itself rather than wait for a
+ * reader to come along. So it must not be called with e_lock held.
+ *
+ * Nobody holds one across a copy to or from user memory, which could
+ * fault back in here and want another; see emu_getuiobuf.
+ */
+static void emu_ra_absorb(struct emu_softc *sc);
+
+static
+void *
+emu_dogetbuf(struct emu_softc *sc, bool wait)
+{
+	void *buf;
+
+	spinlock_acquire(&sc->e_qlock);
+	while (sc->e_nfree == 0 && sc->e_nbufs == EMU_NBUFS) {
+		if (!wait) {
+			spinlock_release(&sc->e_qlock);
+			return NULL;
+		}
+		if (sc->e_radone != NULL) {
+			spinlock_release(&sc->e_qlock);
+			lock_acquire(sc->e_lock);
+			emu_ra_absorb(sc);
+			lock_release(sc->e_lock);
+			spinlock_acquire(&sc->e_qlock);
+			continue;
+		}
+		wchan_lock(sc->e_wchan);
+		spinlock_release(&sc->e_qlock);
+		wchan_sleep(sc->e_wchan);
+		spinlock_acquire(&sc->e_qlock);
+	}
+	if (sc->e_nfree > 0) {
+		buf = sc->e_bufs[--sc->e_nfree];
+		spinlock_release(&sc->e_qlock);
+		return buf;
+	}
+	sc->e_nbufs++;
+	spinlock_release(&sc->e_qlock);
+
+	buf = kmalloc(EMU_MAXIO);
+	if (buf == NULL) {
+		spinlock_acquire(&sc->e_qlock);
+		sc->e_nbufs--;
+		wchan_wakeall(sc->e_wchan);
+		spinlock_release(&sc->e_qlock);
+	}
+	return buf;
+}
+
+static
+void *
+emu_getbuf(struct emu_softc *sc)
+{
+	KASSERT(!lock_do_i_hold(sc->e_lock));
+	return emu_dogetbuf(sc, true);
+}
+
+static
+void *
+emu_trygetbuf(struct emu_softc *sc)
+{
+	return emu_dogetbuf(sc, false);
+}
+
+static
+void
+emu_putbuf(struct emu_softc *sc, void *buf)
+{
+	spinlock_acquire(&sc->e_qlock);
+	KASSERT(sc->e_nfree < EMU_NBUFS);
+	sc->e_bufs[sc->e_nfree++] = buf;
+	wchan_wakeall(sc->e_wchan);
+	spinlock_release(&sc->e_qlock);
+}
+
+/*
+ * Get a buffer for I/O to or from UIO, and give it back. Copying to or
+ * from user memory can fault, and a fault on a page mapped from this
+ * device comes back in here to read it, which may need a buffer from
+ * the pool. So pool buffers are never held across such a copy, or a
+ * few threads doing this at once could hold them all while each
+ * waits for another. A user uio gets a buffer of its own instead; a
+ * kernel uio can't fault and gets one from the pool.
+ */
+static
+void *
+emu_getuiobuf(struct emu_softc *sc, struct uio *uio)
+{
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return emu_getbuf(sc);
+	}
+	return kmalloc(EMU_MAXIO);
+}
+
+static
+void
+emu_putuiobuf(struct emu_softc *sc, struct uio *uio, void *buf)
 {
-	P(sc->e_sem);
-	return translate_err(sc, sc->e_result);
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		emu_putbuf(sc, buf);
+	}
+	else {
+		kfree(buf);
+	}
 }
 
 /*
@@ -182,6 +461,7 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 	 bool create, bool excl, mode_t mode,
 	 uint32_t *newhandle, int *newisdir)
 {
+	struct emu_req req;
 	uint32_t op;
 	int result;
 
@@ -202,20 +482,14 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 	/* mode isn't supported (yet?) */
 	(void)mode;
 
-	lock_acquire(sc->e_lock);
-
-	strcpy(sc->e_iobuf, name);
-	emu_wreg(sc, REG_IOLEN, strlen(name));
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	emu_req_init(&req, op, handle, 0, strlen(name), (char *)name);
+	result = emu_sync(sc, &req);
 
 	if (result==0) {
-		*newhandle = emu_rreg(sc, REG_HANDLE);
-		*newisdir = emu_rreg(sc, REG_IOLEN)>0;
+		*newhandle = req.er_rhandle;
+		*newisdir = req.er_rlen>0;
 	}
 
-	lock_release(sc->e_lock);
 	return result;
 }
 
@@ -228,21 +502,15 @@ static
 int
 emu_close(struct emu_softc *sc, uint32_t handle)
 {
+	struct emu_req req;
 	int result;
-	bool mine;
 	int retries = 0;
 
-	mine = lock_do_i_hold(sc->e_lock);
-	if (!mine) {
-		lock_acquire(sc->e_lock);
-	}
-
 	while (1) {
 		/* Retry operation up to 10 times */
 
-		emu_wreg(sc, REG_HANDLE, handle);
-		emu_wreg(sc, REG_OPER, EMU_OP_CLOSE);
-		result = emu_waitdone(sc);
+		emu_req_init(&req, EMU_OP_CLOSE, handle, 0, 0, NULL);
+		result = emu_sync(sc, &req);
 
 		if (result==EIO && retries < 10) {
 			kprintf("emu%d: I/O error on close, retrying\n", 
@@ -253,137 +521,436 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 		break;
 	}
 
-	if (!mine) {
-		lock_release(sc->e_lock);
-	}
 	return result;
 }
 
 /*
- * Common code for read and readdir.
+ * Read directory entries. (File reads go through the cache below.)
  */
 static
 int
-emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	   uint32_t op, struct uio *uio)
+emu_readdir(struct emu_softc *sc, uint32_t handle, uint32_t len,
+	    struct uio *uio)
 {
+	struct emu_req req;
+	void *buf;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
 
-	lock_acquire(sc->e_lock);
+	buf = emu_getuiobuf(sc, uio);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
-	if (result) {
-		goto out;
+	emu_req_init(&req, EMU_OP_READDIR, handle, uio->uio_offset, len, buf);
+	result = emu_sync(sc, &req);
+	if (result == 0) {
+		result = uiomove(buf, req.er_rlen, uio);
+		uio->uio_offset = req.er_roffset;
 	}
-	
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
 
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	emu_putuiobuf(sc, uio, buf);
+	return result;
+}
 
- out:
-	lock_release(sc->e_lock);
+/*
+ * Write to a hardware-level file handle.
+ */
+static
+int
+emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
+	  struct uio *uio)
+{
+	struct emu_req req;
+	void *buf;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	buf = emu_getuiobuf(sc, uio);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	emu_req_init(&req, EMU_OP_WRITE, handle, uio->uio_offset, len, buf);
+	result = uiomove(buf, len, uio);
+	if (result == 0) {
+		result = emu_sync(sc, &req);
+	}
+
+	emu_putuiobuf(sc, uio, buf);
 	return result;
 }
 
 /*
- * Read from a hardware-level file handle.
+ * Read up to LEN bytes at OFFSET from a hardware-level file handle into
+ * BUF, and return how many there were in *GOT.
  */
 static
 int
 emu_read(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	 struct uio *uio)
+	 uint32_t offset, void *buf, uint32_t *got)
 {
-	return emu_doread(sc, handle, len, EMU_OP_READ, uio);
+	struct emu_req req;
+	int result;
+
+	emu_req_init(&req, EMU_OP_READ, handle, offset, len, buf);
+	result = emu_sync(sc, &req);
+	if (result == 0) {
+		*got = req.er_rlen;
+	}
+	return result;
 }
 
 /*
- * Read a directory entry from a hardware-level file handle.
+ * Get the file size associated with a hardware-level file handle.
  */
 static
 int
-emu_readdir(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	    struct uio *uio)
+emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
-	return emu_doread(sc, handle, len, EMU_OP_READDIR, uio);
+	struct emu_req req;
+	int result;
+
+	emu_req_init(&req, EMU_OP_GETSIZE, handle, 0, 0, NULL);
+	result = emu_sync(sc, &req);
+	if (result==0) {
+		*retval = req.er_rlen;
+	}
+	return result;
 }
 
 /*
- * Write to a hardware-level file handle.
+ * Truncate a hardware-level file handle.
  */
 static
 int
-emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	  struct uio *uio)
+emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 {
-	int result;
+	struct emu_req req;
 
-	KASSERT(uio->uio_rw == UIO_WRITE);
+	emu_req_init(&req, EMU_OP_TRUNC, handle, 0, len, NULL);
+	return emu_sync(sc, &req);
+}
 
-	lock_acquire(sc->e_lock);
+//
+////////////////////////////////////////////////////////////
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+////////////////////////////////////////////////////////////
+//
+// Read cache
+//
 
-	result = uiomove(sc->e_iobuf, len, uio);
-	if (result) {
-		goto out;
+/*
+ * Each emu device keeps a small cache of file pages, shared by all
+ * its files and protected by e_lock. A read that misses fetches a
+ * whole EMU_MAXIO window in one operation and caches every page of
+ * it. So small reads, like the ELF loader's, and sequential reads
+ * cost one host round-trip per window instead of one per call. A
+ * page shorter than PAGE_SIZE is the end of the file.
+ *
+ * Reads of a full window or more that miss go straight through, so
+ * copying one big file doesn't push everything else out.
+ *
+ * When a full window comes in, the next one is read ahead
+ * asynchronously, and its first page is marked; the first read to hit
+ * the marked page starts the window after that. So a sequential
+ * reader finds each window already on its way. Each file has at most
+ * one read-ahead in flight (ev_ra). Its completion function runs in
+ * the interrupt handler, where e_lock can't be taken, so it just puts
+ * the request on e_radone, and the pages go into the cache the next
+ * time someone reads from the device (emu_ra_absorb). A read that
+ * wants a page of a window still on its way waits for it instead of
+ * asking the host a second time.
+ *
+ * e_lock is not held while waiting for the host, so other threads can
+ * use the cache meanwhile, nor while copying out to a user buffer,
+ * which can fault. Writes, truncates and reclaim drop the
+ * affected pages and bump the file's ev_gen, so that data fetched
+ * before then is thrown away rather than cached.
+ *
+ * The cache assumes nothing but OS/161 changes the files while they're
+ * open; changes made on the host side may not be seen until the vnode
+ * is reclaimed.
+ */
+
+/* Pages per device. */
+#define EMU_CACHEPAGES 32
+
+/* Pages per EMU_MAXIO window. */
+#define EMU_WINDOWPAGES (EMU_MAXIO / PAGE_SIZE)
+
+struct emu_cpage {
+	struct emufs_vnode *cp_vn;	/* file, or NULL if slot is free */
+	uint32_t cp_pageno;		/* page within the file */
+	uint32_t cp_len;		/* valid bytes */
+	unsigned cp_stamp;		/* last use, for LRU */
+	bool cp_ramark;			/* hitting this starts a read-ahead */
+	char *cp_data;			/* PAGE_SIZE bytes, once allocated */
+};
+
+/* A read-ahead in flight. */
+struct emu_ra {
+	struct emu_req ra_req;		/* must be first */
+	struct emufs_vnode *ra_vn;	/* file */
+	uint32_t ra_pageno;		/* first page of window */
+	unsigned ra_gen;		/* ra_vn->ev_gen when started */
+	unsigned ra_waiters;		/* reads waiting for it */
+	struct emu_ra *ra_next;		/* on e_radone */
+};
+
+static
+struct emu_cpage *
+emu_cache_find(struct emu_softc *sc, struct emufs_vnode *ev, uint32_t pageno)
+{
+	struct emu_cpage *cp;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	for (i=0; i<EMU_CACHEPAGES; i++) {
+		cp = &sc->e_cache[i];
+		if (cp->cp_vn == ev && cp->cp_pageno == pageno) {
+			cp->cp_stamp = ++sc->e_cachestamp;
+			return cp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Pick a slot for a new page: a free one if there is one, otherwise
+ * the least recently used. Returns NULL if out of memory.
+ */
+static
+struct emu_cpage *
+emu_cache_victim(struct emu_softc *sc)
+{
+	struct emu_cpage *cp, *best;
+	unsigned i;
+
+	best = NULL;
+	for (i=0; i<EMU_CACHEPAGES; i++) {
+		cp = &sc->e_cache[i];
+		if (cp->cp_vn == NULL) {
+			best = cp;
+			break;
+		}
+		if (best == NULL || (int)(cp->cp_stamp - best->cp_stamp) < 0) {
+			/* older, allowing for the stamp wrapping */
+			best = cp;
+		}
+	}
+	if (best->cp_data == NULL) {
+		best->cp_data = kmalloc(PAGE_SIZE);
+		if (best->cp_data == NULL) {
+			return NULL;
+		}
 	}
+	best->cp_vn = NULL;
+	return best;
+}
 
-	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
-	result = emu_waitdone(sc);
+/*
+ * Put the GOT bytes in BUF, read from page PAGENO of EV onwards, into
+ * the cache, and return the first page (or NULL if out of memory).
+ */
+static
+struct emu_cpage *
+emu_cache_insert(struct emu_softc *sc, struct emufs_vnode *ev,
+		 uint32_t pageno, const char *buf, uint32_t got)
+{
+	struct emu_cpage *cp, *first;
+	uint32_t len, i;
 
- out:
-	lock_release(sc->e_lock);
-	return result;
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	/* the first page goes in even if empty, to remember the EOF */
+	first = NULL;
+	for (i = 0; i == 0 || i * PAGE_SIZE < got; i++) {
+		len = got - i * PAGE_SIZE;
+		if (len > PAGE_SIZE) {
+			len = PAGE_SIZE;
+		}
+		cp = emu_cache_find(sc, ev, pageno + i);
+		if (cp == NULL) {
+			cp = emu_cache_victim(sc);
+			if (cp == NULL) {
+				break;
+			}
+		}
+		memcpy(cp->cp_data, buf + i * PAGE_SIZE, len);
+		cp->cp_vn = ev;
+		cp->cp_pageno = pageno + i;
+		cp->cp_len = len;
+		cp->cp_stamp = ++sc->e_cachestamp;
+		cp->cp_ramark = false;
+		if (i == 0) {
+			first = cp;
+		}
+		if (len < PAGE_SIZE) {
+			break;
+		}
+	}
+	return first;
 }
 
 /*
- * Get the file size associated with a hardware-level file handle.
+ * Drop EV's cached pages from FROMPAGE on, along with its last page if
+ * that was short, since the file may have grown over it.
  */
 static
-int
-emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
+void
+emu_cache_drop(struct emu_softc *sc, struct emufs_vnode *ev,
+	       uint32_t frompage)
 {
-	int result;
+	struct emu_cpage *cp;
+	unsigned i;
 
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
-	result = emu_waitdone(sc);
-	if (result==0) {
-		*retval = emu_rreg(sc, REG_IOLEN);
+	ev->ev_gen++;
+	for (i=0; i<EMU_CACHEPAGES; i++) {
+		cp = &sc->e_cache[i];
+		if (cp->cp_vn == ev &&
+		    (cp->cp_pageno >= frompage || cp->cp_len < PAGE_SIZE)) {
+			cp->cp_vn = NULL;
+		}
 	}
+}
 
-	lock_release(sc->e_lock);
-	return result;
+/*
+ * Completion function for read-aheads. Runs in the interrupt handler.
+ */
+static
+void
+emu_ra_done(struct emu_softc *sc, struct emu_req *req)
+{
+	struct emu_ra *ra = (struct emu_ra *)req;
+
+	KASSERT(spinlock_do_i_hold(&sc->e_qlock));
+	ra->ra_next = sc->e_radone;
+	sc->e_radone = ra;
 }
 
 /*
- * Truncate a hardware-level file handle.
+ * Start reading ahead the window at PAGENO of EV, unless one is already
+ * on its way or no buffer is free right now.
  */
 static
-int
-emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
+void
+emu_ra_start(struct emu_softc *sc, struct emufs_vnode *ev, uint32_t pageno)
 {
-	int result;
+	struct emu_ra *ra;
+	void *buf;
 
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	if (ev->ev_ra != NULL) {
+		return;
+	}
+	buf = emu_trygetbuf(sc);
+	if (buf == NULL) {
+		return;
+	}
+	ra = kmalloc(sizeof(*ra));
+	if (ra == NULL) {
+		emu_putbuf(sc, buf);
+		return;
+	}
+	emu_req_init(&ra->ra_req, EMU_OP_READ, ev->ev_handle,
+		     pageno * PAGE_SIZE, EMU_MAXIO, buf);
+	ra->ra_req.er_done = emu_ra_done;
+	ra->ra_vn = ev;
+	ra->ra_pageno = pageno;
+	ra->ra_gen = ev->ev_gen;
+	ra->ra_waiters = 0;
+	ev->ev_ra = ra;
+	emu_submit(sc, &ra->ra_req);
+}
+
+/*
+ * Move finished read-aheads into the cache. One that reads are still
+ * waiting for is left for the last of them to free; ra_vn is cleared
+ * to say it's been dealt with.
+ */
+static
+void
+emu_ra_absorb(struct emu_softc *sc)
+{
+	struct emu_ra *ra, *next;
+	struct emu_cpage *cp;
+	struct emufs_vnode *ev;
+
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	spinlock_acquire(&sc->e_qlock);
+	ra = sc->e_radone;
+	sc->e_radone = NULL;
+	spinlock_release(&sc->e_qlock);
+
+	for (; ra != NULL; ra = next) {
+		next = ra->ra_next;
+		ev = ra->ra_vn;
+		KASSERT(ev->ev_ra == ra);
+		ev->ev_ra = NULL;
+		if (ra->ra_req.er_result == 0 && ra->ra_gen == ev->ev_gen) {
+			cp = emu_cache_insert(sc, ev, ra->ra_pageno,
+					      ra->ra_req.er_buf,
+					      ra->ra_req.er_rlen);
+			if (cp != NULL && ra->ra_req.er_rlen == EMU_MAXIO) {
+				cp->cp_ramark = true;
+			}
+		}
+		emu_putbuf(sc, ra->ra_req.er_buf);
+		ra->ra_vn = NULL;
+		if (ra->ra_waiters == 0) {
+			kfree(ra);
+		}
+	}
+}
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
-	result = emu_waitdone(sc);
+/*
+ * Wait for read-ahead RA to finish and absorb it. e_lock is dropped
+ * while waiting.
+ */
+static
+void
+emu_ra_wait(struct emu_softc *sc, struct emu_ra *ra)
+{
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
+	ra->ra_waiters++;
 	lock_release(sc->e_lock);
-	return result;
+	emu_wait(sc, &ra->ra_req);
+	lock_acquire(sc->e_lock);
+
+	/* it's on e_radone by now, if nobody got to it first */
+	emu_ra_absorb(sc);
+	KASSERT(ra->ra_vn == NULL);
+	if (--ra->ra_waiters == 0) {
+		kfree(ra);
+	}
+}
+
+/*
+ * Wait for EV's read-ahead, if any, and absorb it. Called with e_lock
+ * held, which is kept, so only for when the file is going away and
+ * nobody else can be waiting for it.
+ */
+static
+void
+emu_ra_finish(struct emu_softc *sc, struct emufs_vnode *ev)
+{
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	if (ev->ev_ra != NULL) {
+		KASSERT(ev->ev_ra->ra_waiters == 0);
+		emu_wait(sc, &ev->ev_ra->ra_req);
+		emu_ra_absorb(sc);
+		KASSERT(ev->ev_ra == NULL);
+	}
 }
 
 //
@@ -472,7 +1039,7 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need both of these locks, e_lock to protect the device
+	 * Need both of these locks, e_lock to protect the cache
 	 * and vfs_biglock to protect the fs-related material.
 	 */
 
@@ -485,6 +1052,9 @@ emufs_reclaim(struct vnode *v)
 		return EBUSY;
 	}
 
+	/* the read-ahead would otherwise land on a dead vnode */
+	emu_ra_finish(ev->ev_emu, ev);
+
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
@@ -492,6 +1062,7 @@ emufs_reclaim(struct vnode *v)
 		vfs_biglock_release();
 		return result;
 	}
+	emu_cache_drop(ev->ev_emu, ev, 0);
 
 	num = vnodearray_num(ef->ef_vnodes);
 	ix = num;
@@ -527,32 +1098,145 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
-	size_t oldresid;
+	struct emu_softc *sc = ev->ev_emu;
+	struct emu_cpage *cp;
+	struct emu_ra *ra;
+	uint32_t offset, pageno, pgoff, amt, got;
+	unsigned gen;
+	char *buf;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	/*
+	 * A user buffer may be mapped from this very device, so copying
+	 * to it can fault and come back in here. So data goes to the
+	 * user by way of BUF, with e_lock let go; BUF is our own, not
+	 * from the pool (see emu_getuiobuf). A kernel buffer can't
+	 * fault, and cached pages are copied to it directly. BUF, once
+	 * we have one, is kept until we're done.
+	 */
+	buf = NULL;
+
+	lock_acquire(sc->e_lock);
+	emu_ra_absorb(sc);
+
+	result = 0;
 	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
+		offset = uio->uio_offset;
+		pageno = offset / PAGE_SIZE;
+		pgoff = offset % PAGE_SIZE;
+		cp = emu_cache_find(sc, ev, pageno);
+
+		if (cp != NULL && uio->uio_segflg != UIO_SYSSPACE &&
+		    buf == NULL) {
+			/* get one and look again */
+			lock_release(sc->e_lock);
+			buf = emu_getuiobuf(sc, uio);
+			lock_acquire(sc->e_lock);
+			if (buf == NULL) {
+				result = ENOMEM;
+				break;
+			}
+			continue;
 		}
 
-		oldresid = uio->uio_resid;
+		if (cp != NULL) {
+			if (cp->cp_ramark) {
+				cp->cp_ramark = false;
+				emu_ra_start(sc, ev, pageno + EMU_WINDOWPAGES);
+			}
+			if (pgoff >= cp->cp_len) {
+				/* EOF */
+				break;
+			}
+			amt = cp->cp_len - pgoff;
+			if (amt > uio->uio_resid) {
+				amt = uio->uio_resid;
+			}
+			if (uio->uio_segflg == UIO_SYSSPACE) {
+				result = uiomove(cp->cp_data + pgoff, amt, uio);
+			}
+			else {
+				memcpy(buf, cp->cp_data + pgoff, amt);
+				lock_release(sc->e_lock);
+				result = uiomove(buf, amt, uio);
+				lock_acquire(sc->e_lock);
+			}
+			if (result) {
+				break;
+			}
+			continue;
+		}
+
+		ra = ev->ev_ra;
+		if (ra != NULL && pageno - ra->ra_pageno < EMU_WINDOWPAGES) {
+			/* already on its way */
+			emu_ra_wait(sc, ra);
+			continue;
+		}
+
+		/*
+		 * Miss. Go to the host without e_lock, so the cache stays
+		 * usable meanwhile; ev_gen says if the data went stale.
+		 */
+		gen = ev->ev_gen;
+		lock_release(sc->e_lock);
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		if (buf == NULL) {
+			buf = emu_getuiobuf(sc, uio);
+			if (buf == NULL) {
+				lock_acquire(sc->e_lock);
+				result = ENOMEM;
+				break;
+			}
+		}
+		if (uio->uio_resid >= EMU_MAXIO) {
+			/* big read: go straight through (see above) */
+			result = emu_read(sc, ev->ev_handle, EMU_MAXIO,
+					  offset, buf, &got);
+			if (result == 0) {
+				result = uiomove(buf, got, uio);
+			}
+			lock_acquire(sc->e_lock);
+			if (result || got == 0) {
+				break;
+			}
+			continue;
+		}
+		result = emu_read(sc, ev->ev_handle, EMU_MAXIO,
+				  pageno * PAGE_SIZE, buf, &got);
+
+		lock_acquire(sc->e_lock);
+		emu_ra_absorb(sc);
 		if (result) {
-			return result;
+			break;
 		}
-		
-		if (uio->uio_resid == oldresid) {
-			/* nothing read - EOF */
+		if (ev->ev_gen == gen) {
+			cp = emu_cache_insert(sc, ev, pageno, buf, got);
+			if (cp != NULL && got == EMU_MAXIO) {
+				emu_ra_start(sc, ev, pageno + EMU_WINDOWPAGES);
+			}
+		}
+
+		/* this read gets what was fetched even if it wasn't cached */
+		amt = got > pgoff ? got - pgoff : 0;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		lock_release(sc->e_lock);
+		result = uiomove(buf + pgoff, amt, uio);
+		lock_acquire(sc->e_lock);
+		if (result || amt == 0) {
 			break;
 		}
 	}
 
-	return 0;
+	lock_release(sc->e_lock);
+	if (buf != NULL) {
+		emu_putuiobuf(sc, uio, buf);
+	}
+	return result;
 }
 
 /*
@@ -585,10 +1269,13 @@ emufs_write(struct vnode *v, struct uio *uio)
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	start = uio->uio_offset;
+	result = 0;
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -599,7 +1286,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -608,7 +1295,17 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	/*
+	 * Forget what we knew only after writing, so nobody can cache
+	 * the old contents again in between. Done on error too, since
+	 * some of the data may have gone out.
+	 */
+	lock_acquire(ev->ev_emu->e_lock);
+	emu_cache_drop(ev->ev_emu, ev, start / PAGE_SIZE);
+	ev->ev_sizevalid = false;
+	lock_release(ev->ev_emu->e_lock);
+
+	return result;
 }
 
 /*
@@ -641,10 +1338,18 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
-	if (result) {
-		return result;
+	/* only ask the host if a write or truncate has made us forget */
+	lock_acquire(ev->ev_emu->e_lock);
+	if (!ev->ev_sizevalid) {
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			lock_release(ev->ev_emu->e_lock);
+			return result;
+		}
+		ev->ev_sizevalid = true;
 	}
+	statbuf->st_size = ev->ev_size;
+	lock_release(ev->ev_emu->e_lock);
 
 	result = VOP_GETTYPE(v, &statbuf->st_mode);
 	if (result) {
@@ -717,7 +1422,20 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	lock_acquire(ev->ev_emu->e_lock);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	emu_cache_drop(ev->ev_emu, ev, len / PAGE_SIZE);
+	if (result == 0) {
+		ev->ev_size = len;
+		ev->ev_sizevalid = true;
+	}
+	else {
+		ev->ev_sizevalid = false;
+	}
+	lock_release(ev->ev_emu->e_lock);
+	return result;
 }
 
 /*
@@ -741,6 +1459,11 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 		return result;
 	}
 
+	/* the directory may have grown */
+	lock_acquire(ev->ev_emu->e_lock);
+	ev->ev_sizevalid = false;
+	lock_release(ev->ev_emu->e_lock);
+
 	result = emufs_loadvnode(ef, handle, isdir, &newguy);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
@@ -836,14 +1559,15 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 }
 
 /*
- * VOP_MMAP
+ * VOP_MMAP - files can be mapped; the VM system does the I/O with
+ * VOP_READ and VOP_WRITE.
  */
 static
 int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 //////////////////////////////
@@ -1182,6 +1906,10 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_size = 0;
+	ev->ev_sizevalid = false;
+	ev->ev_gen = 0;
+	ev->ev_ra = NULL;
 
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
@@ -1338,14 +2066,29 @@ config_emu(struct emu_softc *sc, int emuno)
 	if (sc->e_lock == NULL) {
 		return ENOMEM;
 	}
-	sc->e_sem = sem_create("emufs-sem", 0);
-	if (sc->e_sem == NULL) {
+	sc->e_wchan = wchan_create("emufs");
+	if (sc->e_wchan == NULL) {
 		lock_destroy(sc->e_lock);
 		sc->e_lock = NULL;
 		return ENOMEM;
 	}
+	spinlock_init(&sc->e_qlock);
+	sc->e_cur = sc->e_qhead = sc->e_qtail = NULL;
+	sc->e_nfree = sc->e_nbufs = 0;
+	sc->e_radone = NULL;
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
+	/* pages themselves are allocated as the cache fills */
+	sc->e_cache = kmalloc(EMU_CACHEPAGES * sizeof(struct emu_cpage));
+	if (sc->e_cache == NULL) {
+		wchan_destroy(sc->e_wchan);
+		lock_destroy(sc->e_lock);
+		sc->e_lock = NULL;
+		return ENOMEM;
+	}
+	bzero(sc->e_cache, EMU_CACHEPAGES * sizeof(struct emu_cpage));
+	sc->e_cachestamp = 0;
+
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
 	return emufs_addtovfs(sc, name);
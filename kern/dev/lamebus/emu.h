@@ -30,9 +30,11 @@
 #ifndef _LAMEBUS_EMU_H_
 #define _LAMEBUS_EMU_H_
 
+#include <spinlock.h>
 
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
+#define EMU_NBUFS       4	/* bounce buffers per device */
 
 /*
  * The per-device data used by the emufs device driver.
@@ -47,12 +49,23 @@ struct emu_softc {
 	int e_unit;
 
 	/* Initialized by config_emu() */
-	struct lock *e_lock;
-	struct semaphore *e_sem;
+	struct lock *e_lock;		/* cache and vnode state */
 	void *e_iobuf;
 
-	/* Written by the interrupt handler */
-	uint32_t e_result;
+	/* Request queue and bounce buffers, protected by e_qlock */
+	struct spinlock e_qlock;
+	struct wchan *e_wchan;		/* for request and buffer waiters */
+	struct emu_req *e_cur;		/* on the device now */
+	struct emu_req *e_qhead;	/* waiting for the device */
+	struct emu_req *e_qtail;
+	void *e_bufs[EMU_NBUFS];	/* free buffers */
+	unsigned e_nfree;		/* how many in e_bufs */
+	unsigned e_nbufs;		/* how many made */
+	struct emu_ra *e_radone;	/* finished read-aheads */
+
+	/* Read cache of file pages, protected by e_lock (see emu.c) */
+	struct emu_cpage *e_cache;
+	unsigned e_cachestamp;		/* for LRU */
 };
 
 /* Functions called by lower-level drivers */
@@ -35,7 +35,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
-#include <synch.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -59,6 +59,9 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Size of the bounce buffer for I/O to/from user memory, in sectors */
+#define LHD_BOUNCESECTS 8
+
 /*
  * Shortcut for reading a register.
  */
@@ -95,41 +98,194 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the hardware on the next sector of the current request.
+ * Called with lh_lock held.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_startsector(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_request *req = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(req != NULL && req->lr_done < req->lr_nsects);
+
+	/*
+	 * Are we writing? If so, transfer the data to the
+	 * on-card buffer.
+	 */
+	if (req->lr_iswrite) {
+		memcpy(lh->lh_buf, req->lr_buf + req->lr_done*LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->lr_sector + req->lr_done);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * If the disk is idle, pick the next request and start it.
+ * Called with lh_lock held.
+ *
+ * Requests are served in C-SCAN order: the head sweeps upward taking
+ * the first request at or past where it is, then jumps back to the
+ * lowest pending request and sweeps again. Each request waits at
+ * most one sweep, and requests for adjacent sectors are served back
+ * to back. (The hardware moves only one sector per operation, so
+ * there's nothing to gain by merging them into a single request.)
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct lhd_request **pp;
+
+	if (lh->lh_cur != NULL || lh->lh_queue == NULL) {
+		return;
+	}
+
+	/* The queue is sorted; find the first request past the head */
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->lr_next) {
+		if ((*pp)->lr_sector >= lh->lh_headpos) {
+			break;
+		}
+	}
+	if (*pp == NULL) {
+		/* Nothing further up; wrap around to the start */
+		pp = &lh->lh_queue;
+	}
+
+	lh->lh_cur = *pp;
+	*pp = lh->lh_cur->lr_next;
+	lh->lh_cur->lr_next = NULL;
+
+	lhd_startsector(lh);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, finish the sector, and start the next one.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct lhd_request *req;
 	uint32_t val;
+	int err;
 	
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
 	    case LHD_IDLE:
 	    case LHD_WORKING:
-		break;
+		return;
 	    case LHD_OK:
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
+	    default:
+		return;
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+
+	req = lh->lh_cur;
+	if (req == NULL) {
+		/* Spurious */
+		spinlock_release(&lh->lh_lock);
+		return;
+	}
+
+	err = lhd_code_to_errno(lh, val);
+
+	/*
+	 * Are we reading? If so, and if we succeeded,
+	 * transfer the data out of the on-card buffer.
+	 */
+	if (err == 0 && !req->lr_iswrite) {
+		memcpy(req->lr_buf + req->lr_done*LHD_SECTSIZE, lh->lh_buf,
+		       LHD_SECTSIZE);
+	}
+	lh->lh_headpos = req->lr_sector + req->lr_done;
+	req->lr_done++;
+
+	if (err == 0 && req->lr_done < req->lr_nsects) {
+		/* More of this request to go */
+		lhd_startsector(lh);
+	}
+	else {
+		/* Request finished; wake the waiter and go on to the next */
+		req->lr_result = err;
+		req->lr_finished = true;
+		lh->lh_cur = NULL;
+		wchan_wakeall(lh->lh_wchan);
+		lhd_start(lh);
+	}
+
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Queue a request. See lhd.h.
+ */
+void
+lhd_submit(struct lhd_softc *lh, struct lhd_request *req, uint32_t sector,
+	   uint32_t nsects, void *buf, bool iswrite)
+{
+	struct lhd_request **pp;
+
+	KASSERT(nsects > 0);
+	KASSERT(sector + nsects <= lh->lh_dev.d_blocks);
+
+	req->lr_sector = sector;
+	req->lr_nsects = nsects;
+	req->lr_done = 0;
+	req->lr_buf = buf;
+	req->lr_iswrite = iswrite;
+	req->lr_result = 0;
+	req->lr_finished = false;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	/* Insert in sector order, after any requests for the same sector */
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->lr_next) {
+		if ((*pp)->lr_sector > sector) {
+			break;
+		}
+	}
+	req->lr_next = *pp;
+	*pp = req;
+
+	lhd_start(lh);
+
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Wait for a request to finish. See lhd.h.
+ */
+int
+lhd_wait(struct lhd_softc *lh, struct lhd_request *req)
+{
+	int result;
+
+	spinlock_acquire(&lh->lh_lock);
+	while (!req->lr_finished) {
+		wchan_lock(lh->lh_wchan);
+		spinlock_release(&lh->lh_lock);
+		wchan_sleep(lh->lh_wchan);
+		spinlock_acquire(&lh->lh_lock);
 	}
+	result = req->lr_result;
+	spinlock_release(&lh->lh_lock);
+	return result;
 }
 
 /*
@@ -195,19 +351,26 @@ lhd_reset(struct lhd_softc *lh)
 
 /*
  * I/O function (for both reads and writes)
+ *
+ * Transfers are done through lhd_submit/lhd_wait. A uio that is a
+ * single kernel buffer (the usual case, from the file system and the
+ * VM system) is used directly; anything else is bounced through a
+ * kernel buffer a chunk at a time.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct lhd_request req;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	uint32_t n;
+	char *buf;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -220,59 +383,55 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
+	}
+
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1) {
+		/* Do it in place */
+		lhd_submit(lh, &req, sector, len, uio->uio_iov->iov_kbase,
+			   iswrite);
+		result = lhd_wait(lh, &req);
+		if (result) {
+			return result;
+		}
+		uio->uio_iov->iov_kbase =
+			(char *)uio->uio_iov->iov_kbase + len*LHD_SECTSIZE;
+		uio->uio_iov->iov_len -= len*LHD_SECTSIZE;
+		uio->uio_offset += len*LHD_SECTSIZE;
+		uio->uio_resid -= len*LHD_SECTSIZE;
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	buf = kmalloc(LHD_BOUNCESECTS*LHD_SECTSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	result = 0;
+	while (len > 0 && result == 0) {
+		n = len < LHD_BOUNCESECTS ? len : LHD_BOUNCESECTS;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (iswrite) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
+		lhd_submit(lh, &req, sector, n, buf, iswrite);
+		result = lhd_wait(lh, &req);
 
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (result == 0 && !iswrite) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -289,15 +448,13 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_headpos = 0;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
 		return ENOMEM;
 	}
 
@@ -31,12 +31,33 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
+
+struct wchan;
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+/*
+ * A disk request: NSECTS sectors starting at SECTOR, to or from the
+ * kernel buffer BUF. Requests are queued on the disk and served in
+ * C-SCAN order by the interrupt handler; see lhd.c. The caller
+ * provides the request (usually on its stack), so starting I/O never
+ * needs memory.
+ */
+struct lhd_request {
+	uint32_t lr_sector;		/* First sector */
+	uint32_t lr_nsects;		/* Number of sectors */
+	uint32_t lr_done;		/* Sectors transferred so far */
+	char *lr_buf;			/* Data */
+	bool lr_iswrite;		/* Direction */
+	int lr_result;			/* Result, once complete */
+	bool lr_finished;		/* Set on completion */
+	struct lhd_request *lr_next;	/* Next in queue */
+};
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,9 +72,11 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the fields below */
+	struct lhd_request *lh_queue;	/* Pending requests, by sector */
+	struct lhd_request *lh_cur;	/* Request in progress, if any */
+	uint32_t lh_headpos;		/* Last sector the head was at */
+	struct wchan *lh_wchan;		/* Where to wait for completion */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -61,4 +84,13 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/*
+ * Asynchronous I/O. lhd_submit fills in REQ and queues it, and
+ * returns at once; lhd_wait waits for it to finish and returns its
+ * result. REQ and BUF must stay valid until then.
+ */
+void lhd_submit(struct lhd_softc *lh, struct lhd_request *req,
+		uint32_t sector, uint32_t nsects, void *buf, bool iswrite);
+int lhd_wait(struct lhd_softc *lh, struct lhd_request *req);
+
 #endif /* _LAMEBUS_LHD_H_ */
@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <lib.h>
+#include <trace.h>
 #include <platform/bus.h>
 #include <lamebus/ltrace.h>
 #include "autoconf.h"
@@ -44,6 +45,7 @@ static struct ltrace_softc *the_trace;
 void
 ltrace_on(uint32_t code)
 {
+	trace_mark(code);
 	if (the_trace != NULL) {
 		bus_write_register(the_trace->lt_busdata, the_trace->lt_buspos,
 				   LTRACE_REG_TRON, code);
@@ -53,6 +55,7 @@ ltrace_on(uint32_t code)
 void
 ltrace_off(uint32_t code)
 {
+	trace_mark(code);
 	if (the_trace != NULL) {
 		bus_write_register(the_trace->lt_busdata, the_trace->lt_buspos,
 				   LTRACE_REG_TROFF, code);
@@ -62,6 +65,7 @@ ltrace_off(uint32_t code)
 void
 ltrace_debug(uint32_t code)
 {
+	trace_mark(code);
 	if (the_trace != NULL) {
 		bus_write_register(the_trace->lt_busdata, the_trace->lt_buspos,
 				   LTRACE_REG_DEBUG, code);
@@ -55,6 +55,10 @@ struct ltrace_softc {
  * more, people often use the speaker or the top left corner of the
  * screen for this purpose.)
  *
+ * ltrace_on, ltrace_off and ltrace_debug also leave a trace_mark()
+ * with CODE in the kernel's own trace buffers (see trace.h), so a
+ * region bracketed with them can be found in both traces.
+ *
  * ltrace_dump dumps the entire system state and is primarily intended
  * for regression testing of System/161. It might or might not prove
  * useful for debugging as well.
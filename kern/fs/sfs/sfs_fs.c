@@ -44,22 +44,24 @@
 #include <sfs.h>
 
 /* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
-#define SFS_FS_BITBLOCKS(sfs)   SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks)
+#define SFS_FS_BITMAPSIZE(sfs)  \
+	SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks, (sfs)->sfs_blocksize)
+#define SFS_FS_BITBLOCKS(sfs)   \
+	SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks, (sfs)->sfs_blocksize)
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
  * We always do the whole bitmap at once; writing individual sectors
  * might or might not be a worthwhile optimization.
  *
- * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
- * bits, one bit for each sector on the filesystem. The number of
- * blocks in the bitmap is thus rounded up to the nearest multiple of
- * 512*8 = 4096. (This rounded number is SFS_BITMAPSIZE.) This means
- * that the bitmap will (in general) contain space for some number of
- * invalid sectors that are actually beyond the end of the disk
- * device. This is ok. These sectors are supposed to be marked "in
- * use" by mksfs and never get marked "free".
+ * The free block bitmap consists of SFS_BITBLOCKS blocks of bits, one
+ * bit for each block on the filesystem. The number of blocks in the
+ * bitmap is thus rounded up to the nearest multiple of the number of
+ * bits in a block (4096 for 512-byte blocks). (This rounded number is
+ * SFS_BITMAPSIZE.) This means that the bitmap will (in general)
+ * contain space for some number of invalid blocks that are actually
+ * beyond the end of the disk device. This is ok. These blocks are
+ * supposed to be marked "in use" by mksfs and never get marked "free".
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
@@ -79,13 +81,13 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 	/* Pointer to our bitmap data in memory. */
 	bitdata = bitmap_getdata(sfs->sfs_freemap);
 	
-	/* For each sector in the bitmap... */
+	/* For each block in the bitmap... */
 	for (j=0; j<mapsize; j++) {
 
 		/* Get a pointer to its data */
-		void *ptr = bitdata + j*SFS_BLOCKSIZE;
+		void *ptr = bitdata + j*sfs->sfs_blocksize;
 
-		/* and read or write it. The bitmap starts at sector 2. */ 
+		/* and read or write it. The bitmap starts at block 2. */ 
 		if (rw == UIO_READ) {
 			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
 		}
@@ -167,7 +169,7 @@ sfs_sync(struct fs *fs)
 
 	/* If the superblock needs to be written, write it. */
 	if (sfs->sfs_superdirty) {
-		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+		result = sfs_wmeta(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 		if (result) {
 			vfs_biglock_release();
 			return result;
@@ -198,6 +200,50 @@ sfs_getvolname(struct fs *fs)
 	return ret;
 }
 
+/*
+ * Allocate the block-sized scratch buffers. sfs_blocksize must be set.
+ */
+static
+int
+sfs_allocbufs(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	sfs->sfs_iobuf = kmalloc(sfs->sfs_blocksize);
+	sfs->sfs_zeros = kmalloc(sfs->sfs_blocksize);
+	sfs->sfs_dirbuf = kmalloc(sfs->sfs_blocksize);
+	if (sfs->sfs_iobuf == NULL || sfs->sfs_zeros == NULL ||
+	    sfs->sfs_dirbuf == NULL) {
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_zeros, sfs->sfs_blocksize);
+
+	for (i=0; i<3; i++) {
+		sfs->sfs_idbuf[i] = kmalloc(sfs->sfs_blocksize);
+		if (sfs->sfs_idbuf[i] == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Free the scratch buffers. Works on partially allocated sets too.
+ */
+static
+void
+sfs_freebufs(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	kfree(sfs->sfs_iobuf);
+	kfree(sfs->sfs_zeros);
+	kfree(sfs->sfs_dirbuf);
+	for (i=0; i<3; i++) {
+		kfree(sfs->sfs_idbuf[i]);
+	}
+}
+
 /*
  * Unmount code.
  *
@@ -224,6 +270,7 @@ sfs_unmount(struct fs *fs)
 	/* Once we start nuking stuff we can't fail. */
 	vnodearray_destroy(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
+	sfs_freebufs(sfs);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -265,19 +312,19 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/*
 	 * Make sure our on-disk structures aren't messed up
 	 */
-	KASSERT(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
-	KASSERT(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
-	KASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	KASSERT(sizeof(struct sfs_super)==SFS_MINBLOCKSIZE);
+	KASSERT(sizeof(struct sfs_inode)==SFS_MINBLOCKSIZE);
+	KASSERT(SFS_MINBLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	KASSERT(SFS_DIRHASH_MAXBUCKETS <=
+		SFS_NDIRECT + SFS_DBPERIDB(SFS_MINBLOCKSIZE));
 
 	/*
 	 * We can't mount on devices with the wrong sector size.
 	 *
-	 * (Note: for all intents and purposes here, "sector" and
-	 * "block" are interchangeable terms. Technically a filesystem
-	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * (A filesystem block may be composed of several hardware
+	 * sectors, but the smallest block size is one sector.)
 	 */
-	if (dev->d_blocksize != SFS_BLOCKSIZE) {
+	if (dev->d_blocksize != SFS_MINBLOCKSIZE) {
 		vfs_biglock_release();
 		return ENXIO;
 	}
@@ -288,6 +335,10 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		vfs_biglock_release();
 		return ENOMEM;
 	}
+	sfs->sfs_iobuf = NULL;
+	sfs->sfs_zeros = NULL;
+	sfs->sfs_dirbuf = NULL;
+	sfs->sfs_idbuf[0] = sfs->sfs_idbuf[1] = sfs->sfs_idbuf[2] = NULL;
 
 	/* Allocate array */
 	sfs->sfs_vnodes = vnodearray_create();
@@ -297,11 +348,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENOMEM;
 	}
 
-	/* Set the device so we can use sfs_rblock() */
+	/*
+	 * Set the device so we can use sfs_rmeta(). The superblock is
+	 * at the start of the disk whatever the block size is.
+	 */
 	sfs->sfs_device = dev;
+	sfs->sfs_blocksize = SFS_MINBLOCKSIZE;
 
 	/* Load superblock */
-	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+	result = sfs_rmeta(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
@@ -322,17 +377,60 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return EINVAL;
 	}
 	
-	if (sfs->sfs_super.sp_nblocks > dev->d_blocks) {
-		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
-			sfs->sfs_super.sp_nblocks, dev->d_blocks);
+	/* Volumes from before sp_blocksize existed have 0 there */
+	if (sfs->sfs_super.sp_blocksize == 0) {
+		sfs->sfs_super.sp_blocksize = SFS_MINBLOCKSIZE;
+	}
+	if (sfs->sfs_super.sp_blocksize < SFS_MINBLOCKSIZE ||
+	    sfs->sfs_super.sp_blocksize > SFS_MAXBLOCKSIZE ||
+	    (sfs->sfs_super.sp_blocksize &
+	     (sfs->sfs_super.sp_blocksize - 1)) != 0) {
+		kprintf("sfs: Invalid block size %u\n",
+			sfs->sfs_super.sp_blocksize);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return EINVAL;
+	}
+	sfs->sfs_blocksize = sfs->sfs_super.sp_blocksize;
+
+	if ((uint64_t)sfs->sfs_super.sp_nblocks *
+	    (sfs->sfs_blocksize / SFS_MINBLOCKSIZE) > dev->d_blocks) {
+		kprintf("sfs: warning - fs has %u %u-byte blocks, "
+			"device has %u sectors\n",
+			sfs->sfs_super.sp_nblocks, sfs->sfs_blocksize,
+			dev->d_blocks);
+	}
+
+	/* The directory hash bucket count must be 0 or a power of two */
+	if (sfs->sfs_super.sp_dirbuckets > SFS_DIRHASH_MAXBUCKETS ||
+	    (sfs->sfs_super.sp_dirbuckets &
+	     (sfs->sfs_super.sp_dirbuckets - 1)) != 0) {
+		kprintf("sfs: Invalid directory hash bucket count %u\n",
+			sfs->sfs_super.sp_dirbuckets);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return EINVAL;
 	}
 
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/* Get scratch buffers */
+	result = sfs_allocbufs(sfs);
+	if (result) {
+		sfs_freebufs(sfs);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		sfs_freebufs(sfs);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
@@ -341,6 +439,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
+		sfs_freebufs(sfs);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
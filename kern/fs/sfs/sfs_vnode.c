@@ -58,9 +58,7 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	return sfs_wblock(sfs, sfs->sfs_zeros, block);
 }
 
 /* Write an on-disk inode structure back out to disk. */
@@ -70,7 +68,7 @@ sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		int result = sfs_wmeta(sfs, &sv->sv_i, sv->sv_ino);
 		if (result) {
 			return result;
 		}
@@ -146,23 +144,15 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t *idbuf = sfs->sfs_idbuf[0];
+	uint32_t dbperidb = SFS_DBPERIDB(sfs->sfs_blocksize);
 	uint32_t block;
-	uint32_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t idblock, *idptr;
+	uint32_t idoff, span;
+	int indirection;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
@@ -198,27 +188,36 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block; it must be under one of the indirect
+	 * blocks. Subtract off the blocks each level of the tree covers
+	 * until FILEBLOCK is an offset within the tree that holds it.
+	 * INDIRECTION is then how many indirect blocks we have to go
+	 * through and SPAN how many file blocks each entry in the top
+	 * one covers.
 	 */
 
 	fileblock -= SFS_NDIRECT;
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	span = 1;
+	for (indirection = 1; indirection <= 3; indirection++) {
+		if (fileblock / dbperidb < span) {
+			break;
+		}
+		fileblock -= span * dbperidb;
+		span *= dbperidb;
+	}
 
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
+	switch (indirection) {
+	    case 1: idptr = &sv->sv_i.sfi_indirect; break;
+	    case 2: idptr = &sv->sv_i.sfi_dindirect; break;
+	    case 3: idptr = &sv->sv_i.sfi_tindirect; break;
+	    default:
+		/* Past the end of the triple indirect block; too large. */
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	idblock = *idptr;
 
 	if (idblock==0 && !doalloc) {
 		/*
@@ -232,9 +231,9 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	else if (idblock==0) {
 		/*
 		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * allocate a block whose number needs to be stored
+		 * under it. Thus, we need to allocate an indirect
+		 * block. (sfs_balloc clears it for us.)
 		 */
 		result = sfs_balloc(sfs, &idblock);
 		if (result) {
@@ -242,42 +241,51 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		}
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*idptr = idblock;
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
+
+	/*
+	 * Walk down the tree, one indirect block per level, allocating
+	 * blocks along the way if asked to.
+	 */
+	for (; indirection > 0; indirection--) {
 		result = sfs_rblock(sfs, idbuf, idblock);
 		if (result) {
 			return result;
 		}
-	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+		idoff = fileblock / span;
+		fileblock %= span;
+		span /= dbperidb;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
-		}
+		/* Get the block out of the indirect block buffer */
+		block = idbuf[idoff];
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		/* If there's no block there, allocate one */
+		if (block==0 && doalloc) {
+			result = sfs_balloc(sfs, &block);
+			if (result) {
+				return result;
+			}
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+			/* Remember the block we allocated */
+			idbuf[idoff] = block;
+
+			/* The indirect block is now dirty; write it back */
+			result = sfs_wblock(sfs, idbuf, idblock);
+			if (result) {
+				return result;
+			}
+		}
+		else if (block==0) {
+			/* Hole; nothing below here */
+			break;
 		}
+
+		idblock = block;
 	}
 
 	/* Hand back the result and return. */
@@ -308,16 +316,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	char *iobuf;
 	uint32_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -325,15 +325,31 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	/* Allocate missing blocks if and only if we're writing */
 	int doalloc = (uio->uio_rw==UIO_WRITE);
 
-	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
+	KASSERT(skipstart + len <= sfs->sfs_blocksize);
+
+	/*
+	 * A user buffer may be mapped from a file on this volume, so
+	 * the uiomove below can fault and come back in here through
+	 * as_fillpage (the big lock is recursive) and reuse sfs_iobuf
+	 * under us. So user I/O gets a block buffer of its own.
+	 */
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		iobuf = sfs->sfs_iobuf;
+	}
+	else {
+		iobuf = kmalloc(sfs->sfs_blocksize);
+		if (iobuf == NULL) {
+			return ENOMEM;
+		}
+	}
 
 	/* Compute the block offset of this block in the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
 
 	/* Get the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	if (diskblock == 0) {
@@ -342,7 +358,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, sfs->sfs_blocksize);
 	}
 	else {
 		/*
@@ -350,7 +366,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		 */
 		result = sfs_rblock(sfs, iobuf, diskblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -359,7 +375,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	/*
@@ -367,12 +383,13 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
 		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
 	}
 
-	return 0;
+ out:
+	if (iobuf != sfs->sfs_iobuf) {
+		kfree(iobuf);
+	}
+	return result;
 }
 
 /*
@@ -393,7 +410,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	off_t diskres;
 
 	/* Get the block number within the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
 
 	/* Look up the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
@@ -409,7 +426,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		return uiomovezeros(sfs->sfs_blocksize, uio);
 	}
 
 	/*
@@ -417,15 +434,15 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	 * and substitute one that makes sense to the device.
 	 */
 	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
+	diskoff = (off_t)diskblock * sfs->sfs_blocksize;
 	uio->uio_offset = diskoff;
 
 	/*
 	 * Temporarily set the residue to be one block size.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+	KASSERT(uio->uio_resid >= sfs->sfs_blocksize);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
+	diskres = sfs->sfs_blocksize;
 	uio->uio_resid = diskres;
 	
 	result = sfs_rwblock(sfs, uio);
@@ -447,6 +464,8 @@ static
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t blocksize = sfs->sfs_blocksize;
 	uint32_t blkoff;
 	uint32_t nblocks, i;
 	int result = 0;
@@ -476,13 +495,13 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * First, do any leading partial block.
 	 */
-	blkoff = uio->uio_offset % SFS_BLOCKSIZE;
+	blkoff = uio->uio_offset % blocksize;
 	if (blkoff != 0) {
 		/* Number of bytes at beginning of block to skip */
 		uint32_t skip = blkoff;
 
 		/* Number of bytes to read/write after that point */
-		uint32_t len = SFS_BLOCKSIZE - blkoff;
+		uint32_t len = blocksize - blkoff;
 
 		/* ...which might be less than the rest of the block */
 		if (len > uio->uio_resid) {
@@ -504,8 +523,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * Now we should be block-aligned. Do the remaining whole blocks.
 	 */
-	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
+	KASSERT(uio->uio_offset % blocksize == 0);
+	nblocks = uio->uio_resid / blocksize;
 	for (i=0; i<nblocks; i++) {
 		result = sfs_blockio(sv, uio);
 		if (result) {
@@ -516,7 +535,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * Now do any remaining partial block at the end.
 	 */
-	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
+	KASSERT(uio->uio_resid < blocksize);
 
 	if (uio->uio_resid > 0) {
 		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
@@ -636,6 +655,101 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+/*
+ * Compute the hash bucket a name belongs in, for hashed directories.
+ * (See the comments in kern/sfs.h.) NBUCKETS is a power of two.
+ */
+static
+uint32_t
+sfs_dir_hashbucket(const char *name, uint32_t nbuckets)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+
+	for (; *name; name++) {
+		h = SFS_DIRHASH_STEP(h, *name);
+	}
+	return h & (nbuckets - 1);
+}
+
+/*
+ * Search a hashed directory for a filename. Only the chain of the
+ * bucket the name hashes to is examined, one block read per chain
+ * block. Hands back the inode number and slot of the name, if found,
+ * and/or an empty slot the name could be stored in: the first free
+ * slot in the chain, or if there isn't one, the first slot of the
+ * (not yet allocated) block that would extend the chain.
+ */
+static
+int
+sfs_dir_hashfind(struct sfs_vnode *sv, const char *name,
+		 uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_dir *dirbuf = sfs->sfs_dirbuf;
+	uint32_t dirperblock = SFS_DIRPERBLOCK(sfs->sfs_blocksize);
+	uint32_t nbuckets = sfs->sfs_super.sp_dirbuckets;
+	uint32_t nblocks, fileblock, diskblock;
+	int freeslot = -1;
+	unsigned i;
+	int result;
+
+	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
+
+	nblocks = DIVROUNDUP(sv->sv_i.sfi_size, sfs->sfs_blocksize);
+
+	/* Walk the chain until we find the name or run off its end. */
+	fileblock = sfs_dir_hashbucket(name, nbuckets);
+	while (1) {
+		diskblock = 0;
+		if (fileblock < nblocks) {
+			result = sfs_bmap(sv, fileblock, 0, &diskblock);
+			if (result) {
+				return result;
+			}
+		}
+		if (diskblock == 0) {
+			/* End of the chain. */
+			break;
+		}
+
+		result = sfs_rblock(sfs, dirbuf, diskblock);
+		if (result) {
+			return result;
+		}
+
+		for (i=0; i<dirperblock; i++) {
+			if (dirbuf[i].sfd_ino == SFS_NOINO) {
+				if (freeslot < 0) {
+					freeslot = fileblock*dirperblock + i;
+				}
+				continue;
+			}
+
+			/* Ensure null termination, just in case */
+			dirbuf[i].sfd_name[sizeof(dirbuf[i].sfd_name)-1] = 0;
+			if (!strcmp(dirbuf[i].sfd_name, name)) {
+				if (slot != NULL) {
+					*slot = fileblock*dirperblock + i;
+				}
+				if (ino != NULL) {
+					*ino = dirbuf[i].sfd_ino;
+				}
+				return 0;
+			}
+		}
+
+		fileblock += nbuckets;
+	}
+
+	if (emptyslot != NULL) {
+		if (freeslot < 0) {
+			freeslot = fileblock * dirperblock;
+		}
+		*emptyslot = freeslot;
+	}
+	return ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -647,11 +761,19 @@ int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		    uint32_t *ino, int *slot, int *emptyslot)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	struct sfs_dir tsd;
 	int found = 0;
-	int nentries = sfs_dir_nentries(sv);
+	int nentries;
 	int i, result;
 
+	/* Hashed directories only need to look at one bucket */
+	if (sfs->sfs_super.sp_dirbuckets != 0) {
+		return sfs_dir_hashfind(sv, name, ino, slot, emptyslot);
+	}
+
+	nentries = sfs_dir_nentries(sv);
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -1023,6 +1145,7 @@ int
 sfs_stat(struct vnode *v, struct stat *statbuf)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	/* Fill in the stat structure */
@@ -1034,6 +1157,7 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 	}
 
 	statbuf->st_size = sv->sv_i.sfi_size;
+	statbuf->st_blksize = sfs->sfs_blocksize;
 
 	/* We don't support these yet; you get to implement them */
 	statbuf->st_nlink = 0;
@@ -1110,14 +1234,93 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Regular files can always be mapped; the pages
+ * come and go through sfs_read and sfs_write.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
+}
+
+/*
+ * Discard any blocks past file block BLOCKLEN under the indirect
+ * block *IDPTR. INDIRECTION is its level in the tree (1 for single
+ * indirect), BASEBLOCK the first file block it maps, and SPAN the
+ * number of file blocks each of its entries covers. If the indirect
+ * block ends up empty it's freed as well, *IDPTR is cleared, and
+ * *CHANGEDP is set.
+ */
+static
+int
+sfs_truncate_indirect(struct sfs_fs *sfs, uint32_t *idptr, int indirection,
+		      uint64_t baseblock, uint64_t span, uint32_t blocklen,
+		      bool *changedp)
+{
+	/* Each level of the recursion has its own buffer */
+	uint32_t *idbuf = sfs->sfs_idbuf[indirection-1];
+	uint32_t dbperidb = SFS_DBPERIDB(sfs->sfs_blocksize);
+	uint64_t blockbase;
+	uint32_t j;
+	int result;
+	bool hasnonzero, iddirty;
+
+	KASSERT(indirection >= 1 && indirection <= 3);
+
+	if (*idptr == 0 || blocklen >= baseblock + span*dbperidb) {
+		/* Nothing here, or all of it is before the new EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_rblock(sfs, idbuf, *idptr);
+	if (result) {
+		return result;
+	}
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<dbperidb; j++) {
+		blockbase = baseblock + j*span;
+		if (indirection > 1) {
+			/* Trim the subtree under this entry */
+			result = sfs_truncate_indirect(sfs, &idbuf[j],
+						       indirection-1,
+						       blockbase,
+						       span/dbperidb,
+						       blocklen, &iddirty);
+			if (result) {
+				return result;
+			}
+		}
+		else if (blockbase >= blocklen && idbuf[j] != 0) {
+			/* Discard any blocks that are past the new EOF */
+			sfs_bfree(sfs, idbuf[j]);
+			idbuf[j] = 0;
+			iddirty = true;
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j]!=0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, *idptr);
+		*idptr = 0;
+		*changedp = true;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty; write it back */
+		result = sfs_wblock(sfs, idbuf, *idptr);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
 }
 
 /*
@@ -1127,27 +1330,16 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
-	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	uint32_t blocklen = DIVROUNDUP(len, sfs->sfs_blocksize);
 
-	uint32_t i, j, block;
-	uint32_t idblock, baseblock, highblock;
+	uint32_t i, block;
+	uint64_t baseblock, span;
+	uint32_t *idptrs[3];
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
 	vfs_biglock_acquire();
 
@@ -1164,54 +1356,23 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Then the single, double, and triple indirect trees, in order */
+	idptrs[0] = &sv->sv_i.sfi_indirect;
+	idptrs[1] = &sv->sv_i.sfi_dindirect;
+	idptrs[2] = &sv->sv_i.sfi_tindirect;
 
-	/* The lowest block in the indirect block */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+	span = 1;
+	for (i=0; i<3; i++) {
+		result = sfs_truncate_indirect(sfs, idptrs[i], i+1,
+					       baseblock, span, blocklen,
+					       &sv->sv_dirty);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+		baseblock += span * SFS_DBPERIDB(sfs->sfs_blocksize);
+		span *= SFS_DBPERIDB(sfs->sfs_blocksize);
 	}
 
 	/* Set the file size */
@@ -1697,7 +1858,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = sfs_rmeta(sfs, &sv->sv_i, ino);
 	if (result) {
 		kfree(sv);
 		return result;
@@ -40,6 +40,16 @@
 #include "opt-dumbvm.h"
 #include <wchan.h>
 struct vnode;
+struct lock;
+
+/*
+ * Stacks for user threads other than the first are fixed-size slots at
+ * the bottom of the stack area; the first thread's stack grows down from
+ * the top and stops above them.
+ */
+#define AS_NSTACKS    32
+#define AS_STACKSIZE  (64*1024)
+#define AS_STACKSTOP  ((USERSTACKBASE) + AS_NSTACKS * AS_STACKSIZE)
 
 
 /*
@@ -49,7 +59,7 @@ struct vnode;
  */
 
 struct state_field {
-    int pte_lock_ondisk:2;
+    unsigned pte_lock_ondisk:3;
     int swap_index:12;
 };
 
@@ -66,6 +76,10 @@ struct region_entry{
   size_t bounds;
   ax_permssion original_perm;
   ax_permssion backup_perm; //only for loadelf
+  region_type reg_type;
+  int reg_flags;          // MAP_SHARED or MAP_PRIVATE, for mmap regions
+  struct vnode *reg_vn;   // backing file of an RT_FILE region
+  off_t reg_offset;       // file offset that reg_base maps
   struct region_entry *next;
 };
 
@@ -84,7 +98,12 @@ struct addrspace {
         vaddr_t heap_start;
         vaddr_t heap_end;
         vaddr_t stack_end;
+        vaddr_t mmap_start;     // lowest address used by mmap; heap stops here
         struct wchan *swap_wc;
+        struct lock *as_lock;   // held while faulting or changing the layout
+        int as_refcount;        // threads using this address space
+        uint32_t as_stacks;     // thread stack slots in use, one bit each
+        unsigned as_nresident;  // pages in memory; under coremap_lock
 #endif
 };
 
@@ -105,8 +124,11 @@ struct addrspace {
  *                "seen" by the processor. Argument might be NULL,
  *                meaning "no particular address space".
  *
- *    as_destroy - dispose of an address space. You may need to change
- *                the way this works if implementing user-level threads.
+ *    as_incref - add a reference, for another thread sharing the
+ *                address space.
+ *
+ *    as_destroy - drop a reference to an address space, disposing of
+ *                it when the last thread using it lets go.
  *
  *    as_define_region - set up a region of memory within the address
  *                space.
@@ -125,6 +147,7 @@ struct addrspace {
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(struct addrspace *);
+void              as_incref(struct addrspace *);
 void              as_destroy(struct addrspace *);
 
 int               as_define_region(struct addrspace *as,
@@ -139,6 +162,15 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 /************ RB:Auxillary as functions ************/
 void as_check_regions(struct addrspace *as);
 
+/*
+ * User thread stacks:
+ *    as_allocstack - claim a free stack slot; hands back the slot number
+ *                    and the initial stack pointer for it.
+ *    as_freestack  - give a slot back.
+ */
+int as_allocstack(struct addrspace *as, unsigned *slot, vaddr_t *stackptr);
+void as_freestack(struct addrspace *as, unsigned slot);
+
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
@@ -158,6 +190,29 @@ struct page_table_entry *get_pte(struct page_table_entry* page_table, vaddr_t va
 
 struct region_entry *add_region(struct addrspace* as, vaddr_t rbase,size_t sz,int r,int w,int x);
 struct region_entry *get_region(struct region_entry* regions, vaddr_t vaddr);
+
+/*
+ * mmap support:
+ *    as_mmap     - add a mapping of LEN bytes at *ADDR (chosen if not
+ *                  MAP_FIXED) for sys_mmap. VN is NULL for MAP_ANON;
+ *                  otherwise the region takes a reference to it.
+ *    as_munmap   - remove the mappings in [ADDR, ADDR+LEN), writing
+ *                  back modified MAP_SHARED pages.
+ *    as_fillpage - read a file-backed page in on its first fault.
+ *    as_waitpte  - wait for a page that is busy (PTE_LOCKED) to be let go.
+ *
+ * The file I/O is done with the page busy and as_lock let go, since the
+ * file system may itself need to fault on this address space, in
+ * uiomove, while holding its own locks. So as_fillpage and as_waitpte,
+ * which are called with as_lock held (once), may let go of it for a
+ * while; anything may have changed by the time they return.
+ */
+int as_mmap(struct addrspace *as, vaddr_t *addr, size_t len, int prot,
+            int flags, struct vnode *vn, off_t offset);
+int as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int as_fillpage(struct addrspace *as, struct region_entry *reg,
+                struct page_table_entry *pte);
+void as_waitpte(struct addrspace *as, struct page_table_entry *pte);
 void printPageTable(struct page_table_entry *entry);
 
 #endif /* _ADDRSPACE_H_ */
@@ -0,0 +1,50 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: call a function a given number of hardclocks from now.
+ *
+ * Pending callouts live on a hierarchical timing wheel: four levels of
+ * 64 slots, each level covering 64 times the span of the one below.
+ * Level 0 holds callouts due within the next 64 ticks, one slot per
+ * tick; a slot of a higher level is emptied into the levels below
+ * whenever level 0 comes back around to it. So arming and stopping a
+ * callout is O(1), and each tick only looks at the one slot that is
+ * due. A callout further out than the wheel reaches (64^4 ticks) is
+ * parked in the last slot and re-filed as the wheel turns.
+ *
+ * The wheel is turned by cpu 0's hardclock. The function is called
+ * from there, in interrupt context with no locks held, so it must not
+ * sleep; typically it sets a flag and wakes a wait channel.
+ *
+ * Functions:
+ *    callout_init  - set up a callout that is not pending.
+ *    callout_reset - arrange for FUNC(ARG) to be called TICKS
+ *                    hardclocks from now (0 means at the next one),
+ *                    cancelling whatever CO was set to do before.
+ *    callout_stop  - cancel CO. Returns true if it was pending, and
+ *                    false if it had already fired or was never set;
+ *                    in the latter case the function may still be
+ *                    running on cpu 0 when this returns.
+ *    callout_tick  - turn the wheel by one tick and run whatever is due.
+ *                    Called by hardclock.
+ *
+ * A struct callout may be embedded anywhere, including on a stack, as
+ * long as it is stopped or has fired before it goes away.
+ */
+
+struct callout {
+	struct callout *co_next;	/* next in wheel slot */
+	struct callout **co_prevp;	/* what points at us; NULL if idle */
+	uint32_t co_expire;		/* tick to fire at */
+	void (*co_func)(void *);
+	void *co_arg;
+};
+
+void callout_init(struct callout *co);
+void callout_reset(struct callout *co, unsigned ticks,
+		   void (*func)(void *), void *arg);
+bool callout_stop(struct callout *co);
+void callout_tick(void);
+
+#endif /* _CALLOUT_H_ */
@@ -47,7 +47,7 @@
  * XXX we have struct timespec now, let's use it.
  */
 
-/* hardclocks per second */
+/* hardclocks per second at boot */
 #if OPT_SYNCHPROBS
 /* Make synchronization more exciting :) */
 #define HZ  10000
@@ -56,6 +56,35 @@
 #define HZ  100
 #endif
 
+/* limits for clock_sethz */
+#define HZ_MIN  10
+#define HZ_MAX  10000
+
+/*
+ * Length of a thread's time slice. A thread that has used up its slice
+ * is preempted at the next hardclock, but only if something else on
+ * its cpu is waiting to run; otherwise it keeps going. 0 means every
+ * hardclock ends the slice.
+ */
+#if OPT_SYNCHPROBS
+#define QUANTUM_MSECS  0
+#else
+#define QUANTUM_MSECS  40
+#endif
+
+/*
+ * The current rate and slice length, the latter in hardclocks. Both can
+ * be changed at runtime: clock_sethz sets the rate and clock_setquantum
+ * the slice length in milliseconds, and the slice and the periodic
+ * scheduler work in hardclock() keep the same length in real time
+ * across a change of rate. Each cpu's timer picks up a new rate at its
+ * next tick.
+ */
+extern unsigned clock_hz;
+extern unsigned clock_quantum;
+int clock_sethz(unsigned hz);
+int clock_setquantum(unsigned msecs);
+
 void hardclock_bootstrap(void);
 
 void hardclock(void);
@@ -73,5 +102,11 @@ void getinterval(time_t secs1, uint32_t nsecs,
  */
 void clocksleep(int seconds);
 
+/*
+ * thread_sleep_until() suspends the current thread until gettime()
+ * reaches SECS.NSECS, to the resolution of a hardclock.
+ */
+void thread_sleep_until(time_t secs, uint32_t nsecs);
+
 
 #endif /* _CLOCK_H_ */
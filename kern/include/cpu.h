@@ -60,6 +60,11 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_uticks;		/* ...that found us in user mode */
+	unsigned c_sticks;		/* ...in the kernel */
+	unsigned c_iticks;		/* ...idle */
+	unsigned c_nswitches;		/* Context switches made */
+	struct tracebuf *c_trace;	/* Event records (see trace.h) */
 
 	/*
 	 * Accessed by other cpus.
@@ -109,6 +114,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * The cpus that have been created, by c_number. (In thread.c.)
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned number);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -45,6 +45,10 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	off_t ev_size;			/* cached size, if ev_sizevalid */
+	bool ev_sizevalid;		/* protected by the device's e_lock */
+	unsigned ev_gen;		/* bumped when cached data goes stale */
+	struct emu_ra *ev_ra;		/* read-ahead in flight, if any */
 };
 
 struct emufs_fs {
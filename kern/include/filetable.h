@@ -0,0 +1,93 @@
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * A struct fdesc is one open file: what open() creates and what dup2
+ * and fork share. Its seek offset and reference count are guarded by
+ * a spinlock, so looking at them costs a few instructions. I/O at the
+ * seek position must also read the offset, transfer and advance it as
+ * one step, or two users of the file would both use the same offset;
+ * so for objects that can seek a sleep lock is held across that. pread
+ * and pwrite don't use the offset and take no lock. Objects that can't
+ * seek (the console, pipes) have no lock, as a read there may block
+ * for as long as it likes.
+ *
+ * A struct filetable maps descriptor numbers to fdescs for a process.
+ * fork gives the child its own table pointing at the same fdescs;
+ * threads of one process share a table by reference. The slot array
+ * starts small and doubles up to OPEN_MAX as needed, and a bitmap of
+ * used slots finds the lowest free descriptor without a scan of the
+ * slots themselves.
+ */
+
+#include <spinlock.h>
+
+struct lock;
+struct vnode;
+struct bitmap;
+
+struct fdesc {
+	struct vnode *vn;		/* the open object */
+	int flags;			/* flags passed to open */
+	struct spinlock lock;		/* protects offset and ref_count */
+	off_t offset;			/* seek position */
+	int ref_count;			/* table slots referring to this */
+	struct lock *iolock;		/* held across I/O at offset, if seekable */
+};
+
+struct filetable {
+	struct spinlock ft_lock;	/* protects everything below */
+	int ft_refcount;		/* threads using this table */
+	unsigned ft_size;		/* number of slots in ft_files */
+	struct fdesc **ft_files;	/* descriptor -> open file */
+	struct bitmap *ft_used;		/* which descriptors are in use */
+};
+
+/*
+ * Open file operations:
+ *    fdesc_create    - make an open file for VN, which it takes over.
+ *    fdesc_incref    - add a reference.
+ *    fdesc_decref    - drop a reference; the last one closes VN.
+ *    fdesc_getoffset - read the seek position.
+ *    fdesc_setoffset - set the seek position.
+ *    fdesc_lockio    - start I/O (or a seek) that uses the seek position.
+ *    fdesc_unlockio  - end it.
+ */
+struct fdesc *fdesc_create(struct vnode *vn, int flags, off_t offset);
+void fdesc_incref(struct fdesc *f);
+void fdesc_decref(struct fdesc *f);
+off_t fdesc_getoffset(struct fdesc *f);
+void fdesc_setoffset(struct fdesc *f, off_t offset);
+void fdesc_lockio(struct fdesc *f);
+void fdesc_unlockio(struct fdesc *f);
+
+/*
+ * Descriptor table operations:
+ *    filetable_create  - make an empty table.
+ *    filetable_copy    - make a new table sharing SRC's open files
+ *                        (for fork).
+ *    filetable_incref  - share a table with another thread.
+ *    filetable_decref  - drop a thread's use of a table; the last one
+ *                        closes all its descriptors.
+ *    filetable_add     - put F in the lowest free slot and return its
+ *                        number; takes over the caller's reference.
+ *    filetable_get     - look up FD and return its open file with a
+ *                        new reference, which the caller must drop.
+ *    filetable_remove  - empty slot FD and return what was there,
+ *                        with the table's reference.
+ *    filetable_place   - put F in slot FD (adding a reference) and
+ *                        return what was there before, if anything.
+ */
+struct filetable *filetable_create(void);
+int filetable_copy(struct filetable *src, struct filetable **ret);
+void filetable_incref(struct filetable *ft);
+void filetable_decref(struct filetable *ft);
+int filetable_add(struct filetable *ft, struct fdesc *f, int *fd);
+int filetable_get(struct filetable *ft, int fd, struct fdesc **ret);
+int filetable_remove(struct filetable *ft, int fd, struct fdesc **ret);
+int filetable_place(struct filetable *ft, int fd, struct fdesc *f,
+		    struct fdesc **old);
+
+#endif /* _FILETABLE_H_ */
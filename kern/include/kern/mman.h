@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap() and munmap(), shared between the kernel and
+ * <sys/mman.h> in libc.
+ */
+
+/* Protection bits (the PROT argument) */
+#define PROT_NONE     0      /* Page can't be accessed */
+#define PROT_READ     1      /* Page can be read */
+#define PROT_WRITE    2      /* Page can be written */
+#define PROT_EXEC     4      /* Page can be executed */
+
+/* Mapping type (the FLAGS argument) - exactly one of these */
+#define MAP_SHARED    0x0001 /* Changes are written back to the file */
+#define MAP_PRIVATE   0x0002 /* Changes are private to this process */
+#define MAP_TYPE      0x000f /* Mask for the mapping type */
+
+/* Other flags */
+#define MAP_FIXED     0x0010 /* Map exactly at ADDR or fail */
+#define MAP_ANON      0x1000 /* Not backed by a file; fd is ignored */
+#define MAP_ANONYMOUS MAP_ANON
+
+#endif /* _KERN_MMAN_H_ */
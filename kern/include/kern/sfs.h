@@ -37,27 +37,54 @@
  */
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
-#define SFS_BLOCKSIZE     512           /* size of our blocks */
+#define SFS_MINBLOCKSIZE  512           /* smallest block size (1 sector) */
+#define SFS_MAXBLOCKSIZE  16384         /* largest block size */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
-#define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SB_LOCATION    0            /* block the superblock lives in */
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
 #define SFS_MAP_LOCATION   2            /* 1st block of the freemap */
 #define SFS_NOINO          0            /* inode # for free dir entry */
+#define SFS_DIRHASH_MAXBUCKETS 64       /* max hash buckets per directory */
+
+/*
+ * The block size is chosen when the volume is made and recorded in
+ * sp_blocksize; it is a power of two between SFS_MINBLOCKSIZE and
+ * SFS_MAXBLOCKSIZE. The macros below that depend on it take it as
+ * the BS argument.
+ *
+ * The superblock and inodes are always SFS_MINBLOCKSIZE bytes and
+ * sit at the start of their blocks; the rest of those blocks is
+ * unused.
+ */
+
+/* Number of direct blocks per indirect block */
+#define SFS_DBPERIDB(bs) ((bs) / sizeof(uint32_t))
 
 /* Number of bits in a block */
-#define SFS_BLOCKBITS (SFS_BLOCKSIZE * CHAR_BIT)
+#define SFS_BLOCKBITS(bs) ((bs) * CHAR_BIT)
 
 /* Utility macro */
-#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*b)
+#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*(b))
 
 /* Size of bitmap (in bits) */
-#define SFS_BITMAPSIZE(nblocks) SFS_ROUNDUP(nblocks, SFS_BLOCKBITS)
+#define SFS_BITMAPSIZE(nblocks, bs) SFS_ROUNDUP(nblocks, SFS_BLOCKBITS(bs))
 
 /* Size of bitmap (in blocks) */
-#define SFS_BITBLOCKS(nblocks)  (SFS_BITMAPSIZE(nblocks)/SFS_BLOCKBITS)
+#define SFS_BITBLOCKS(nblocks, bs) \
+	(SFS_BITMAPSIZE(nblocks, bs)/SFS_BLOCKBITS(bs))
+
+/* Number of directory entries in a block */
+#define SFS_DIRPERBLOCK(bs) ((bs) / sizeof(struct sfs_dir))
+
+/*
+ * Hash function for directory entry names (32-bit FNV-1a). Start with
+ * SFS_DIRHASH_INIT and apply SFS_DIRHASH_STEP for each byte of the
+ * name, not including the terminating null.
+ */
+#define SFS_DIRHASH_INIT        0x811c9dc5U
+#define SFS_DIRHASH_STEP(h, c)  (((h) ^ (uint8_t)(c)) * 0x01000193U)
 
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
@@ -71,7 +98,9 @@ struct sfs_super {
 	uint32_t sp_magic;		/* Magic number, should be SFS_MAGIC */
 	uint32_t sp_nblocks;			/* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];
+	uint32_t sp_dirbuckets;			/* Hash buckets per dir, or 0 */
+	uint32_t sp_blocksize;			/* Block size, or 0 for 512 */
+	uint32_t reserved[116];
 };
 
 /*
@@ -83,11 +112,33 @@ struct sfs_inode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_waste[128-5-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
+/*
+ * The double and triple indirect pointers used to be part of
+ * sfi_waste, so older volumes (where they're always 0) still work.
+ * These tell the tools (e.g. sfsck) that the fields exist.
+ */
+#define HAS_DIDIRECT
+#define HAS_TIDIRECT
+
 /*
  * On-disk directory entry
+ *
+ * If sp_dirbuckets is 0, a directory is a flat array of these and
+ * entries may be in any slot. Otherwise each directory is a hash
+ * table of sp_dirbuckets buckets (a power of two): the entry for a
+ * name whose hash is H lives in one of the file blocks
+ *
+ *     B, B + sp_dirbuckets, B + 2*sp_dirbuckets, ...
+ *
+ * where B = H % sp_dirbuckets. This sequence is the bucket's chain.
+ * Chain blocks are allocated only as the bucket fills up, so hashed
+ * directories are sparse files, and the first unallocated block in a
+ * chain ends it.
  */
 struct sfs_dir {
 	uint32_t sfd_ino;			/* Inode number */
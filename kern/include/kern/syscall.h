@@ -47,13 +47,21 @@
 /*CALLBEGIN*/
 
 //                              -- Process-related --
-#define SYS_fork         0
+#define SYS___fork       0
 #define SYS_vfork        1
-#define SYS_execv        2
+#define SYS___execv      2
 #define SYS__exit        3
 #define SYS_waitpid      4
 #define SYS_getpid       5
 #define SYS_getppid      6
+//                              (fork+exec in one step)
+#define SYS___spawnv     122
+//                              (user threads)
+#define SYS___threadfork 123
+#define SYS_threadjoin   124
+#define SYS_threadexit   125
+#define SYS_futex_wait   126
+#define SYS_futex_wake   127
 //                              (virtual memory)
 #define SYS_sbrk         7
 #define SYS_mmap         8
@@ -86,7 +94,7 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -109,12 +117,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -124,6 +132,8 @@
 #define SYS_ioctl        64
 #define SYS_select       65
 #define SYS_poll         66
+//                              (in-kernel copying)
+#define SYS_sendfile     121
 
 //                              -- Pathname-related --
 #define SYS_link         67
@@ -0,0 +1,160 @@
+#ifndef _PROC_H_
+#define _PROC_H_
+
+/*
+ * Processes.
+ *
+ * A struct proc holds what waitpid needs to know about a process: its
+ * pid, its parent, its children, and how it exited. Everything else a
+ * process owns (address space, descriptor table, cwd) still hangs off
+ * its thread.
+ *
+ * Each process keeps a list of its children, so waitpid only looks at
+ * the caller's own children and exit only touches the exiting
+ * process's; there is no global process table. Pids come from a bitmap
+ * and are handed out in increasing order, wrapping at PID_MAX, so a
+ * pid is not reused right after it is freed and allocation normally
+ * succeeds on the first probe.
+ *
+ * Kernel threads have no process (t_proc is NULL). The kernel itself is
+ * kproc, which is the parent of programs started from the menu.
+ *
+ * A process may have several threads sharing its address space and
+ * file table. Each thread after the first has a struct uthread so it
+ * can be joined; thread ids come from the same space as pids. The
+ * process exits when its last thread does. Its status comes from the
+ * first _exit (or fatal trap) if there was one, and otherwise from the
+ * last thread to leave.
+ *
+ * Every process also sits on one list of all processes, for the stats
+ * device, and keeps a list of its live threads and the resource usage
+ * of those that have gone (see rusage.h).
+ *
+ * All of the fields below are protected by a single spinlock in
+ * proc.c. A parent sleeps on its own p_wchan while waiting, and a child
+ * wakes its parent's channel when it exits.
+ */
+
+#include <limits.h>
+#include <rusage.h>
+
+struct thread;
+struct wchan;
+
+/* Longest process name kept, including the terminating null. */
+#define PROC_NAMELEN 32
+
+struct uthread {
+	pid_t ut_tid;			/* thread id */
+	unsigned ut_stack;		/* user stack slot (see addrspace.h) */
+	bool ut_exited;			/* true once it has exited */
+	int ut_status;			/* wait status, for threadjoin */
+	struct uthread *ut_next;	/* next thread of the process */
+};
+
+/* ut_stack of a thread that has exec'd and so has no slot any more */
+#define UT_NOSTACK ((unsigned)-1)
+
+struct proc {
+	pid_t p_pid;			/* process id */
+	struct proc *p_parent;		/* NULL if nobody will wait */
+	struct proc *p_children;	/* first child */
+	struct proc *p_sibling;		/* next child of p_parent */
+	struct wchan *p_wchan;		/* where to wait for children/threads */
+	int p_nthreads;			/* threads still running */
+	struct uthread *p_uthreads;	/* threads after the first */
+	bool p_hasstatus;		/* p_exitcode set by _exit */
+	bool p_exiting;			/* _exit called; every thread must leave */
+	struct thread *p_killer;	/* in execv; every other thread must leave */
+	bool p_exited;			/* true once the last thread has left */
+	int p_exitcode;			/* wait status, for waitpid */
+	struct thread *p_threads;	/* its threads, through t_psibling */
+	struct ru_counts p_ru;		/* usage of threads that have left */
+	struct ru_counts p_cru;		/* usage of children waited for */
+	struct proc *p_allnext;		/* next on the list of all processes */
+	struct proc **p_allprevp;	/* what points at us there */
+	char p_name[PROC_NAMELEN];	/* last program executed */
+};
+
+/* The kernel's process, parent of programs run from the menu. */
+extern struct proc *kproc;
+
+/* Call once during startup, after thread_bootstrap. */
+void proc_bootstrap(void);
+
+/*
+ * Process operations:
+ *    proc_create  - make a new process with a fresh pid as a child of
+ *                   PARENT, which may be NULL for a process nobody
+ *                   will wait for.
+ *    proc_destroy - undo proc_create for a process that never ran.
+ *    proc_exit    - record STATUS (a wait status as made by _MKWAIT_*)
+ *                   for the current thread's process and detach the
+ *                   thread from it. The process's other threads are
+ *                   woken and leave too (see proc_killed). When the
+ *                   last thread goes, the status is reported and the
+ *                   process is freed here if its parent is gone,
+ *                   otherwise by the parent's proc_wait. The thread
+ *                   keeps running; call thread_exit afterwards.
+ *    proc_threadexit - like proc_exit, but STATUS is only this thread's
+ *                   own, for threadjoin; it becomes the process's
+ *                   status only if nobody called _exit.
+ *    proc_wait    - wait for PARENT's child PID to exit, hand back its
+ *                   status, and free it. With WNOHANG, returns *RETPID
+ *                   = 0 if the child is still running.
+ *    proc_setname - record the program P is running, from its PATH.
+ *                   A new process starts with its parent's name.
+ *    proc_getrusage - hand back P's usage: with RUSAGE_SELF, that of
+ *                   its threads, live or gone; with RUSAGE_CHILDREN,
+ *                   that of the children it has waited for.
+ *    proc_foreach - call FUNC(P, RU, ARG) for every process that has
+ *                   not exited, with RU its RUSAGE_SELF usage. FUNC is
+ *                   called with the process lock held, so it must not
+ *                   sleep or call back into this file. Fails only for
+ *                   lack of memory.
+ *
+ * Thread operations:
+ *    proc_attach       - put kernel thread T, which has not started
+ *                        yet, on P's list of threads. Called by
+ *                        thread_fork_proc; proc_exit takes it off.
+ *    proc_addthread    - count a new thread of P, which will run on user
+ *                        stack slot STACK, and hand back its record.
+ *    proc_removethread - undo proc_addthread for a thread that never ran.
+ *    proc_jointhread   - wait for thread TID of P to exit, hand back its
+ *                        status, and free its record.
+ *    proc_killed       - true if the current thread must leave its
+ *                        process because another thread called _exit,
+ *                        died of a fatal trap or is in execv. Waits
+ *                        that may last indefinitely check it and give
+ *                        up with EINTR.
+ *    proc_checkkill    - if proc_killed, leave the process and exit the
+ *                        thread. Called on the way back to user mode.
+ *    proc_singlethread - for execv, make the current thread the only
+ *                        one in its process: tell the others to leave,
+ *                        wait until they have, and free their records.
+ *                        Fails with EINTR if the process is exiting or
+ *                        another thread is exec'ing; the caller should
+ *                        then just return, and will be killed on the
+ *                        way out.
+ */
+int proc_create(struct proc *parent, struct proc **ret);
+void proc_destroy(struct proc *p);
+void proc_exit(int status);
+void proc_threadexit(int status);
+int proc_wait(struct proc *parent, pid_t pid, int options,
+	      int *status, pid_t *retpid);
+void proc_setname(struct proc *p, const char *path);
+int proc_getrusage(struct proc *p, int who, struct ru_counts *ret);
+int proc_foreach(void (*func)(struct proc *p, const struct ru_counts *ru,
+			      void *arg),
+		 void *arg);
+
+void proc_attach(struct proc *p, struct thread *t);
+int proc_addthread(struct proc *p, unsigned stack, struct uthread **ret);
+void proc_removethread(struct proc *p, struct uthread *ut);
+int proc_jointhread(struct proc *p, pid_t tid, int *status);
+bool proc_killed(void);
+void proc_checkkill(void);
+int proc_singlethread(void);
+
+#endif /* _PROC_H_ */
@@ -0,0 +1,57 @@
+#ifndef _RUSAGE_H_
+#define _RUSAGE_H_
+
+/*
+ * Resource accounting.
+ *
+ * Each thread keeps a struct ru_counts (t_ru) that only it updates:
+ * hardclock charges the tick to it, thread_switch counts its switches,
+ * vm_fault its faults and syscall() its system calls and I/O. So the
+ * counters need no locking; anyone else reading them may see a value
+ * that is a moment out of date.
+ *
+ * When a thread leaves its process its counts are added to the
+ * process's p_ru, and when a process is waited for, its totals are
+ * added to its parent's p_cru. So a process's own usage is p_ru plus
+ * the t_ru of each thread still running (see proc_getrusage), and
+ * p_cru covers all its descendants that have been waited for, as
+ * with getrusage(RUSAGE_CHILDREN).
+ *
+ * Each address space counts its resident pages (as_nresident, kept by
+ * page_alloc and page_free); vm_fault records the most a thread has
+ * seen there in rc_maxrss, so nobody else has to look at an address
+ * space that may be going away.
+ */
+
+/* System call numbers counted one by one; all of them are below this. */
+#define RU_NSYSCALLS 128
+
+struct ru_counts {
+	uint32_t rc_uticks;		/* hardclocks spent in user mode */
+	uint32_t rc_sticks;		/* hardclocks spent in the kernel */
+	uint64_t rc_utime;		/* the same, in microseconds */
+	uint64_t rc_stime;
+	uint32_t rc_nvcsw;		/* switches made by blocking */
+	uint32_t rc_nivcsw;		/* switches forced by preemption */
+	uint32_t rc_minflt;		/* faults that needed no I/O */
+	uint32_t rc_majflt;		/* faults that read a file or swap */
+	uint32_t rc_nswapin;		/* of which, pages read from swap */
+	uint64_t rc_inbytes;		/* bytes read by read-type calls */
+	uint64_t rc_outbytes;		/* bytes written by write-type calls */
+	uint32_t rc_maxrss;		/* peak resident pages */
+	uint32_t rc_nsyscalls;		/* system calls of any number */
+	uint32_t rc_syscalls[RU_NSYSCALLS];	/* by number */
+};
+
+/*
+ * Functions:
+ *    ru_add      - add FROM into TO. rc_maxrss takes the larger.
+ *    ru_tick     - charge a hardclock to the current thread and cpu.
+ *    ru_syscall  - count system call CALLNO by the current thread,
+ *                  which returned RETVAL, or failed if ERR is set.
+ */
+void ru_add(struct ru_counts *to, const struct ru_counts *from);
+void ru_tick(bool user);
+void ru_syscall(int callno, int err, int32_t retval);
+
+#endif /* _RUSAGE_H_ */
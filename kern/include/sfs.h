@@ -63,6 +63,21 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	uint32_t sfs_blocksize;         /* block size in bytes */
+
+	/*
+	 * Block-sized scratch buffers, used under the vfs big lock.
+	 * The big lock is recursive, and a uiomove to user memory can
+	 * fault and read a mapped file, so none of these may be live
+	 * across one.
+	 *
+	 * Note: in real life (and when you've done the fs assignment)
+	 * you would get space from the disk buffer cache for these.
+	 */
+	char *sfs_iobuf;                /* for partial-block I/O */
+	char *sfs_zeros;                /* all zeros, for clearing blocks */
+	struct sfs_dir *sfs_dirbuf;     /* for directory lookups */
+	uint32_t *sfs_idbuf[3];         /* one per level of indirection */
 };
 
 /*
@@ -75,15 +90,20 @@ int sfs_mount(const char *device);
  * Internal functions
  */
 
-/* Initialize uio structure */
-#define SFSUIO(iov, uio, ptr, block, rw) \
-    uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
+/* Initialize uio structure for LEN bytes at the start of BLOCK */
+#define SFSUIO(sfs, iov, uio, ptr, len, block, rw) \
+    uio_kinit(iov, uio, ptr, len, \
+	      ((off_t)(block))*(sfs)->sfs_blocksize, rw)
 
 /* Convenience functions for block I/O */
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+/* Same, for the superblock and inodes, which don't fill their blocks */
+int sfs_rmeta(struct sfs_fs *sfs, void *data, uint32_t block);
+int sfs_wmeta(struct sfs_fs *sfs, void *data, uint32_t block);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
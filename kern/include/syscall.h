@@ -30,7 +30,6 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
-#include <kern/filesys.h>
 #include "addrspace.h"
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -47,6 +46,12 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+/* Set up the futex wait queues. Call once during startup. */
+void futex_bootstrap(void);
+
+/* Wake every thread in futex_wait on any address in AS. */
+void futex_wakeall(struct addrspace *as);
+
 /* Enter user mode. Does not return. */
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
@@ -58,9 +63,18 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 int sys_open(userptr_t filename, int flags,int mode, int *fd);
 int sys_read(int fd, userptr_t buf, size_t nbytes, size_t *bytes_read);
 int sys_write(int fd, userptr_t buf, size_t nbytes, size_t *bytes_written);
+int sys_readv(int fd, userptr_t iov, int iovcnt, size_t *bytes_read);
+int sys_writev(int fd, userptr_t iov, int iovcnt, size_t *bytes_written);
+int sys_pread(int fd, userptr_t buf, size_t nbytes, off_t pos,
+	      size_t *bytes_read);
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t pos,
+	       size_t *bytes_written);
+int sys_sendfile(int outfd, int infd, userptr_t offset, size_t count,
+		 size_t *bytes_copied);
 int sys_close(int fd);
 int sys_lseek(int fd, off_t pos, int whence, off_t *new_pos);
 int sys_chdir(userptr_t pathname);
@@ -70,6 +84,17 @@ int sys_waitpid(int pid, userptr_t status, int options, pid_t *ret_pid);
 int sys_fork(struct trapframe *tf, pid_t *ret_pid);
 int sys_dup2(int oldfd, int newfd, int *ret_fd);
 int sys_execv(userptr_t program, userptr_t args);
+int sys_spawnv(userptr_t program, userptr_t args, pid_t *ret_pid);
+int sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t func,
+		     userptr_t arg, pid_t *ret_tid);
+int sys_threadjoin(pid_t tid, userptr_t status);
+void sys_threadexit(int exitcode);
+int sys_futex_wait(userptr_t addr, int val);
+int sys_futex_wake(userptr_t addr, int count, int *retval);
 int sys_sbrk(intptr_t amount,struct addrspace *as, int *returnVal);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_getrusage(int who, userptr_t usage);
 
 #endif /* _SYSCALL_H_ */
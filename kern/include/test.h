@@ -104,6 +104,18 @@ int malloctest(int, char **);
 int mallocstress(int, char **);
 int nettest(int, char **);
 
+/* benchmarks */
+int benchlock(int, char **);
+int benchlockc(int, char **);
+int benchcv(int, char **);
+int benchthread(int, char **);
+int benchkmalloc(int, char **);
+int benchkpages(int, char **);
+int benchvm(int, char **);
+int benchuiomove(int, char **);
+int benchsfs(int, char **);
+int benchall(int, char **);
+
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
 
@@ -38,13 +38,16 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
-#include <kern/filesys.h>
 #include <limits.h>
+#include <rusage.h>
 
 
 struct addrspace;
 struct cpu;
 struct vnode;
+struct filetable;
+struct proc;
+struct uthread;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -101,6 +104,7 @@ struct thread {
 	 * rather than per-cpu or global?
 	 */
 	bool t_in_interrupt;		/* Are we in an interrupt? */
+	bool t_intr_user;		/* ...taken from user mode? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
@@ -115,12 +119,20 @@ struct thread {
 	struct vnode *t_cwd;		/* current working directory */
 
 	/* add more here as needed */
-	/* RB: File table */
-	struct fdesc *t_fdtable[OPEN_MAX];
+	/* File descriptor table, shared by the threads of a process */
+	struct filetable *t_filetable;
 	/* RB: Thread priority for scheduling */
 	int t_priority;
-	/* RB:Pid */
-	pid_t t_pid;
+	/* Hardclocks left in this thread's time slice */
+	unsigned t_slice;
+	/* Process this thread belongs to; NULL for kernel threads */
+	struct proc *t_proc;
+	/* Join record, for user threads after the first */
+	struct uthread *t_uthread;
+	/* Next thread of t_proc, on its p_threads list */
+	struct thread *t_psibling;
+	/* Resource usage (see rusage.h) */
+	struct ru_counts t_ru;
 };
 
 /* Call once during system startup to allocate data structures. */
@@ -143,11 +155,18 @@ void thread_shutdown(void);
  * handed back. (Note that using said thread structure from the parent
  * thread should be done only with caution, because in general the
  * child thread might exit at any time.) Returns an error code.
+ *
+ * thread_fork_proc is the same, but makes the new thread part of
+ * process PROC.
  */
 int thread_fork(const char *name,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2,
                 struct thread **ret);
+int thread_fork_proc(const char *name, struct proc *proc,
+                     void (*func)(void *, unsigned long),
+                     void *data1, unsigned long data2,
+                     struct thread **ret);
 
 /*
  * Cause the current thread to exit.
@@ -0,0 +1,84 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Kernel event tracing.
+ *
+ * TRACE() is like DEBUG(), but instead of printing through kprintf (one
+ * byte at a time, under the global console lock) it appends a fixed-size
+ * binary record to a ring buffer belonging to the current cpu. Each cpu
+ * writes only its own buffer, with interrupts off, so logging takes no
+ * locks and doesn't touch the console; it is cheap enough to leave in
+ * hot paths and use under load.
+ *
+ *      TRACE(DB_VM, "fault %x type %d", faultaddress, faulttype);
+ *
+ * The format is kept as a pointer and only expanded when the buffers are
+ * dumped, so it must be a string constant, may take at most three
+ * arguments, and every argument is stored as 32 bits.
+ *
+ * Which subsystems are recorded is chosen with trflags, using the same
+ * DB_* bits as dbflags but independently of them. trflags starts out 0,
+ * which costs one load and branch per TRACE(); the "tr" menu command
+ * turns subsystems on and off and dumps the buffers to the console or
+ * a file. Each buffer keeps the last TRACE_NRECS records; older ones
+ * are overwritten.
+ *
+ * trace_mark() drops a numbered marker into the trace whenever any
+ * subsystem is being traced. The ltrace device calls it, so regions
+ * bracketed with ltrace_on/ltrace_off line up with the simulator's own
+ * trace.
+ */
+
+/* Records kept per cpu. Must be a power of 2. */
+#define TRACE_NRECS 512
+
+/* Subsystem bit for markers, outside the DB_* range */
+#define TRACE_MARK 0x80000000
+
+struct trace_rec {
+	uint32_t tr_secs;		/* when: from gettime() */
+	uint32_t tr_nsecs;
+	uint32_t tr_flag;		/* which subsystem (DB_* bit) */
+	int32_t tr_pid;			/* process, or 0 for kernel threads */
+	const char *tr_fmt;		/* how to print the arguments */
+	uint32_t tr_args[3];
+};
+
+struct cpu;
+
+extern uint32_t trflags;
+
+/* Called by cpu_create for each new cpu. */
+void trace_cpu_init(struct cpu *c);
+
+void trace_log(uint32_t flag, const char *fmt,
+	       uint32_t a0, uint32_t a1, uint32_t a2);
+void trace_mark(uint32_t code);
+
+/*
+ * Menu support:
+ *    trace_setflags - set trflags, and return the old value.
+ *    trace_clear    - throw away everything recorded so far.
+ *    trace_dump     - print all cpus' records in time order, to the
+ *                     console if PATH is NULL or to the file PATH.
+ *                     Tracing is paused while this runs.
+ *    trace_subsys   - look up a subsystem by name ("vm", "syscall",
+ *                     "all", ...) and return its bits, or 0.
+ *    trace_printflags - say which subsystems are being traced and how
+ *                     much each cpu has recorded.
+ */
+uint32_t trace_setflags(uint32_t flags);
+void trace_clear(void);
+int trace_dump(char *path);
+uint32_t trace_subsys(const char *name);
+void trace_printflags(void);
+
+/* Pads the argument list out to three, dropping any beyond that. */
+#define TRACE_LOG_(d, fmt, a0, a1, a2, ...) \
+	trace_log(d, fmt, (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2))
+
+#define TRACE(d, ...) \
+	((trflags & (d)) ? TRACE_LOG_(d, __VA_ARGS__, 0, 0, 0, 0) : (void)0)
+
+#endif /* _TRACE_H_ */
@@ -18,7 +18,14 @@ typedef enum {
 
 typedef enum{
 	PTE_ONDISK = 1,
-	PTE_LOCKED = 2
+	PTE_LOCKED = 2,
+	PTE_MODIFIED = 4	/* written since it was faulted in */
 } pte_state;
 
+typedef enum {
+	RT_SEGMENT,		/* program segment set up by load_elf */
+	RT_ANON,		/* anonymous mmap, zero-filled on demand */
+	RT_FILE			/* file mmap, read from reg_vn on demand */
+} region_type;
+
 #endif
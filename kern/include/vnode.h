@@ -135,9 +135,10 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check whether the file can be mapped into
+ *                      memory. The VM system faults mapped pages in
+ *                      with vop_read and writes shared ones back with
+ *                      vop_write, so this only has to say yes or no.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -209,7 +210,7 @@ struct vnode_ops {
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	int (*vop_tryseek)(struct vnode *object, off_t pos);
 	int (*vop_fsync)(struct vnode *object);
-	int (*vop_mmap)(struct vnode *file /* add stuff */);
+	int (*vop_mmap)(struct vnode *file);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
@@ -254,7 +255,7 @@ struct vnode_ops {
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
-#define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
+#define VOP_MMAP(vn)                    (__VOP(vn, mmap)(vn))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
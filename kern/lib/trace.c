@@ -0,0 +1,303 @@
+/*
+ * Per-cpu trace buffers. See trace.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <trace.h>
+
+struct tracebuf {
+	unsigned tb_cpu;		/* cpu number */
+	volatile unsigned tb_head;	/* records ever written */
+	unsigned tb_dumppos;		/* next record for trace_dump */
+	struct tracebuf *tb_next;	/* next cpu's buffer */
+	struct trace_rec tb_recs[TRACE_NRECS];
+};
+
+uint32_t trflags = 0;
+
+/* All the buffers; only added to, when a cpu is created. */
+static struct tracebuf *trace_bufs;
+static struct spinlock trace_bufs_lock = SPINLOCK_INITIALIZER;
+
+/* Names for the "tr" menu command and the dump. */
+static const struct {
+	const char *name;
+	uint32_t flag;
+} trace_names[] = {
+	{ "locore",	DB_LOCORE },
+	{ "syscall",	DB_SYSCALL },
+	{ "interrupt",	DB_INTERRUPT },
+	{ "device",	DB_DEVICE },
+	{ "threads",	DB_THREADS },
+	{ "vm",		DB_VM },
+	{ "exec",	DB_EXEC },
+	{ "vfs",	DB_VFS },
+	{ "sfs",	DB_SFS },
+	{ "net",	DB_NET },
+	{ "netfs",	DB_NETFS },
+	{ "kmalloc",	DB_KMALLOC },
+	{ "mark",	TRACE_MARK },
+	{ NULL, 0 }
+};
+
+void
+trace_cpu_init(struct cpu *c)
+{
+	struct tracebuf *tb;
+
+	tb = kmalloc(sizeof(*tb));
+	if (tb == NULL) {
+		panic("trace_cpu_init: Out of memory\n");
+	}
+	tb->tb_cpu = c->c_number;
+	tb->tb_head = 0;
+
+	spinlock_acquire(&trace_bufs_lock);
+	tb->tb_next = trace_bufs;
+	trace_bufs = tb;
+	spinlock_release(&trace_bufs_lock);
+
+	c->c_trace = tb;
+}
+
+/*
+ * Append a record to this cpu's buffer. Interrupts are off while the
+ * record is filled in, so an interrupt handler tracing on the same cpu
+ * can't take the same slot, and nothing else ever writes here.
+ */
+void
+trace_log(uint32_t flag, const char *fmt,
+	  uint32_t a0, uint32_t a1, uint32_t a2)
+{
+	struct tracebuf *tb;
+	struct trace_rec *tr;
+	time_t secs;
+	uint32_t nsecs;
+	int spl;
+
+	gettime(&secs, &nsecs);
+
+	spl = splhigh();
+	tb = curcpu->c_trace;
+	tr = &tb->tb_recs[tb->tb_head & (TRACE_NRECS - 1)];
+	tr->tr_secs = secs;
+	tr->tr_nsecs = nsecs;
+	tr->tr_flag = flag;
+	tr->tr_pid = curthread->t_proc != NULL ? curthread->t_proc->p_pid : 0;
+	tr->tr_fmt = fmt;
+	tr->tr_args[0] = a0;
+	tr->tr_args[1] = a1;
+	tr->tr_args[2] = a2;
+	tb->tb_head++;
+	splx(spl);
+}
+
+void
+trace_mark(uint32_t code)
+{
+	if (trflags != 0) {
+		trace_log(TRACE_MARK, "mark %u", code, 0, 0);
+	}
+}
+
+uint32_t
+trace_setflags(uint32_t flags)
+{
+	uint32_t old;
+
+	old = trflags;
+	trflags = flags;
+	return old;
+}
+
+uint32_t
+trace_subsys(const char *name)
+{
+	uint32_t all;
+	unsigned i;
+
+	all = 0;
+	for (i=0; trace_names[i].name != NULL; i++) {
+		if (!strcmp(trace_names[i].name, name)) {
+			return trace_names[i].flag;
+		}
+		all |= trace_names[i].flag;
+	}
+	if (!strcmp(name, "all")) {
+		return all;
+	}
+	return 0;
+}
+
+static
+const char *
+trace_flagname(uint32_t flag)
+{
+	unsigned i;
+
+	for (i=0; trace_names[i].name != NULL; i++) {
+		if (trace_names[i].flag == flag) {
+			return trace_names[i].name;
+		}
+	}
+	return "?";
+}
+
+void
+trace_printflags(void)
+{
+	struct tracebuf *tb;
+	unsigned i;
+
+	kprintf("Tracing:");
+	for (i=0; trace_names[i].name != NULL; i++) {
+		if (trflags & trace_names[i].flag) {
+			kprintf(" %s", trace_names[i].name);
+		}
+	}
+	kprintf(trflags ? "\n" : " nothing\n");
+
+	for (tb = trace_bufs; tb != NULL; tb = tb->tb_next) {
+		kprintf("cpu%u: %u records", tb->tb_cpu, tb->tb_head);
+		if (tb->tb_head > TRACE_NRECS) {
+			kprintf(" (%u kept)", TRACE_NRECS);
+		}
+		kprintf("\n");
+	}
+}
+
+/*
+ * Clearing and dumping read other cpus' buffers, so they pause tracing
+ * first. A record some cpu was halfway through writing at that moment
+ * may still land, possibly out of order; that's the price of not
+ * locking the writers.
+ */
+
+void
+trace_clear(void)
+{
+	struct tracebuf *tb;
+	uint32_t old;
+
+	old = trace_setflags(0);
+	for (tb = trace_bufs; tb != NULL; tb = tb->tb_next) {
+		tb->tb_head = 0;
+	}
+	trace_setflags(old);
+}
+
+/* True if A happened before B. */
+static
+bool
+trace_before(const struct trace_rec *a, const struct trace_rec *b)
+{
+	return a->tr_secs < b->tr_secs ||
+		(a->tr_secs == b->tr_secs && a->tr_nsecs < b->tr_nsecs);
+}
+
+static
+int
+trace_emit(struct vnode *vn, off_t *pos, unsigned cpu,
+	   const struct trace_rec *tr)
+{
+	char buf[160];
+	struct iovec iov;
+	struct uio ku;
+	size_t len;
+	int result;
+
+	len = snprintf(buf, sizeof(buf), "%u.%09u cpu%u pid %d %s: ",
+		       tr->tr_secs, tr->tr_nsecs, cpu, tr->tr_pid,
+		       trace_flagname(tr->tr_flag));
+	if (len < sizeof(buf)) {
+		len += snprintf(buf + len, sizeof(buf) - len, tr->tr_fmt,
+				tr->tr_args[0], tr->tr_args[1],
+				tr->tr_args[2]);
+	}
+	if (len >= sizeof(buf) - 1) {
+		len = sizeof(buf) - 2;
+	}
+	buf[len++] = '\n';
+	buf[len] = 0;
+
+	if (vn == NULL) {
+		kprintf("%s", buf);
+		return 0;
+	}
+	uio_kinit(&iov, &ku, buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	*pos = ku.uio_offset;
+	return 0;
+}
+
+int
+trace_dump(char *path)
+{
+	struct tracebuf *tb, *best;
+	struct trace_rec *tr, *besttr;
+	struct vnode *vn;
+	uint32_t old;
+	off_t pos;
+	int result;
+
+	vn = NULL;
+	pos = 0;
+	if (path != NULL) {
+		result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+		if (result) {
+			return result;
+		}
+	}
+
+	old = trace_setflags(0);
+
+	/* start each cpu at its oldest surviving record */
+	for (tb = trace_bufs; tb != NULL; tb = tb->tb_next) {
+		tb->tb_dumppos = tb->tb_head > TRACE_NRECS ?
+			tb->tb_head - TRACE_NRECS : 0;
+	}
+
+	/* merge: repeatedly take the oldest record from any cpu */
+	result = 0;
+	while (result == 0) {
+		best = NULL;
+		besttr = NULL;
+		for (tb = trace_bufs; tb != NULL; tb = tb->tb_next) {
+			if (tb->tb_dumppos == tb->tb_head) {
+				continue;
+			}
+			tr = &tb->tb_recs[tb->tb_dumppos & (TRACE_NRECS - 1)];
+			if (best == NULL || trace_before(tr, besttr)) {
+				best = tb;
+				besttr = tr;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		result = trace_emit(vn, &pos, best->tb_cpu, besttr);
+		best->tb_dumppos++;
+	}
+
+	trace_setflags(old);
+
+	if (vn != NULL) {
+		vfs_close(vn);
+	}
+	return result;
+}
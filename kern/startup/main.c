@@ -39,6 +39,7 @@
 #include <spl.h>
 #include <clock.h>
 #include <thread.h>
+#include <proc.h>
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
@@ -107,6 +108,8 @@ boot(void)
 	/* Early initialization. */
 	ram_bootstrap();
 	thread_bootstrap();
+	proc_bootstrap();
+	futex_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
 
@@ -41,8 +41,8 @@
 #include <syscall.h>
 #include <test.h>
 #include <synch.h>
-#include <kern/procsys.h>
-#include <syscall.h>
+#include <proc.h>
+#include <trace.h>
 
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
@@ -57,9 +57,6 @@
 #define MAXMENUARGS  16
 
 
-struct pdesc* g_pdtable[PID_LIMIT];
-
-
 // XXX this should not be in this file
 void
 getinterval(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2,
@@ -143,18 +140,25 @@ common_prog(int nargs, char **args)
 #endif
 
 	/************ RB:Modifying for waiting for child ************/
-	struct thread *child;
-	result = thread_fork(args[0] /* thread name */,
+	struct proc *child;
+	result = proc_create(kproc, &child);
+	if (result) {
+		kprintf("proc_create failed: %s\n", strerror(result));
+		return result;
+	}
+	pid_t pid = child->p_pid;
+
+	result = thread_fork_proc(args[0] /* thread name */, child,
 			cmd_progthread /* thread function */,
 			args /* thread arg */, nargs /* thread arg */,
-			&child);
+			NULL);
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
+		proc_destroy(child);
 		return result;
 	}
 	int status;
-	pid_t pid;
-	sys_waitpid(child->t_pid,(userptr_t)&status,0, &pid);
+	proc_wait(kproc, pid, 0, &status, &pid);
 	return 0;
 }
 
@@ -393,6 +397,108 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Commands for the clock rate and the scheduler's time slice.
+ */
+static
+int
+cmd_hz(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: hz [hardclocks-per-second]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		result = clock_sethz(atoi(args[1]));
+		if (result) {
+			kprintf("hz: must be between %d and %d\n",
+				HZ_MIN, HZ_MAX);
+			return result;
+		}
+	}
+	kprintf("%u hardclocks per second, %u per time slice\n",
+		clock_hz, clock_quantum);
+	return 0;
+}
+
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: quantum [milliseconds]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		result = clock_setquantum(atoi(args[1]));
+		if (result) {
+			kprintf("quantum: at most 1000 ms\n");
+			return result;
+		}
+	}
+	kprintf("%u hardclocks per second, %u per time slice\n",
+		clock_hz, clock_quantum);
+	return 0;
+}
+
+/*
+ * Command for the kernel trace buffers.
+ *
+ *    tr                      show what is being traced
+ *    tr on|off subsys...     start/stop tracing subsystems ("all" for all)
+ *    tr mark n               drop marker N into the trace
+ *    tr dump [file]          print the trace, or write it to FILE
+ *    tr clear                throw the trace away
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	uint32_t flags, bits;
+	int i;
+
+	if (nargs == 1) {
+		trace_printflags();
+		return 0;
+	}
+	if (!strcmp(args[1], "on") || !strcmp(args[1], "off")) {
+		flags = trflags;
+		for (i=2; i<nargs; i++) {
+			bits = trace_subsys(args[i]);
+			if (bits == 0) {
+				kprintf("tr: unknown subsystem %s\n", args[i]);
+				return EINVAL;
+			}
+			if (args[1][1] == 'n') {
+				flags |= bits;
+			}
+			else {
+				flags &= ~bits;
+			}
+		}
+		trace_setflags(flags);
+		trace_printflags();
+		return 0;
+	}
+	if (!strcmp(args[1], "mark") && nargs == 3) {
+		trace_mark(atoi(args[2]));
+		return 0;
+	}
+	if (!strcmp(args[1], "dump") && nargs <= 3) {
+		return trace_dump(nargs == 3 ? args[2] : NULL);
+	}
+	if (!strcmp(args[1], "clear") && nargs == 2) {
+		trace_clear();
+		return 0;
+	}
+	kprintf("Usage: tr [on|off subsys... | mark n | dump [file] | clear]\n");
+	return EINVAL;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -432,6 +538,8 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[hz]      Set clock rate            ",
+	"[quantum] Set time slice (ms)       ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -490,10 +598,42 @@ cmd_testmenu(int n, char **a)
 	return 0;
 }
 
+static const char *benchmenu[] = {
+	"[bl1]  Lock, uncontended            ",
+	"[bl2]  Lock, contended              ",
+	"[bcv]  CV ping-pong                 ",
+	"[bth]  Thread fork and join         ",
+	"[bkm]  kmalloc/kfree by size        ",
+	"[bkp]  alloc_kpages/free_kpages     ",
+	"[bvm]  vm_fault service time        ",
+	"[bum]  uiomove throughput           ",
+	"[bfs]  SFS block I/O        (4)     ",
+	"[ball] All but bfs                  ",
+	NULL
+};
+
+static
+int
+cmd_benchmenu(int n, char **a)
+{
+	(void)n;
+	(void)a;
+
+	showmenu("OS/161 benchmarks menu", benchmenu);
+	kprintf("    Each takes an optional number of samples; "
+		"bfs takes filesystem: [blocks].\n");
+	kprintf("    (4) This needs a mounted file system.\n");
+	kprintf("\n");
+
+	return 0;
+}
+
 static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
+	"[?b] Benchmarks menu                ",
 	"[kh] Kernel heap stats              ",
+	"[tr] Kernel event trace             ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -523,6 +663,7 @@ static struct {
 	{ "help",	cmd_mainmenu },
 	{ "?o",		cmd_opsmenu },
 	{ "?t",		cmd_testmenu },
+	{ "?b",		cmd_benchmenu },
 
 	/* operations */
 	{ "s",		cmd_shell },
@@ -534,6 +675,8 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "hz",		cmd_hz },
+	{ "quantum",	cmd_quantum },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -542,6 +685,7 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "tr",		cmd_trace },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -574,6 +718,18 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
 
+	/* benchmarks */
+	{ "bl1",	benchlock },
+	{ "bl2",	benchlockc },
+	{ "bcv",	benchcv },
+	{ "bth",	benchthread },
+	{ "bkm",	benchkmalloc },
+	{ "bkp",	benchkpages },
+	{ "bvm",	benchvm },
+	{ "bum",	benchuiomove },
+	{ "bfs",	benchsfs },
+	{ "ball",	benchall },
+
 	{ NULL, NULL }
 };
 
@@ -16,6 +16,14 @@
 #include <synch.h>
 #include <uio.h>
 #include <copyinout.h>
+#include <limits.h>
+#include <filetable.h>
+
+/* Largest byte count readv/writev/sendfile can report in their int return value */
+#define FILE_IOMAX	((size_t)0x7fffffff)
+
+/* Size of the kernel buffer sendfile copies through */
+#define SENDFILE_CHUNK	(4*PAGE_SIZE)
 
 int
 sys_open(userptr_t filename, int flags, int mode, int *fd)
@@ -61,46 +69,26 @@ sys_open(userptr_t filename, int flags, int mode, int *fd)
 				int err = VOP_STAT(f_vnode, &f_stat);
 				if (err)
 				{
+					vfs_close(f_vnode);
 					return err;
 				}
 				offset = f_stat.st_size;
 
 			}
-			int i;
-			for (i=3; i<OPEN_MAX; i++){
-				if (curthread->t_fdtable[i] == 0)
-				{
-					break;
-				}
+			struct fdesc *file_fd = fdesc_create(f_vnode, flags, offset);
+			if (file_fd == NULL)
+			{
+				vfs_close(f_vnode);
+				return ENOMEM;
 			}
-			if (i>=OPEN_MAX)
+			/* lowest free descriptor */
+			err = filetable_add(curthread->t_filetable, file_fd, fd);
+			if (err)
 			{
-				return EMFILE;
-			}else{
-
-				struct fdesc *file_fd = kmalloc(sizeof(struct fdesc));
-				if (file_fd == NULL)
-				{
-					return ENOMEM;
-				}
-				strcpy(file_fd->name,(char *)filename);
-
-					/************ RB:Change this lock name later - Not nice ************/
-				file_fd->lock = lock_create(file_fd->name);
-				if (file_fd->lock == NULL)
-				{
-					kfree(file_fd);
-					return ENOMEM;
-				}
-				file_fd->offset = offset;
-				file_fd->ref_count = 1;
-				file_fd->vn = f_vnode;
-				file_fd->flags = flags;
-				curthread->t_fdtable[i] = file_fd;
-				*fd = i;
-				return 0;
+				fdesc_decref(file_fd);
+				return err;
 			}
-
+			return 0;
 		}
 	}
 }
@@ -116,40 +104,38 @@ sys_read(int fd, userptr_t buf, size_t nbytes, size_t *bytes_read)
 		return EFAULT;
 	}
 
-	if (fd<0 || fd>=OPEN_MAX)
+	struct fdesc *t_fd;
+	int result = filetable_get(curthread->t_filetable, fd, &t_fd);
+	if (result)
 	{
-		return EBADF;
+		return result;
 	}
 
-	struct fdesc *t_fd = curthread->t_fdtable[fd];
-	if (t_fd == NULL)
-	{
+	if (!((t_fd->flags & O_RDONLY) == O_RDONLY
+		|| (t_fd->flags & O_RDWR) == O_RDWR)){
+		fdesc_decref(t_fd);
 		return EBADF;
 	}
-
-	lock_acquire(t_fd->lock);
-		if (!((t_fd->flags & O_RDONLY) == O_RDONLY
-			|| (t_fd->flags & O_RDWR) == O_RDWR)){
-			lock_release(t_fd->lock);
-			return EBADF;
-		}
-		iov.iov_ubase = buf;
-		iov.iov_len = nbytes;		 // length of the memory space
-		u.uio_iov = &iov;
-		u.uio_iovcnt = 1;
-		u.uio_resid = nbytes;          // amount to read from the file
-		u.uio_offset = t_fd->offset;
-		u.uio_segflg = UIO_USERSPACE;
-		u.uio_rw = UIO_READ;
-		u.uio_space = curthread->t_addrspace;
-		int result = VOP_READ(t_fd->vn, &u);
-		if (result) {
-			lock_release(t_fd->lock);
-			return result;
-		}
-		*bytes_read = nbytes-u.uio_resid;
-		t_fd->offset += (*bytes_read);
-	lock_release(t_fd->lock);
+	iov.iov_ubase = buf;
+	iov.iov_len = nbytes;		 // length of the memory space
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = nbytes;          // amount to read from the file
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = curthread->t_addrspace;
+	fdesc_lockio(t_fd);
+	u.uio_offset = fdesc_getoffset(t_fd);
+	result = VOP_READ(t_fd->vn, &u);
+	if (result) {
+		fdesc_unlockio(t_fd);
+		fdesc_decref(t_fd);
+		return result;
+	}
+	*bytes_read = nbytes-u.uio_resid;
+	fdesc_setoffset(t_fd, u.uio_offset);
+	fdesc_unlockio(t_fd);
+	fdesc_decref(t_fd);
 	return 0;
 
 }
@@ -163,108 +149,418 @@ sys_write(int fd, userptr_t buf, size_t nbytes, size_t *bytes_written)
 	{
 		return EFAULT;
 	}
-	if ( fd<0 || fd >= OPEN_MAX)
+	struct fdesc *t_fd;
+	int result = filetable_get(curthread->t_filetable, fd, &t_fd);
+	if (result)
+	{
+		return result;
+	}
+	if (!( (t_fd->flags & O_WRONLY) == O_WRONLY
+		|| (t_fd->flags & O_RDWR) == O_RDWR))
 	{
+		fdesc_decref(t_fd);
 		return EBADF;
 	}
-	struct fdesc *t_fd = curthread->t_fdtable[fd];
-	if (t_fd == NULL)
+	iov.iov_ubase = (userptr_t)buf;
+	iov.iov_len = nbytes;		 // length of the memory space
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = nbytes;          // amount to write to file
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = UIO_WRITE;
+	u.uio_space = curthread->t_addrspace;
+	fdesc_lockio(t_fd);
+	u.uio_offset = fdesc_getoffset(t_fd);
+	result = VOP_WRITE(t_fd->vn, &u);
+	if (result) {
+		fdesc_unlockio(t_fd);
+		fdesc_decref(t_fd);
+		return result;
+	}
+	*bytes_written = nbytes-u.uio_resid;
+	fdesc_setoffset(t_fd, u.uio_offset);
+	fdesc_unlockio(t_fd);
+	fdesc_decref(t_fd);
+	return 0;
+}
+
+/*
+ * Common part of readv/writev/pread/pwrite. IOV holds IOVCNT iovecs
+ * (already copied in) pointing at user memory, TOTAL bytes in all.
+ *
+ * If POS is NULL the transfer happens at the file's seek position,
+ * which is advanced under the open file's I/O lock - same as
+ * read/write. If POS is given the
+ * transfer happens there and the seek position is neither used nor
+ * changed, so several threads sharing a file can do positional I/O
+ * on it without stepping on each other.
+ */
+static int
+file_iorw(int fd, struct iovec *iov, int iovcnt, size_t total,
+	  const off_t *pos, enum uio_rw rw, size_t *done)
+{
+	struct fdesc *t_fd;
+	struct uio u;
+	int result;
+
+	result = filetable_get(curthread->t_filetable, fd, &t_fd);
+	if (result)
 	{
+		return result;
+	}
+	/* O_RDONLY is 0, so look at the whole access mode */
+	if ((t_fd->flags & O_ACCMODE) ==
+	    (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+		fdesc_decref(t_fd);
 		return EBADF;
 	}
-	lock_acquire(t_fd->lock);
-		if (!( (t_fd->flags & O_WRONLY) == O_WRONLY
-			|| (t_fd->flags & O_RDWR) == O_RDWR))
-		{
-			lock_release(t_fd->lock);
-			return EBADF;
-		}
-		iov.iov_ubase = (userptr_t)buf;
-		iov.iov_len = nbytes;		 // length of the memory space
-		u.uio_iov = &iov;
-		u.uio_iovcnt = 1;
-		u.uio_resid = nbytes;          // amount to write to file
-		u.uio_offset = t_fd->offset;
-		u.uio_segflg = UIO_USERSPACE;
-		u.uio_rw = UIO_WRITE;
-		u.uio_space = curthread->t_addrspace;
-		int result = VOP_WRITE(t_fd->vn, &u);
+
+	u.uio_iov = iov;
+	u.uio_iovcnt = iovcnt;
+	u.uio_resid = total;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = curthread->t_addrspace;
+
+	if (pos != NULL) {
+		/* VOP_TRYSEEK says ESPIPE for the console */
+		result = (*pos < 0) ? EINVAL : VOP_TRYSEEK(t_fd->vn, *pos);
 		if (result) {
-			lock_release(t_fd->lock);
+			fdesc_decref(t_fd);
 			return result;
 		}
-		*bytes_written = nbytes-u.uio_resid;
-		t_fd->offset += (*bytes_written);
-	lock_release(t_fd->lock);
-	return 0;
+		u.uio_offset = *pos;
+	}
+	else {
+		fdesc_lockio(t_fd);
+		u.uio_offset = fdesc_getoffset(t_fd);
+	}
+
+	result = (rw == UIO_READ) ?
+		VOP_READ(t_fd->vn, &u) : VOP_WRITE(t_fd->vn, &u);
+	if (result == 0) {
+		*done = total - u.uio_resid;
+		if (pos == NULL) {
+			fdesc_setoffset(t_fd, u.uio_offset);
+		}
+	}
+	if (pos == NULL) {
+		fdesc_unlockio(t_fd);
+	}
+	fdesc_decref(t_fd);
+	return result;
 }
 
-int sys_close(int fd)
+/*
+ * Copy in and check a user iovec array for readv/writev. The user
+ * and kernel struct iovec have the same layout, so it's copied as-is.
+ * The caller frees *RET with kfree.
+ */
+static int
+file_copyiniov(userptr_t uiov, int iovcnt, struct iovec **ret, size_t *total)
 {
+	struct iovec *iov;
+	size_t sum;
+	int i, result;
 
-	if (fd < 0 || fd >= OPEN_MAX)
-	{
-		return EBADF;
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
 	}
-	struct fdesc *t_fdesc = curthread->t_fdtable[fd];
-	if(t_fdesc == NULL) {
-		return EBADF;
+	if (uiov == NULL) {
+		return EFAULT;
+	}
+	iov = kmalloc(iovcnt * sizeof(*iov));
+	if (iov == NULL) {
+		return ENOMEM;
 	}
-	lock_acquire(t_fdesc->lock);
-	t_fdesc->ref_count--;
-	curthread->t_fdtable[fd] = NULL;
-	if(t_fdesc->ref_count == 0) {
-		vfs_close(t_fdesc->vn);
-		lock_release(t_fdesc->lock);
-		fdesc_destroy(t_fdesc);
-	}else{
-		lock_release(t_fdesc->lock);
+	result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+	if (result) {
+		kfree(iov);
+		return result;
+	}
+
+	sum = 0;
+	for (i=0; i<iovcnt; i++) {
+		/* the total has to fit in the (signed) return value */
+		if (iov[i].iov_len > FILE_IOMAX - sum) {
+			kfree(iov);
+			return EINVAL;
+		}
+		sum += iov[i].iov_len;
 	}
+
+	*ret = iov;
+	*total = sum;
 	return 0;
 }
-/*********** RR: 26Feb2015 ***********/
-int sys_lseek(int fd, off_t pos, int whence, off_t *new_pos)
+
+int
+sys_readv(int fd, userptr_t uiov, int iovcnt, size_t *bytes_read)
 {
-	if (fd < 0 || fd >= OPEN_MAX)
+	struct iovec *iov;
+	size_t total;
+	int result;
+
+	result = file_copyiniov(uiov, iovcnt, &iov, &total);
+	if (result) {
+		return result;
+	}
+	result = file_iorw(fd, iov, iovcnt, total, NULL, UIO_READ, bytes_read);
+	kfree(iov);
+	return result;
+}
+
+int
+sys_writev(int fd, userptr_t uiov, int iovcnt, size_t *bytes_written)
+{
+	struct iovec *iov;
+	size_t total;
+	int result;
+
+	result = file_copyiniov(uiov, iovcnt, &iov, &total);
+	if (result) {
+		return result;
+	}
+	result = file_iorw(fd, iov, iovcnt, total, NULL, UIO_WRITE,
+			   bytes_written);
+	kfree(iov);
+	return result;
+}
+
+int
+sys_pread(int fd, userptr_t buf, size_t nbytes, off_t pos, size_t *bytes_read)
+{
+	struct iovec iov;
+
+	if (buf == NULL)
 	{
-		return EBADF;
+		return EFAULT;
 	}
-	struct fdesc *t_fdesc = curthread->t_fdtable[fd];
-	if(t_fdesc == NULL) {
-		return EBADF;
+	iov.iov_ubase = buf;
+	iov.iov_len = nbytes;
+	return file_iorw(fd, &iov, 1, nbytes, &pos, UIO_READ, bytes_read);
+}
+
+int
+sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t pos,
+	   size_t *bytes_written)
+{
+	struct iovec iov;
+
+	if (buf == NULL)
+	{
+		return EFAULT;
 	}
-	if (strcmp(t_fdesc->name,"con:") == 0)
+	iov.iov_ubase = buf;
+	iov.iov_len = nbytes;
+	return file_iorw(fd, &iov, 1, nbytes, &pos, UIO_WRITE, bytes_written);
+}
+
+/*
+ * sendfile: copy up to COUNT bytes from INFD to OUTFD without the data
+ * passing through userspace. It goes a chunk at a time through a
+ * kernel buffer: one VOP_READ and one VOP_WRITE per chunk, instead of
+ * a read and a write syscall per user buffer, each with its own copy
+ * across the user/kernel boundary.
+ *
+ * If UOFFSET is NULL the input is read at INFD's seek position, which
+ * is advanced; otherwise it's read at *UOFFSET, which is updated, and
+ * INFD's seek position is left alone. The output always goes at
+ * OUTFD's seek position. A short count means EOF on the input or a
+ * short write on the output; an error is only returned if nothing was
+ * copied.
+ */
+int
+sys_sendfile(int outfd, int infd, userptr_t uoffset, size_t count,
+	     size_t *bytes_copied)
+{
+	struct fdesc *in, *out;
+	struct iovec iov;
+	struct uio u;
+	off_t inpos, outpos;
+	size_t done, len, got, put;
+	char *kbuf;
+	int result;
+
+	result = filetable_get(curthread->t_filetable, infd, &in);
+	if (result)
+	{
+		return result;
+	}
+	result = filetable_get(curthread->t_filetable, outfd, &out);
+	if (result)
 	{
-		return ESPIPE;
+		fdesc_decref(in);
+		return result;
 	}
 
-	lock_acquire(t_fdesc->lock);
-		off_t offset = 0;
-		int err = 0;
-		if(whence == SEEK_SET) {
-			offset = pos;
-		} else if (whence == SEEK_CUR) {
-			offset = t_fdesc->offset + pos;
-		} else if (whence == SEEK_END) {
-			struct stat f_stat;
-			err = VOP_STAT(t_fdesc->vn, &f_stat);
-			if (err) {
-				lock_release(t_fdesc->lock);
-				return err;
-			}
-			offset = f_stat.st_size + pos;
-		} else {
-			lock_release(t_fdesc->lock);
-			return EINVAL;
+	if ((in->flags & O_ACCMODE) == O_WRONLY ||
+	    (out->flags & O_ACCMODE) == O_RDONLY)
+	{
+		result = EBADF;
+	}
+	else if (in == out)
+	{
+		/* same open file: reads and writes would chase each other */
+		result = EINVAL;
+	}
+	else if (uoffset != NULL)
+	{
+		result = copyin(uoffset, &inpos, sizeof(inpos));
+		if (result == 0)
+		{
+			/* VOP_TRYSEEK says ESPIPE for the console */
+			result = (inpos < 0) ? EINVAL : VOP_TRYSEEK(in->vn, inpos);
+		}
+	}
+	kbuf = NULL;
+	if (result == 0)
+	{
+		kbuf = kmalloc(SENDFILE_CHUNK);
+		if (kbuf == NULL)
+		{
+			result = ENOMEM;
+		}
+	}
+	if (result)
+	{
+		fdesc_decref(in);
+		fdesc_decref(out);
+		return result;
+	}
+
+	if (count > FILE_IOMAX)
+	{
+		count = FILE_IOMAX;
+	}
+
+	/*
+	 * Hold the I/O lock of each open file whose offset we use. Take
+	 * them in address order, so two sendfiles going opposite ways
+	 * between the same files can't deadlock.
+	 */
+	if (uoffset == NULL && in < out)
+	{
+		fdesc_lockio(in);
+	}
+	fdesc_lockio(out);
+	if (uoffset == NULL && in > out)
+	{
+		fdesc_lockio(in);
+	}
+	if (uoffset == NULL)
+	{
+		inpos = fdesc_getoffset(in);
+	}
+	outpos = fdesc_getoffset(out);
+	done = 0;
+	while (done < count) {
+		len = count - done;
+		if (len > SENDFILE_CHUNK) {
+			len = SENDFILE_CHUNK;
+		}
+
+		uio_kinit(&iov, &u, kbuf, len, inpos, UIO_READ);
+		result = VOP_READ(in->vn, &u);
+		if (result) {
+			break;
+		}
+		got = len - u.uio_resid;
+		if (got == 0) {
+			break;
+		}
+		inpos += got;
+
+		uio_kinit(&iov, &u, kbuf, got, outpos, UIO_WRITE);
+		result = VOP_WRITE(out->vn, &u);
+		put = got - u.uio_resid;
+		outpos += put;
+		done += put;
+		if (result || put < got) {
+			/* what was read but not written is not consumed */
+			inpos -= got - put;
+			break;
 		}
-		err = VOP_TRYSEEK(t_fdesc->vn, offset);
+	}
+
+	fdesc_setoffset(out, outpos);
+	fdesc_unlockio(out);
+	if (uoffset == NULL)
+	{
+		fdesc_setoffset(in, inpos);
+		fdesc_unlockio(in);
+	}
+	fdesc_decref(in);
+	fdesc_decref(out);
+	kfree(kbuf);
+
+	if (done > 0)
+	{
+		result = 0;
+	}
+	if (result == 0 && uoffset != NULL)
+	{
+		result = copyout(&inpos, uoffset, sizeof(inpos));
+	}
+	if (result)
+	{
+		return result;
+	}
+	*bytes_copied = done;
+	return 0;
+}
+
+int sys_close(int fd)
+{
+	struct fdesc *t_fdesc;
+	int err = filetable_remove(curthread->t_filetable, fd, &t_fdesc);
+	if (err) {
+		return err;
+	}
+	fdesc_decref(t_fdesc);
+	return 0;
+}
+/*********** RR: 26Feb2015 ***********/
+int sys_lseek(int fd, off_t pos, int whence, off_t *new_pos)
+{
+	struct fdesc *t_fdesc;
+	int err = filetable_get(curthread->t_filetable, fd, &t_fdesc);
+	if (err) {
+		return err;
+	}
+
+	/* so a seek doesn't land in the middle of a read or write */
+	fdesc_lockio(t_fdesc);
+	off_t offset = 0;
+	if(whence == SEEK_SET) {
+		offset = pos;
+	} else if (whence == SEEK_CUR) {
+		offset = fdesc_getoffset(t_fdesc) + pos;
+	} else if (whence == SEEK_END) {
+		struct stat f_stat;
+		err = VOP_STAT(t_fdesc->vn, &f_stat);
 		if (err) {
-			lock_release(t_fdesc->lock);
+			fdesc_unlockio(t_fdesc);
+			fdesc_decref(t_fdesc);
 			return err;
 		}
-		t_fdesc->offset = offset;
-		*new_pos = t_fdesc->offset;
-	lock_release(t_fdesc->lock);
+		offset = f_stat.st_size + pos;
+	} else {
+		fdesc_unlockio(t_fdesc);
+		fdesc_decref(t_fdesc);
+		return EINVAL;
+	}
+	/* this also says ESPIPE for the console */
+	err = VOP_TRYSEEK(t_fdesc->vn, offset);
+	if (err) {
+		fdesc_unlockio(t_fdesc);
+		fdesc_decref(t_fdesc);
+		return err;
+	}
+	fdesc_setoffset(t_fdesc, offset);
+	fdesc_unlockio(t_fdesc);
+	*new_pos = offset;
+	fdesc_decref(t_fdesc);
 	return 0;
 }
 /*********** RR: 27Feb2015 ***********/
@@ -315,36 +611,28 @@ int sys___getcwd(userptr_t buf, size_t buflen, size_t *data_len)
 /*********** RR: 28Feb2015 ***********/
 int sys_dup2(int oldfd, int newfd, int *ret_fd)
 {
-	int err = 0;
-	if ((oldfd < 0 || oldfd >= OPEN_MAX) || (newfd < 0 || newfd >= OPEN_MAX))
-	{
-		return EBADF;
-	}
-	struct fdesc *old_fdesc = curthread->t_fdtable[oldfd];
-	struct fdesc *new_fdesc = curthread->t_fdtable[newfd];
-	if(old_fdesc == NULL) {
-		return EBADF;
+	struct fdesc *old_fdesc, *new_fdesc;
+	int err = filetable_get(curthread->t_filetable, oldfd, &old_fdesc);
+	if (err) {
+		return err;
 	}
 	if (oldfd == newfd)
 	{
+		fdesc_decref(old_fdesc);
 		*ret_fd = newfd;
 		return 0;
 	}
+	err = filetable_place(curthread->t_filetable, newfd, old_fdesc,
+		&new_fdesc);
+	fdesc_decref(old_fdesc);
+	if (err) {
+		return err;
+	}
+	/* whatever was at newfd is closed */
 	if (new_fdesc != NULL)
 	{
-		err = sys_close(newfd);
-		if (err) {
-			return err;
-		}
+		fdesc_decref(new_fdesc);
 	}
-	curthread->t_fdtable[oldfd]->ref_count++;
-	curthread->t_fdtable[newfd] = curthread->t_fdtable[oldfd];
 	*ret_fd = newfd;
 	return 0;
 }
-
-void fdesc_destroy (struct fdesc *file_fd )
-{
-	lock_destroy(file_fd->lock);
-	kfree(file_fd);
-}
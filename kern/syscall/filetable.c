@@ -0,0 +1,375 @@
+/*
+ * Open files and per-process file descriptor tables.
+ * See filetable.h for the overall picture.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <limits.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <filetable.h>
+
+/* Slots in a new table; doubled as needed up to OPEN_MAX */
+#define FT_INITSIZE 8
+
+////////////////////////////////////////////////////////////
+// open files
+
+struct fdesc *
+fdesc_create(struct vnode *vn, int flags, off_t offset)
+{
+	struct fdesc *f;
+
+	f = kmalloc(sizeof(struct fdesc));
+	if (f == NULL) {
+		return NULL;
+	}
+	f->vn = vn;
+	f->flags = flags;
+	spinlock_init(&f->lock);
+	f->offset = offset;
+	f->ref_count = 1;
+	f->iolock = NULL;
+	if (VOP_TRYSEEK(vn, 0) == 0) {
+		f->iolock = lock_create("fdesc");
+		if (f->iolock == NULL) {
+			spinlock_cleanup(&f->lock);
+			kfree(f);
+			return NULL;
+		}
+	}
+	return f;
+}
+
+void
+fdesc_incref(struct fdesc *f)
+{
+	spinlock_acquire(&f->lock);
+	KASSERT(f->ref_count > 0);
+	f->ref_count++;
+	spinlock_release(&f->lock);
+}
+
+void
+fdesc_decref(struct fdesc *f)
+{
+	int refs;
+
+	spinlock_acquire(&f->lock);
+	KASSERT(f->ref_count > 0);
+	refs = --f->ref_count;
+	spinlock_release(&f->lock);
+
+	if (refs == 0) {
+		vfs_close(f->vn);
+		if (f->iolock != NULL) {
+			lock_destroy(f->iolock);
+		}
+		spinlock_cleanup(&f->lock);
+		kfree(f);
+	}
+}
+
+/*
+ * off_t is 64 bits, so even reading it takes the lock to avoid seeing
+ * half of an update.
+ */
+off_t
+fdesc_getoffset(struct fdesc *f)
+{
+	off_t offset;
+
+	spinlock_acquire(&f->lock);
+	offset = f->offset;
+	spinlock_release(&f->lock);
+	return offset;
+}
+
+void
+fdesc_setoffset(struct fdesc *f, off_t offset)
+{
+	spinlock_acquire(&f->lock);
+	f->offset = offset;
+	spinlock_release(&f->lock);
+}
+
+void
+fdesc_lockio(struct fdesc *f)
+{
+	if (f->iolock != NULL) {
+		lock_acquire(f->iolock);
+	}
+}
+
+void
+fdesc_unlockio(struct fdesc *f)
+{
+	if (f->iolock != NULL) {
+		lock_release(f->iolock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// descriptor tables
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	unsigned i;
+
+	ft = kmalloc(sizeof(struct filetable));
+	if (ft == NULL) {
+		return NULL;
+	}
+	ft->ft_files = kmalloc(FT_INITSIZE * sizeof(struct fdesc *));
+	if (ft->ft_files == NULL) {
+		kfree(ft);
+		return NULL;
+	}
+	ft->ft_used = bitmap_create(OPEN_MAX);
+	if (ft->ft_used == NULL) {
+		kfree(ft->ft_files);
+		kfree(ft);
+		return NULL;
+	}
+	for (i=0; i<FT_INITSIZE; i++) {
+		ft->ft_files[i] = NULL;
+	}
+	ft->ft_size = FT_INITSIZE;
+	ft->ft_refcount = 1;
+	spinlock_init(&ft->ft_lock);
+	return ft;
+}
+
+/*
+ * Make sure slot FD exists. The new array is allocated without the
+ * table lock held; if someone else grew the table meanwhile, ours is
+ * thrown away.
+ */
+static
+int
+filetable_reserve(struct filetable *ft, unsigned fd)
+{
+	struct fdesc **newfiles, **oldfiles;
+	unsigned newsize, i;
+
+	KASSERT(fd < OPEN_MAX);
+
+	spinlock_acquire(&ft->ft_lock);
+	newsize = ft->ft_size;
+	spinlock_release(&ft->ft_lock);
+	if (fd < newsize) {
+		return 0;
+	}
+	while (newsize <= fd) {
+		newsize *= 2;
+	}
+	if (newsize > OPEN_MAX) {
+		newsize = OPEN_MAX;
+	}
+
+	newfiles = kmalloc(newsize * sizeof(struct fdesc *));
+	if (newfiles == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	if (ft->ft_size >= newsize) {
+		oldfiles = newfiles;
+	}
+	else {
+		for (i=0; i<newsize; i++) {
+			newfiles[i] = i < ft->ft_size ? ft->ft_files[i] : NULL;
+		}
+		oldfiles = ft->ft_files;
+		ft->ft_files = newfiles;
+		ft->ft_size = newsize;
+	}
+	spinlock_release(&ft->ft_lock);
+
+	kfree(oldfiles);
+	return 0;
+}
+
+int
+filetable_copy(struct filetable *src, struct filetable **ret)
+{
+	struct filetable *ft;
+	unsigned i;
+	int result;
+
+	ft = filetable_create();
+	if (ft == NULL) {
+		return ENOMEM;
+	}
+
+	/* the source may grow while we're not looking; go until it's big enough */
+	spinlock_acquire(&src->ft_lock);
+	while (ft->ft_size < src->ft_size) {
+		i = src->ft_size;
+		spinlock_release(&src->ft_lock);
+		result = filetable_reserve(ft, i - 1);
+		if (result) {
+			filetable_decref(ft);
+			return result;
+		}
+		spinlock_acquire(&src->ft_lock);
+	}
+	for (i=0; i<src->ft_size; i++) {
+		if (src->ft_files[i] != NULL) {
+			fdesc_incref(src->ft_files[i]);
+			ft->ft_files[i] = src->ft_files[i];
+			bitmap_mark(ft->ft_used, i);
+		}
+	}
+	spinlock_release(&src->ft_lock);
+
+	*ret = ft;
+	return 0;
+}
+
+void
+filetable_incref(struct filetable *ft)
+{
+	spinlock_acquire(&ft->ft_lock);
+	ft->ft_refcount++;
+	spinlock_release(&ft->ft_lock);
+}
+
+void
+filetable_decref(struct filetable *ft)
+{
+	unsigned i;
+	int refs;
+
+	spinlock_acquire(&ft->ft_lock);
+	KASSERT(ft->ft_refcount > 0);
+	refs = --ft->ft_refcount;
+	spinlock_release(&ft->ft_lock);
+	if (refs > 0) {
+		return;
+	}
+
+	for (i=0; i<ft->ft_size; i++) {
+		if (ft->ft_files[i] != NULL) {
+			fdesc_decref(ft->ft_files[i]);
+		}
+	}
+	bitmap_destroy(ft->ft_used);
+	kfree(ft->ft_files);
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft);
+}
+
+int
+filetable_add(struct filetable *ft, struct fdesc *f, int *fd)
+{
+	unsigned ix;
+	int result;
+
+	/*
+	 * Claim the lowest free number, then make sure its slot exists.
+	 * If another thread dup2's onto the number in between, it keeps
+	 * it and we go around again.
+	 */
+	while (1) {
+		spinlock_acquire(&ft->ft_lock);
+		result = bitmap_alloc(ft->ft_used, &ix);
+		spinlock_release(&ft->ft_lock);
+		if (result) {
+			return EMFILE;
+		}
+
+		result = filetable_reserve(ft, ix);
+		if (result) {
+			spinlock_acquire(&ft->ft_lock);
+			bitmap_unmark(ft->ft_used, ix);
+			spinlock_release(&ft->ft_lock);
+			return result;
+		}
+
+		spinlock_acquire(&ft->ft_lock);
+		if (ft->ft_files[ix] == NULL) {
+			ft->ft_files[ix] = f;
+			spinlock_release(&ft->ft_lock);
+			*fd = ix;
+			return 0;
+		}
+		spinlock_release(&ft->ft_lock);
+	}
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct fdesc **ret)
+{
+	struct fdesc *f;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	spinlock_acquire(&ft->ft_lock);
+	f = (unsigned)fd < ft->ft_size ? ft->ft_files[fd] : NULL;
+	if (f != NULL) {
+		fdesc_incref(f);
+	}
+	spinlock_release(&ft->ft_lock);
+
+	if (f == NULL) {
+		return EBADF;
+	}
+	*ret = f;
+	return 0;
+}
+
+int
+filetable_remove(struct filetable *ft, int fd, struct fdesc **ret)
+{
+	struct fdesc *f;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	spinlock_acquire(&ft->ft_lock);
+	f = (unsigned)fd < ft->ft_size ? ft->ft_files[fd] : NULL;
+	if (f != NULL) {
+		ft->ft_files[fd] = NULL;
+		bitmap_unmark(ft->ft_used, fd);
+	}
+	spinlock_release(&ft->ft_lock);
+
+	if (f == NULL) {
+		return EBADF;
+	}
+	*ret = f;
+	return 0;
+}
+
+int
+filetable_place(struct filetable *ft, int fd, struct fdesc *f,
+		struct fdesc **old)
+{
+	int result;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	result = filetable_reserve(ft, fd);
+	if (result) {
+		return result;
+	}
+
+	fdesc_incref(f);
+	spinlock_acquire(&ft->ft_lock);
+	*old = ft->ft_files[fd];
+	ft->ft_files[fd] = f;
+	if (!bitmap_isset(ft->ft_used, fd)) {
+		bitmap_mark(ft->ft_used, fd);
+	}
+	spinlock_release(&ft->ft_lock);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Futexes: sleep until another thread says a user word has changed.
+ *
+ * A futex is just an aligned int in user memory, named by the address
+ * space and virtual address it lives at. Waiters are kept in a small
+ * hash table of buckets; each bucket has a spinlock, a list of waiters
+ * and one wait channel they all sleep on. futex_wake marks the waiters
+ * it picks and wakes the whole channel, and anyone not marked (waiting
+ * on another address in the same bucket) goes back to sleep.
+ *
+ * A waiter goes on its bucket's list before it reads the user word, so
+ * a wake that follows a store the waiter didn't see always finds it.
+ *
+ * Since the key includes the address space, threads of one process can
+ * share a futex but separate processes can't, even through a shared
+ * mapping.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <syscall.h>
+
+/* Must be a power of 2 */
+#define FUTEX_NBUCKETS 64
+
+struct futex_waiter {
+	struct addrspace *fw_as;	/* key: address space... */
+	vaddr_t fw_addr;		/* ...and user address */
+	bool fw_woken;			/* set by futex_wake */
+	struct futex_waiter *fw_next;	/* next in bucket */
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;	/* protects fb_waiters */
+	struct futex_waiter *fb_waiters;
+	struct wchan *fb_wchan;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < FUTEX_NBUCKETS; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_waiters = NULL;
+		futex_table[i].fb_wchan = wchan_create("futex");
+		if (futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+static
+struct futex_bucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t h;
+
+	/* low two bits of ADDR are always zero; mix in the as pointer */
+	h = (addr >> 2) ^ ((uintptr_t)as >> 4);
+	h ^= h >> 7;
+	return &futex_table[h & (FUTEX_NBUCKETS - 1)];
+}
+
+/*
+ * Take FW off FB's list, if futex_wake hasn't already.
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+	struct futex_waiter **pp;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		if (*pp == fw) {
+			*pp = fw->fw_next;
+			return;
+		}
+	}
+}
+
+/*
+ * Sleep until woken by futex_wake on ADDR, but only if the int at ADDR
+ * still holds VAL. Returns EAGAIN if it didn't.
+ */
+int
+sys_futex_wait(userptr_t addr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw;
+	int cur;
+	int result;
+
+	if ((vaddr_t)addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fw.fw_as = curthread->t_addrspace;
+	fw.fw_addr = (vaddr_t)addr;
+	fw.fw_woken = false;
+	fb = futex_bucket(fw.fw_as, fw.fw_addr);
+
+	spinlock_acquire(&fb->fb_lock);
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+	spinlock_release(&fb->fb_lock);
+
+	/* copyin may fault, so it can't be done under the spinlock */
+	result = copyin(addr, &cur, sizeof(int));
+	if (result == 0 && cur != val) {
+		result = EAGAIN;
+	}
+	/*
+	 * Likewise, we're on the list before we look, so if the process
+	 * starts exiting after this, futex_wakeall finds us.
+	 */
+	if (result == 0 && proc_killed()) {
+		result = EINTR;
+	}
+	if (result) {
+		spinlock_acquire(&fb->fb_lock);
+		futex_unlink(fb, &fw);
+		spinlock_release(&fb->fb_lock);
+		return result;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+	while (!fw.fw_woken) {
+		wchan_lock(fb->fb_wchan);
+		spinlock_release(&fb->fb_lock);
+		wchan_sleep(fb->fb_wchan);
+		spinlock_acquire(&fb->fb_lock);
+	}
+	spinlock_release(&fb->fb_lock);
+	return 0;
+}
+
+/*
+ * Wake up to COUNT threads waiting on ADDR and return how many there
+ * were.
+ */
+int
+sys_futex_wake(userptr_t addr, int count, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **pp;
+	struct addrspace *as;
+	int n;
+
+	if ((vaddr_t)addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	as = curthread->t_addrspace;
+	fb = futex_bucket(as, (vaddr_t)addr);
+	n = 0;
+
+	spinlock_acquire(&fb->fb_lock);
+	pp = &fb->fb_waiters;
+	while ((fw = *pp) != NULL && n < count) {
+		if (fw->fw_as == as && fw->fw_addr == (vaddr_t)addr) {
+			*pp = fw->fw_next;
+			fw->fw_woken = true;
+			n++;
+		}
+		else {
+			pp = &fw->fw_next;
+		}
+	}
+	if (n > 0) {
+		wchan_wakeall(fb->fb_wchan);
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = n;
+	return 0;
+}
+
+/*
+ * Wake every thread waiting on any futex in AS, for a process whose
+ * threads are being told to leave. They return from futex_wait as if
+ * woken normally and notice on their way out of the kernel.
+ */
+void
+futex_wakeall(struct addrspace *as)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **pp;
+	unsigned i;
+	bool any;
+
+	for (i = 0; i < FUTEX_NBUCKETS; i++) {
+		fb = &futex_table[i];
+		any = false;
+
+		spinlock_acquire(&fb->fb_lock);
+		pp = &fb->fb_waiters;
+		while ((fw = *pp) != NULL) {
+			if (fw->fw_as == as) {
+				*pp = fw->fw_next;
+				fw->fw_woken = true;
+				any = true;
+			}
+			else {
+				pp = &fw->fw_next;
+			}
+		}
+		if (any) {
+			wchan_wakeall(fb->fb_wchan);
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
@@ -4,9 +4,10 @@
  * Process system calls
  */
 
+#include <types.h>
 #include <syscall.h>
 #include <kern/wait.h>
-#include <kern/procsys.h>
+#include <proc.h>
 #include <thread.h>
 #include <current.h>
 #include <kern/errno.h>
@@ -17,25 +18,23 @@
 #include <addrspace.h>
 #include <vfs.h>
 #include <copyinout.h>
+#include <vnode.h>
+#include <kern/mman.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <filetable.h>
+#include <synch.h>
+#include <trace.h>
 
 
-#define MAX_ARG_NUM 100
-#define MAX_ARG_LENGTH 100
-
-struct pdesc* g_pdtable[PID_LIMIT];
 void childfork_func(void * ptr, unsigned long data2);
-void cleanup_dirtyproc(struct addrspace * as, char **kbuf, int argc);
+void cleanup_dirtyproc(struct addrspace * as, char *arena);
 
 void
 sys__exit(int exitcode)
 {
 
-	struct pdesc *pd = g_pdtable[curthread->t_pid];
-	pd->exitcode = _MKWAIT_EXIT(exitcode);
-	pd->exited = true;
-	lock_acquire(pd->wait_lock);
-	cv_signal(pd->wait_cv,pd->wait_lock);
-	lock_release(pd->wait_lock);
+	proc_exit(_MKWAIT_EXIT(exitcode));
 	thread_exit();
 }
 
@@ -53,11 +52,6 @@ sys_waitpid(int pid, userptr_t status, int options, pid_t *ret_pid)
 		return EFAULT;
 	}
 
-	if (pid < 0 || pid >= PID_LIMIT)
-	{
-		return ESRCH;
-	}
-
 	if (options != 0 &&
 		options != 1 &&
 		options != 2 )
@@ -65,41 +59,15 @@ sys_waitpid(int pid, userptr_t status, int options, pid_t *ret_pid)
 		return EINVAL;
 	}
 
-	struct pdesc *pd = g_pdtable[pid];
-	if (pd == NULL)
-	{
-		return ESRCH;
-	}
-
-	if (pd->ppid != curthread->t_pid)
-	{
-		return ECHILD; //Not parent
-	}
-
-	if (pd->exited == false && options == WNOHANG)
-	{
-		*ret_pid = 0;
-		return 0;
-	}
-
-	lock_acquire(pd->wait_lock);
-	while (pd->exited == false)
-	{
-		cv_wait(pd->wait_cv, pd->wait_lock);
-	}
-	lock_release(pd->wait_lock);
-
-
-	*ret_pid = pid;
-	err = copyout(&pd->exitcode, status, sizeof(int));
-	if (err)
+	int exitcode;
+	err = proc_wait(curthread->t_proc, pid, options, &exitcode, ret_pid);
+	if (err || *ret_pid == 0)
 	{
 		return err;
 	}
-	pdesc_destroy(pd);
-	g_pdtable[pid] = NULL;
 
-	return 0;
+	/* The child is gone by now, so a bad pointer loses its status */
+	return copyout(&exitcode, status, sizeof(int));
 }
 
 int
@@ -113,13 +81,35 @@ sys_fork(struct trapframe *tf, pid_t *ret_pid)
 	memmove(child_tf,tf,sizeof(struct trapframe));
 	int err;
 
-	struct thread *child_thread;
-	err = thread_fork("child", childfork_func, child_tf, (vaddr_t)NULL, &child_thread);
+	/* RB:The child gets a copy of our address space */
+	struct addrspace *child_as;
+	err = as_copy(curthread->t_addrspace, &child_as);
 	if (err)
 	{
+		kfree(child_tf);
+		return err;
+	}
+
+	struct proc *child;
+	err = proc_create(curthread->t_proc, &child);
+	if (err)
+	{
+		as_destroy(child_as);
+		kfree(child_tf);
+		return err;
+	}
+	/* read the pid now; the child may exit and be reaped at any time */
+	*ret_pid = child->p_pid;
+
+	err = thread_fork_proc("child", child, childfork_func, child_tf,
+		(unsigned long)child_as, NULL);
+	if (err)
+	{
+		proc_destroy(child);
+		as_destroy(child_as);
+		kfree(child_tf);
 		return err;
 	}
-	*ret_pid = child_thread->t_pid;
 	return 0;
 
 }
@@ -136,10 +126,209 @@ void childfork_func(void * tf_ptr, unsigned long as)
 	tf.tf_v0 = 0;
 	tf.tf_a3 = 0;
 	tf.tf_epc += 4;
-	(void)as;
+	curthread->t_addrspace = (struct addrspace *)as;
+	as_activate(curthread->t_addrspace);
 	mips_usermode(&tf);
 }
 
+static
+void
+uthread_start(void *tf_ptr, unsigned long ut)
+{
+	struct trapframe tf;
+
+	memmove(&tf,tf_ptr,sizeof(struct trapframe));
+	kfree(tf_ptr);
+	curthread->t_uthread = (struct uthread *)ut;
+	/* the process may have started exiting before we got going */
+	proc_checkkill();
+	mips_usermode(&tf);
+}
+
+/*
+ * Start a new thread in this process at user address ENTRY, called as
+ * ENTRY(FUNC, ARG) on a stack of its own. The new thread shares the
+ * address space and file table. libc's threadfork passes a
+ * trampoline as ENTRY that calls FUNC(ARG) and then threadexit.
+ */
+int
+sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t func,
+	userptr_t arg, pid_t *ret_tid)
+{
+	struct addrspace *as = curthread->t_addrspace;
+	struct proc *p = curthread->t_proc;
+	struct trapframe *child_tf;
+	struct uthread *ut;
+	unsigned slot;
+	vaddr_t stackptr;
+	int err;
+
+	err = as_allocstack(as, &slot, &stackptr);
+	if (err)
+	{
+		return err;
+	}
+	err = proc_addthread(p, slot, &ut);
+	if (err)
+	{
+		as_freestack(as, slot);
+		return err;
+	}
+
+	/* Same registers as the caller (notably gp), but a new pc and sp */
+	child_tf = kmalloc(sizeof(struct trapframe));
+	if (child_tf == NULL)
+	{
+		proc_removethread(p, ut);
+		as_freestack(as, slot);
+		return ENOMEM;
+	}
+	memmove(child_tf, tf, sizeof(struct trapframe));
+	child_tf->tf_epc = (vaddr_t)entry;
+	child_tf->tf_a0 = (vaddr_t)func;
+	child_tf->tf_a1 = (vaddr_t)arg;
+	child_tf->tf_sp = stackptr;
+	child_tf->tf_ra = 0;
+
+	/* read the tid now; the thread may exit and be joined at any time */
+	*ret_tid = ut->ut_tid;
+	err = thread_fork_proc("uthread", p, uthread_start, child_tf,
+		(unsigned long)ut, NULL);
+	if (err)
+	{
+		kfree(child_tf);
+		proc_removethread(p, ut);
+		as_freestack(as, slot);
+		return err;
+	}
+	return 0;
+}
+
+int
+sys_threadjoin(pid_t tid, userptr_t status)
+{
+	int exitcode;
+	int err;
+
+	err = proc_jointhread(curthread->t_proc, tid, &exitcode);
+	if (err || status == NULL)
+	{
+		return err;
+	}
+	return copyout(&exitcode, status, sizeof(int));
+}
+
+void
+sys_threadexit(int exitcode)
+{
+	proc_threadexit(_MKWAIT_EXIT(exitcode));
+	thread_exit();
+}
+
+/*
+ * Copy the argument strings for exec into ARENA, which is ARG_MAX
+ * bytes. The strings are packed from the start of the arena, and argv[]
+ * is built as offsets into them working down from the end, so the two
+ * together are limited to ARG_MAX as POSIX intends. On success argv[]
+ * is left in order (with its NULL) in the last ARGC+1 words.
+ */
+static
+int
+execv_copyinargs(userptr_t u_uargs, char *arena, int *ret_argc,
+	size_t *ret_strsize)
+{
+	userptr_t *argv_end = (userptr_t *)(arena + ARG_MAX);
+	userptr_t uarg, tmp;
+	size_t used = 0, len, reserve;
+	int argc = 0, err;
+
+	while (1)
+	{
+		err = copyin((userptr_t)((vaddr_t)u_uargs + argc * sizeof(userptr_t)),
+			&uarg, sizeof(userptr_t));
+		if (err)
+		{
+			return err;
+		}
+		if (uarg == NULL)
+		{
+			break;
+		}
+
+		/* room for this pointer and the NULL after it */
+		reserve = (argc + 2) * sizeof(userptr_t);
+		if (used + reserve >= ARG_MAX)
+		{
+			return E2BIG;
+		}
+		err = copyinstr(uarg, arena + used, ARG_MAX - used - reserve, &len);
+		if (err)
+		{
+			return err == ENAMETOOLONG ? E2BIG : err;
+		}
+		argv_end[-(argc + 1)] = (userptr_t)used;
+		used += len;
+		argc++;
+	}
+
+	/* argv[] went in backwards; turn it around, NULL last */
+	userptr_t *argv = argv_end - (argc + 1);
+	argv[0] = NULL;
+	for (int i = 0, j = argc; i < j; i++, j--)
+	{
+		tmp = argv[i];
+		argv[i] = argv[j];
+		argv[j] = tmp;
+	}
+
+	*ret_argc = argc;
+	*ret_strsize = used;
+	return 0;
+}
+
+/*
+ * Load the program in V into the current (new, empty, active) address
+ * space and put the arguments gathered by execv_copyinargs on its
+ * stack. Hands back where to start it; does not close V.
+ */
+static
+int
+execv_load(struct vnode *v, char *arena, int argc, size_t strsize,
+	vaddr_t *entrypoint, vaddr_t *stackptr)
+{
+	int err;
+
+	err = load_elf(v, entrypoint);
+	if (err)
+	{
+		return err;
+	}
+	err = as_define_stack(curthread->t_addrspace, stackptr);
+	if (err)
+	{
+		return err;
+	}
+
+	/*
+	 * RR:Put the strings at the top of the stack and argv[] right below
+	 * them; then it's two copyouts however many arguments there are.
+	 */
+	userptr_t *argv = (userptr_t *)(arena + ARG_MAX) - (argc + 1);
+	vaddr_t strbase = *stackptr - ROUNDUP(strsize, 8);
+	*stackptr = strbase - ROUNDUP((argc + 1) * sizeof(userptr_t), 8);
+	for (int i = 0; i < argc; ++i)
+	{
+		argv[i] = (userptr_t)(strbase + (vaddr_t)argv[i]);
+	}
+	err = copyout(arena, (userptr_t)strbase, strsize);
+	if (err)
+	{
+		return err;
+	}
+	return copyout(argv, (userptr_t)*stackptr,
+		(argc + 1) * sizeof(userptr_t));
+}
+
 int
 sys_execv(userptr_t u_program, userptr_t u_uargs)
 {
@@ -160,48 +349,54 @@ sys_execv(userptr_t u_program, userptr_t u_uargs)
 		return EISDIR;
 	}
 
-	char *uargs[MAX_ARG_NUM];
-	err = copyin(u_uargs,uargs,MAX_ARG_NUM);
+	/*
+	 * Gather the arguments into one arena, laid out the way they go
+	 * on the new stack, before the old address space goes away.
+	 */
+	char *arena = kmalloc(ARG_MAX);
+	if (arena == NULL)
+	{
+		return ENOMEM;
+	}
+	int argc;
+	size_t strsize;
+	err = execv_copyinargs(u_uargs, arena, &argc, &strsize);
 	if (err)
 	{
+		kfree(arena);
 		return err;
 	}
 
-	int index = 0;
-	int copylength = 0;
-	char *kbuf[MAX_ARG_NUM];
-	while(uargs[index] != NULL) {
-		kbuf[index] = kmalloc(MAX_ARG_LENGTH);
-		if (kbuf[index] == NULL)
-		{
-			return ENOMEM;
-		}
-		err = copyin((const userptr_t) uargs[index], (char *)kbuf[index], (size_t)MAX_ARG_LENGTH);
-		if (err) {
-
-			cleanup_dirtyproc(NULL, kbuf, index+1);
-			return err;
-		}
-		int arg_length = strlen(uargs[index]);
-		int padding = (4-((arg_length+1)%4))%4;		//align by 4 (including \0 at the end)
-		copylength += arg_length+padding +1;
-		index++;
+	/* vfs_open may scribble on the path; keep it for the process name */
+	char *name = kstrdup(program);
+	if (name == NULL)
+	{
+		kfree(arena);
+		return ENOMEM;
 	}
-	int argc = index;
-	copylength += 4*(argc+1);
 
 	/************ RR:Rest of run program ************/
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
-	int prog_len = strlen(program);
-	char temp_progname[prog_len];
-	strcpy(temp_progname,program);
-	err = vfs_open(temp_progname, O_RDONLY, 0, &v);
+	err = vfs_open(program, O_RDONLY, 0, &v);
 	if (err) {
-		cleanup_dirtyproc(NULL, kbuf, index+1);
+		kfree(name);
+		kfree(arena);
 		return err;
 	}
 
+	/*
+	 * The new image has only one thread, so the others go now, while
+	 * the old address space is still ours. If loading fails after
+	 * this, we return to a process with just this thread left in it.
+	 */
+	err = proc_singlethread();
+	if (err) {
+		vfs_close(v);
+		kfree(name);
+		kfree(arena);
+		return err;
+	}
 
 	/* Free . */
 	struct addrspace *parent_as = NULL;
@@ -213,59 +408,38 @@ sys_execv(userptr_t u_program, userptr_t u_uargs)
 	// /* Create a new address space. */
 	curthread->t_addrspace = as_create();
 	if (curthread->t_addrspace==NULL) {
-		cleanup_dirtyproc(NULL, kbuf, argc);
+		curthread->t_addrspace = parent_as;
+		kfree(name);
+		kfree(arena);
 		vfs_close(v);
 		return ENOMEM;
 	}
 	/* Activate it. */
 	as_activate(curthread->t_addrspace);
-	/* Load the executable. */
-	err = load_elf(v, &entrypoint);
-	if (err) {
-		cleanup_dirtyproc(parent_as, kbuf, argc);
-		vfs_close(v);
-		return err;
-	}
+	/* Load the executable and set up its stack. */
+	err = execv_load(v, arena, argc, strsize, &entrypoint, &stackptr);
 	/* Done with the file now. */
 	vfs_close(v);
-	/* Define the user stack in the address space */
-	err = as_define_stack(curthread->t_addrspace, &stackptr);
 	if (err) {
-		cleanup_dirtyproc(parent_as, kbuf, argc);
+		kfree(name);
+		cleanup_dirtyproc(parent_as, arena);
 		return err;
 	}
 
-	/************ RR:Pack the variables and dispatch them ************/
-	stackptr -= copylength;
-	int prev_offset = 0;
-	char* ret_buf[argc+1];
-	/*********** RR:moving contents from kernel buffer to user stack ***********/
-	for (int l = 0; l < argc; ++l)
+	kfree(arena);
+	/*
+	 * A thread from threadfork gives its stack slot back to the old
+	 * image; from here on it runs on the new image's main stack, which
+	 * isn't a slot.
+	 */
+	if (curthread->t_uthread != NULL)
 	{
-		int arg_length = strlen(kbuf[l]);
-		int padding = (4-((arg_length+1)%4))%4;
-		char * dest = (char *)stackptr+(index+1)*4+prev_offset;
-		err = copyout(kbuf[l],(userptr_t)dest,(size_t)arg_length+1);
-		if (err) {
-			cleanup_dirtyproc(parent_as, kbuf, argc);
-			return err;
-		}
-		for (int i = arg_length; i < arg_length+padding+1; ++i)
-		{
-			dest[i] = '\0';
-		}
-		ret_buf[l] = (char *)dest;
-		prev_offset += (arg_length+padding+1);
+		as_freestack(parent_as, curthread->t_uthread->ut_stack);
+		curthread->t_uthread->ut_stack = UT_NOSTACK;
 	}
-	ret_buf[argc] = NULL;
-	err = copyout(ret_buf,(userptr_t)stackptr, sizeof(ret_buf));
-	if (err) {
-		cleanup_dirtyproc(parent_as, kbuf, argc);
-		return err;
-	}
-
-	cleanup_dirtyproc(NULL, kbuf, argc);
 	as_destroy(parent_as);
+	proc_setname(curthread->t_proc, name);
+	kfree(name);
 
 	enter_new_process(argc, (userptr_t)stackptr /*userspace addr of argv*/,
 			  stackptr, entrypoint);
@@ -277,50 +451,341 @@ sys_execv(userptr_t u_program, userptr_t u_uargs)
 	return EINVAL;
 }
 
-void pdesc_destroy(struct pdesc * pd)
+/*
+ * What sys_spawnv hands to the new process. The parent sleeps on
+ * sp_done until the child has loaded the program (or failed to), so
+ * load errors come back from spawnv just as they would from execv.
+ */
+struct spawn_args
+{
+	struct vnode *sp_vn;
+	char *sp_arena;
+	int sp_argc;
+	size_t sp_strsize;
+	struct semaphore *sp_done;
+	int sp_result;
+};
+
+static
+void
+spawn_child(void *ptr, unsigned long unused)
 {
-	cv_destroy(pd->wait_cv);
-	lock_destroy(pd->wait_lock);
-	kfree(pd);
+	struct spawn_args *sp = ptr;
+	vaddr_t entrypoint, stackptr;
+	int argc = sp->sp_argc;
+	int err;
+
+	(void)unused;
+
+	curthread->t_addrspace = as_create();
+	if (curthread->t_addrspace == NULL)
+	{
+		err = ENOMEM;
+	}
+	else
+	{
+		as_activate(curthread->t_addrspace);
+		err = execv_load(sp->sp_vn, sp->sp_arena, argc, sp->sp_strsize,
+			&entrypoint, &stackptr);
+	}
+
+	/* the parent frees SP as soon as it wakes up */
+	sp->sp_result = err;
+	V(sp->sp_done);
+
+	if (err)
+	{
+		proc_exit(_MKWAIT_EXIT(255));
+		thread_exit();
+	}
+	enter_new_process(argc, (userptr_t)stackptr /*userspace addr of argv*/,
+			  stackptr, entrypoint);
+	/* enter_new_process does not return. */
+	panic("enter_new_process returned\n");
 }
 
-void cleanup_dirtyproc(struct addrspace * as, char **kbuf, int argc)
+/*
+ * Start PROGRAM with ARGS in a new child process, like fork+execv but
+ * without copying the parent's address space first. The child starts
+ * with a fresh address space and shares the parent's open files and
+ * working directory as a forked child would.
+ */
+int
+sys_spawnv(userptr_t u_program, userptr_t u_uargs, pid_t *ret_pid)
 {
-	if (as)
+	char program[NAME_MAX];
+	char *name;
+	struct spawn_args sp;
+	struct proc *child;
+	size_t actual;
+	pid_t pid;
+	int status, err;
+
+	err = copyinstr(u_program, program, NAME_MAX, &actual);
+	if (err)
 	{
-		as_destroy(curthread->t_addrspace);
-		curthread->t_addrspace = as;
+		return err;
 	}
-	for (int i = 0; i < argc; ++i)
+	if (strcmp(program,"") == 0)
 	{
-		kfree(kbuf[i]);
+		return EISDIR;
+	}
+
+	sp.sp_arena = kmalloc(ARG_MAX);
+	if (sp.sp_arena == NULL)
+	{
+		return ENOMEM;
+	}
+	err = execv_copyinargs(u_uargs, sp.sp_arena, &sp.sp_argc,
+		&sp.sp_strsize);
+	if (err)
+	{
+		goto fail_arena;
+	}
+	/* as in execv, vfs_open may scribble on the path */
+	name = kstrdup(program);
+	if (name == NULL)
+	{
+		err = ENOMEM;
+		goto fail_arena;
+	}
+	err = vfs_open(program, O_RDONLY, 0, &sp.sp_vn);
+	if (err)
+	{
+		goto fail_name;
+	}
+	sp.sp_done = sem_create("spawn", 0);
+	if (sp.sp_done == NULL)
+	{
+		err = ENOMEM;
+		goto fail_vn;
+	}
+
+	err = proc_create(curthread->t_proc, &child);
+	if (err)
+	{
+		goto fail_sem;
+	}
+	pid = child->p_pid;
+	proc_setname(child, name);
+	err = thread_fork_proc("child", child, spawn_child, &sp, 0, NULL);
+	if (err)
+	{
+		proc_destroy(child);
+		goto fail_sem;
+	}
+
+	P(sp.sp_done);
+	err = sp.sp_result;
+	if (err)
+	{
+		/* it has exited or is about to; don't leave a zombie */
+		proc_wait(curthread->t_proc, pid, 0, &status, &pid);
+	}
+	else
+	{
+		*ret_pid = pid;
 	}
+
+ fail_sem:
+	sem_destroy(sp.sp_done);
+ fail_vn:
+	vfs_close(sp.sp_vn);
+ fail_name:
+	kfree(name);
+ fail_arena:
+	kfree(sp.sp_arena);
+	return err;
+}
+
+/* Put back the old address space after a failed exec */
+void cleanup_dirtyproc(struct addrspace * as, char *arena)
+{
+	struct addrspace *new_as = curthread->t_addrspace;
+	curthread->t_addrspace = as;
+	as_activate(as);
+	as_destroy(new_as);
+	kfree(arena);
 }
 
 int
 sys_sbrk(intptr_t amount,struct addrspace* as,int *returnVal)
 {
 
+	int err = 0;
+
+	/* other threads may be moving the break or mapping things too */
+	lock_acquire(as->as_lock);
 	/*********** RR: logic for alignment checking ***********/
 	//if amount is not aligned, reject
 	vaddr_t new_heap = as->heap_end + amount;
 	unsigned int tempAmount = amount > 0 ?amount:(amount * -1);
 	if(amount > 0 || tempAmount <= as->heap_end - as->heap_start)
 	{
-		if ((tempAmount <= USERSTACKBASE - as->heap_end) &&
+		if ((tempAmount <= as->mmap_start - as->heap_end) &&
 			(tempAmount < USERHEAPLIMIT))
 		{
 			*returnVal = as->heap_end;
 			as->heap_end = new_heap;
-			kprintf("Heap moved to %lx\n",(long unsigned int)as->heap_end);
-			return 0;
+			TRACE(DB_VM, "sbrk %d: heap moved to %x",
+			      amount, as->heap_end);
 		}else{
-			return ENOMEM;
+			err = ENOMEM;
 		}
 	}
 	else
 	{
 		*returnVal = -1;
+		err = EINVAL;
+	}
+	lock_release(as->as_lock);
+	return err;
+}
+
+/*
+ * mmap. Mappings are placed top down below the stack, and pages are
+ * faulted in on demand: zero-filled for MAP_ANON, read from the file
+ * otherwise. Shared anonymous memory isn't supported, since fork
+ * copies every page.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	off_t offset, int *retval)
+{
+	struct addrspace *as = curthread->t_addrspace;
+	struct vnode *vn = NULL;
+	vaddr_t base = (vaddr_t)addr;
+	int maptype = flags & MAP_TYPE;
+	int err;
+
+	if (len == 0)
+	{
+		return EINVAL;
+	}
+	if (maptype != MAP_SHARED && maptype != MAP_PRIVATE)
+	{
+		return EINVAL;
+	}
+	if ((prot & ~(PROT_READ|PROT_WRITE|PROT_EXEC)) != 0)
+	{
+		return EINVAL;
+	}
+	/* not PAGE_FRAME, which would cut a 64-bit offset to 32 bits */
+	if (offset < 0 || offset % PAGE_SIZE != 0)
+	{
+		return EINVAL;
+	}
+	len = (len + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (len == 0)
+	{
+		return ENOMEM;
+	}
+
+	if (flags & MAP_ANON)
+	{
+		if (maptype == MAP_SHARED)
+		{
+			return EUNIMP;
+		}
+	}
+	else
+	{
+		struct fdesc *t_fd;
+		err = filetable_get(curthread->t_filetable, fd, &t_fd);
+		if (err)
+		{
+			return err;
+		}
+		int accmode = t_fd->flags & O_ACCMODE;
+		if (accmode == O_WRONLY)
+		{
+			err = EACCES;
+		}
+		else if (maptype == MAP_SHARED && (prot & PROT_WRITE) &&
+			accmode != O_RDWR)
+		{
+			err = EACCES;
+		}
+		else
+		{
+			/* the mapping holds its own reference to the vnode */
+			vn = t_fd->vn;
+			err = VOP_MMAP(vn);
+		}
+		fdesc_decref(t_fd);
+		if (err)
+		{
+			return err;
+		}
+	}
+
+	err = as_mmap(as, &base, len, prot, flags, vn, offset);
+	if (err)
+	{
+		return err;
+	}
+	*retval = (int)base;
+	return 0;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	vaddr_t base = (vaddr_t)addr;
+
+	if ((base & PAGE_FRAME) != base || len == 0)
+	{
 		return EINVAL;
 	}
+	len = (len + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (len == 0 || base + len < base || base + len > USERSPACETOP)
+	{
+		return EINVAL;
+	}
+	return as_munmap(curthread->t_addrspace, base, len);
+}
+
+/*
+ * Hand back usage (see rusage.h) as a struct rusage. ru_nswap counts
+ * pages swapped in, and ru_maxrss is the peak resident set of any one
+ * thread's address space. There is nothing to go on for the block,
+ * message, signal and integral memory counts, so they stay zero.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+	struct ru_counts *rc;
+	struct rusage ru;
+	int err;
+
+	/* too big for the stack */
+	rc = kmalloc(sizeof(*rc));
+	if (rc == NULL)
+	{
+		return ENOMEM;
+	}
+	err = proc_getrusage(curthread->t_proc, who, rc);
+	if (err)
+	{
+		kfree(rc);
+		return err;
+	}
+
+	bzero(&ru, sizeof(ru));
+	ru.ru_utime.tv_sec = rc->rc_utime / 1000000;
+	ru.ru_utime.tv_usec = rc->rc_utime % 1000000;
+	ru.ru_stime.tv_sec = rc->rc_stime / 1000000;
+	ru.ru_stime.tv_usec = rc->rc_stime % 1000000;
+	ru.ru_maxrss = rc->rc_maxrss * (PAGE_SIZE / 1024);
+	ru.ru_minflt = rc->rc_minflt;
+	ru.ru_majflt = rc->rc_majflt;
+	ru.ru_nswap = rc->rc_nswapin;
+	ru.ru_nvcsw = rc->rc_nvcsw;
+	ru.ru_nivcsw = rc->rc_nivcsw;
+	ru.ru_nsyscall = rc->rc_nsyscalls;
+	ru.ru_inbytes = rc->rc_inbytes;
+	ru.ru_outbytes = rc->rc_outbytes;
+	kfree(rc);
+
+	return copyout(&ru, usage, sizeof(ru));
 }
@@ -46,6 +46,8 @@
 #include <test.h>
 #include <synch.h>
 #include <copyinout.h>
+#include <filetable.h>
+#include <proc.h>
 /*
  * Load program "progname" and start running it in usermode.
  * Does not return except on error.
@@ -69,6 +71,10 @@ runprogram(char *progname)
 	/* We should be a new thread. */
 	KASSERT(curthread->t_addrspace == NULL);
 
+	if (curthread->t_proc != NULL) {
+		proc_setname(curthread->t_proc, temp_progname);
+	}
+
 	// /* Create a new address space. */
 	curthread->t_addrspace = as_create();
 	if (curthread->t_addrspace==NULL) {
@@ -98,58 +104,44 @@ runprogram(char *progname)
 	}
 
 	/************ RB:Initialize console - Begin ************/
-	// stdin
-	struct vnode *stdin;
-	char consolePath[5];
-	strcpy(consolePath,"con:");
-	result = vfs_open(consolePath, O_RDONLY, 0664, &stdin);
-	if (result)
-	{
-		return result;
-	}
-	struct fdesc * stdin_fd = kmalloc(sizeof(struct fdesc));
-	strcpy(stdin_fd->name,"con:");
-	stdin_fd->flags = O_RDONLY;
-	stdin_fd->offset = 0;
-	stdin_fd->ref_count = 1;
-	stdin_fd->lock = lock_create("con");
-	stdin_fd->vn =stdin;
-
-	// stdout
-	struct vnode *stdout;
-	strcpy(consolePath,"con:");
-	result = vfs_open(consolePath, O_WRONLY, 0664, &stdout);
-	if (result)
+	if (curthread->t_filetable == NULL)
 	{
-		return result;
+		curthread->t_filetable = filetable_create();
+		if (curthread->t_filetable == NULL)
+		{
+			return ENOMEM;
+		}
 	}
-	struct fdesc * stdout_fd = kmalloc(sizeof(struct fdesc));
-	strcpy(stdout_fd->name,"con:");
-	stdout_fd->flags = O_WRONLY;
-	stdout_fd->offset = 0;
-	stdout_fd->ref_count = 1;
-	stdout_fd->lock = lock_create("con");
-	stdout_fd->vn =stdout;
-
-	//stderr
-	struct vnode *stderr;
-	strcpy(consolePath,"con:");
-	result = vfs_open(consolePath, O_WRONLY, 0664, &stderr);
-	if (result)
+
+	/* stdin, stdout, stderr: the table is empty, so they get 0, 1, 2 */
+	static const int con_flags[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	for (int i = 0; i < 3; i++)
 	{
-		return result;
+		struct vnode *con;
+		struct fdesc *con_fd;
+		char consolePath[5];
+		int fd;
+
+		strcpy(consolePath,"con:");
+		result = vfs_open(consolePath, con_flags[i], 0664, &con);
+		if (result)
+		{
+			return result;
+		}
+		con_fd = fdesc_create(con, con_flags[i], 0);
+		if (con_fd == NULL)
+		{
+			vfs_close(con);
+			return ENOMEM;
+		}
+		result = filetable_add(curthread->t_filetable, con_fd, &fd);
+		if (result)
+		{
+			fdesc_decref(con_fd);
+			return result;
+		}
+		KASSERT(fd == i);
 	}
-	struct fdesc * stderr_fd = kmalloc(sizeof(struct fdesc));
-	strcpy(stderr_fd->name,"con:");
-	stderr_fd->flags = O_WRONLY;
-	stderr_fd->offset = 0;
-	stderr_fd->ref_count = 1;
-	stderr_fd->lock = lock_create("con");
-	stderr_fd->vn =stderr;
-
-	curthread->t_fdtable[0] = stdin_fd;
-	curthread->t_fdtable[1] = stdout_fd;
-	curthread->t_fdtable[2] = stderr_fd;
 
 	/************ RB:End ************/
 
@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,36 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in *REQ. Nothing interrupts a sleep, so *REM is
+ * never written.
+ */
+int
+sys_nanosleep(const_userptr_t req, userptr_t rem)
+{
+	struct timespec ts;
+	time_t secs;
+	uint32_t nsecs;
+	int result;
+
+	(void)rem;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	gettime(&secs, &nsecs);
+	secs += ts.tv_sec;
+	nsecs += ts.tv_nsec;
+	if (nsecs >= 1000000000) {
+		nsecs -= 1000000000;
+		secs++;
+	}
+	thread_sleep_until(secs, nsecs);
+	return 0;
+}
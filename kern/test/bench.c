@@ -0,0 +1,786 @@
+/*
+ * In-kernel microbenchmarks, run from the "?b" menu.
+ *
+ * Each benchmark times some number of samples with gettime(). A sample
+ * is a batch of one or more operations, so that very cheap operations
+ * aren't swamped by the cost of reading the clock; the latency of a
+ * sample is divided by its batch size. At the end the samples are
+ * sorted and the benchmark prints its throughput over the wall-clock
+ * time of the run, and the 50th, 90th and 99th percentile and worst
+ * latency per operation:
+ *
+ *   lock: 16000 ops, 1523809 ops/sec; ns/op p50 640 p90 660 p99 1200 max 5120
+ *
+ * Most take an optional count of samples to take (default
+ * BENCH_DEFSAMPLES); bfs takes a filesystem and a number of blocks.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+#define BENCH_MAXSAMPLES 10000	/* most samples one run keeps */
+#define BENCH_DEFSAMPLES 1000
+#define BENCH_BATCH      16	/* ops per sample for cheap ops */
+#define BENCH_NTHREADS   4	/* threads for contended benchmarks */
+#define BENCH_MAXBUF     65536	/* largest uiomove */
+#define BENCH_BLOCKSIZE  512	/* sfs block */
+#define BENCH_DEFBLOCKS  256
+#define BENCH_VMBASE     0x10000000
+#define BENCH_DEFPAGES   64
+
+struct bench {
+	char b_name[32];
+	unsigned b_batch;		/* ops per sample */
+	size_t b_bytes;			/* bytes per op, for throughput */
+	struct spinlock b_lock;		/* for threads adding samples */
+	uint32_t *b_lat;		/* ns per op of each sample */
+	unsigned b_nsamples;
+	time_t b_secs;			/* start of the run */
+	uint32_t b_nsecs;
+};
+
+struct benchtime {
+	time_t bt_secs;
+	uint32_t bt_nsecs;
+};
+
+static
+void
+bench_now(struct benchtime *bt)
+{
+	gettime(&bt->bt_secs, &bt->bt_nsecs);
+}
+
+/* Nanoseconds from START until now. */
+static
+uint64_t
+bench_since(const struct benchtime *start)
+{
+	struct benchtime now;
+	time_t secs;
+	uint32_t nsecs;
+
+	bench_now(&now);
+	getinterval(start->bt_secs, start->bt_nsecs,
+		    now.bt_secs, now.bt_nsecs, &secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+static
+int
+bench_init(struct bench *b, const char *name, unsigned batch, size_t bytes)
+{
+	snprintf(b->b_name, sizeof(b->b_name), "%s", name);
+	b->b_batch = batch;
+	b->b_bytes = bytes;
+	spinlock_init(&b->b_lock);
+	b->b_lat = kmalloc(BENCH_MAXSAMPLES * sizeof(uint32_t));
+	if (b->b_lat == NULL) {
+		kprintf("%s: Out of memory\n", b->b_name);
+		return ENOMEM;
+	}
+	b->b_nsamples = 0;
+	gettime(&b->b_secs, &b->b_nsecs);
+	return 0;
+}
+
+/* Record a sample that began at START. */
+static
+void
+bench_add(struct bench *b, const struct benchtime *start)
+{
+	uint64_t ns;
+
+	ns = bench_since(start) / b->b_batch;
+	if (ns > 0xffffffff) {
+		ns = 0xffffffff;
+	}
+	spinlock_acquire(&b->b_lock);
+	if (b->b_nsamples < BENCH_MAXSAMPLES) {
+		b->b_lat[b->b_nsamples++] = ns;
+	}
+	spinlock_release(&b->b_lock);
+}
+
+/*
+ * Print the results and free the samples.
+ */
+static
+void
+bench_report(struct bench *b)
+{
+	struct benchtime start;
+	uint64_t wall, ops;
+	uint32_t *lat, v;
+	unsigned n, i, j;
+
+	start.bt_secs = b->b_secs;
+	start.bt_nsecs = b->b_nsecs;
+	wall = bench_since(&start);
+
+	/* insertion sort; there are only a few thousand */
+	lat = b->b_lat;
+	n = b->b_nsamples;
+	for (i = 1; i < n; i++) {
+		v = lat[i];
+		for (j = i; j > 0 && lat[j-1] > v; j--) {
+			lat[j] = lat[j-1];
+		}
+		lat[j] = v;
+	}
+
+	ops = (uint64_t)n * b->b_batch;
+	if (n == 0 || wall == 0) {
+		kprintf("%s: no samples\n", b->b_name);
+	}
+	else {
+		kprintf("%s: %llu ops, %llu ops/sec", b->b_name, ops,
+			ops * 1000000000 / wall);
+		if (b->b_bytes > 0) {
+			kprintf(", %llu KB/sec",
+				ops * b->b_bytes * 1000000000 / 1024 / wall);
+		}
+		kprintf("; ns/op p50 %u p90 %u p99 %u max %u\n",
+			lat[n * 50 / 100], lat[n * 90 / 100],
+			lat[n * 99 / 100], lat[n - 1]);
+	}
+
+	kfree(b->b_lat);
+	b->b_lat = NULL;
+}
+
+/*
+ * Sample count from an optional argument.
+ */
+static
+unsigned
+bench_count(int nargs, char **args, int which, unsigned def)
+{
+	unsigned n;
+
+	if (nargs <= which) {
+		return def;
+	}
+	n = atoi(args[which]);
+	if (n == 0) {
+		return def;
+	}
+	return n < BENCH_MAXSAMPLES ? n : BENCH_MAXSAMPLES;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Locks
+
+int
+benchlock(int nargs, char **args)
+{
+	struct bench b;
+	struct benchtime t;
+	struct lock *lk;
+	unsigned n, i, j;
+	int result;
+
+	n = bench_count(nargs, args, 1, BENCH_DEFSAMPLES);
+	lk = lock_create("bench");
+	if (lk == NULL) {
+		return ENOMEM;
+	}
+	result = bench_init(&b, "lock", BENCH_BATCH, 0);
+	if (result) {
+		lock_destroy(lk);
+		return result;
+	}
+	for (i = 0; i < n; i++) {
+		bench_now(&t);
+		for (j = 0; j < BENCH_BATCH; j++) {
+			lock_acquire(lk);
+			lock_release(lk);
+		}
+		bench_add(&b, &t);
+	}
+	bench_report(&b);
+	lock_destroy(lk);
+	return 0;
+}
+
+/* State shared by the threads of a multi-threaded benchmark. */
+struct benchshare {
+	struct bench *bs_bench;
+	struct lock *bs_lock;
+	struct cv *bs_cv;
+	struct semaphore *bs_go;	/* all start together */
+	struct semaphore *bs_done;	/* each V's when finished */
+	unsigned bs_count;		/* samples per thread */
+	volatile unsigned bs_turn;	/* for ping-pong */
+};
+
+static
+void
+benchlockthread(void *p, unsigned long junk)
+{
+	struct benchshare *bs = p;
+	struct benchtime t;
+	unsigned i, j;
+
+	(void)junk;
+
+	P(bs->bs_go);
+	for (i = 0; i < bs->bs_count; i++) {
+		bench_now(&t);
+		for (j = 0; j < BENCH_BATCH; j++) {
+			lock_acquire(bs->bs_lock);
+			lock_release(bs->bs_lock);
+		}
+		bench_add(bs->bs_bench, &t);
+	}
+	V(bs->bs_done);
+}
+
+/*
+ * Start NTHREADS copies of FUNC, let them go at once, and wait for them
+ * all to finish.
+ */
+static
+int
+bench_runthreads(struct benchshare *bs, unsigned nthreads,
+		 void (*func)(void *, unsigned long))
+{
+	unsigned i, started;
+	int result;
+
+	bs->bs_go = sem_create("bench-go", 0);
+	bs->bs_done = sem_create("bench-done", 0);
+	if (bs->bs_go == NULL || bs->bs_done == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	result = 0;
+	for (started = 0; started < nthreads; started++) {
+		result = thread_fork("bench", func, bs, started, NULL);
+		if (result) {
+			kprintf("bench: thread_fork failed: %s\n",
+				strerror(result));
+			break;
+		}
+	}
+	for (i = 0; i < started; i++) {
+		V(bs->bs_go);
+	}
+	for (i = 0; i < started; i++) {
+		P(bs->bs_done);
+	}
+
+ out:
+	if (bs->bs_go != NULL) {
+		sem_destroy(bs->bs_go);
+	}
+	if (bs->bs_done != NULL) {
+		sem_destroy(bs->bs_done);
+	}
+	return result;
+}
+
+/*
+ * Contended locking: BENCH_NTHREADS threads hammer one lock. They only
+ * truly collide with more than one cpu, or when one is preempted
+ * holding it.
+ */
+int
+benchlockc(int nargs, char **args)
+{
+	struct bench b;
+	struct benchshare bs;
+	int result;
+
+	bs.bs_count = bench_count(nargs, args, 1, BENCH_DEFSAMPLES) /
+		BENCH_NTHREADS + 1;
+	bs.bs_lock = lock_create("bench");
+	if (bs.bs_lock == NULL) {
+		return ENOMEM;
+	}
+	result = bench_init(&b, "lock contended", BENCH_BATCH, 0);
+	if (result) {
+		lock_destroy(bs.bs_lock);
+		return result;
+	}
+	bs.bs_bench = &b;
+	result = bench_runthreads(&bs, BENCH_NTHREADS, benchlockthread);
+	bench_report(&b);
+	lock_destroy(bs.bs_lock);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// CVs and threads
+
+static
+void
+benchpongthread(void *p, unsigned long junk)
+{
+	struct benchshare *bs = p;
+	unsigned i;
+
+	(void)junk;
+
+	P(bs->bs_go);
+	lock_acquire(bs->bs_lock);
+	for (i = 0; i < bs->bs_count; i++) {
+		while (bs->bs_turn != 1) {
+			cv_wait(bs->bs_cv, bs->bs_lock);
+		}
+		bs->bs_turn = 0;
+		cv_signal(bs->bs_cv, bs->bs_lock);
+	}
+	lock_release(bs->bs_lock);
+	V(bs->bs_done);
+}
+
+/*
+ * CV ping-pong: hand a turn to another thread and wait to get it back.
+ * Each sample is one round trip, so two wakeups and two switches.
+ */
+int
+benchcv(int nargs, char **args)
+{
+	struct bench b;
+	struct benchshare bs;
+	struct benchtime t;
+	unsigned i;
+	int result;
+
+	bs.bs_count = bench_count(nargs, args, 1, BENCH_DEFSAMPLES);
+	bs.bs_turn = 0;
+	bs.bs_lock = lock_create("bench");
+	bs.bs_cv = cv_create("bench");
+	bs.bs_go = sem_create("bench-go", 0);
+	bs.bs_done = sem_create("bench-done", 0);
+	if (bs.bs_lock == NULL || bs.bs_cv == NULL ||
+	    bs.bs_go == NULL || bs.bs_done == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	result = bench_init(&b, "cv ping-pong", 1, 0);
+	if (result) {
+		goto out;
+	}
+	result = thread_fork("bench-pong", benchpongthread, &bs, 0, NULL);
+	if (result) {
+		kfree(b.b_lat);
+		goto out;
+	}
+	V(bs.bs_go);
+
+	lock_acquire(bs.bs_lock);
+	for (i = 0; i < bs.bs_count; i++) {
+		bench_now(&t);
+		bs.bs_turn = 1;
+		cv_signal(bs.bs_cv, bs.bs_lock);
+		while (bs.bs_turn != 0) {
+			cv_wait(bs.bs_cv, bs.bs_lock);
+		}
+		bench_add(&b, &t);
+	}
+	lock_release(bs.bs_lock);
+	P(bs.bs_done);
+	bench_report(&b);
+
+ out:
+	if (bs.bs_done != NULL) {
+		sem_destroy(bs.bs_done);
+	}
+	if (bs.bs_go != NULL) {
+		sem_destroy(bs.bs_go);
+	}
+	if (bs.bs_cv != NULL) {
+		cv_destroy(bs.bs_cv);
+	}
+	if (bs.bs_lock != NULL) {
+		lock_destroy(bs.bs_lock);
+	}
+	return result;
+}
+
+static
+void
+benchnullthread(void *p, unsigned long junk)
+{
+	(void)junk;
+	V((struct semaphore *)p);
+}
+
+/*
+ * Thread create and join: fork a thread that does nothing and wait
+ * for it to say it's done.
+ */
+int
+benchthread(int nargs, char **args)
+{
+	struct bench b;
+	struct benchtime t;
+	struct semaphore *sem;
+	unsigned n, i;
+	int result;
+
+	n = bench_count(nargs, args, 1, BENCH_DEFSAMPLES);
+	sem = sem_create("bench", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+	result = bench_init(&b, "thread_fork+join", 1, 0);
+	if (result) {
+		sem_destroy(sem);
+		return result;
+	}
+	for (i = 0; i < n; i++) {
+		bench_now(&t);
+		result = thread_fork("bench-null", benchnullthread, sem, 0,
+				     NULL);
+		if (result) {
+			kprintf("bench: thread_fork failed: %s\n",
+				strerror(result));
+			break;
+		}
+		P(sem);
+		bench_add(&b, &t);
+	}
+	bench_report(&b);
+	sem_destroy(sem);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Memory
+
+/*
+ * kmalloc and kfree, for each power of two from 16 bytes (the smallest
+ * subpage size) to two pages (which comes from alloc_kpages).
+ */
+int
+benchkmalloc(int nargs, char **args)
+{
+	struct bench b;
+	struct benchtime t;
+	void *ptrs[BENCH_BATCH];
+	char name[32];
+	unsigned n, i, j;
+	size_t size;
+	int result;
+
+	n = bench_count(nargs, args, 1, BENCH_DEFSAMPLES);
+	for (size = 16; size <= 2 * PAGE_SIZE; size *= 2) {
+		snprintf(name, sizeof(name), "kmalloc %u", size);
+		result = bench_init(&b, name, BENCH_BATCH, 0);
+		if (result) {
+			return result;
+		}
+		for (i = 0; i < n; i++) {
+			bench_now(&t);
+			for (j = 0; j < BENCH_BATCH; j++) {
+				ptrs[j] = kmalloc(size);
+			}
+			for (j = 0; j < BENCH_BATCH; j++) {
+				kfree(ptrs[j]);
+			}
+			bench_add(&b, &t);
+		}
+		bench_report(&b);
+	}
+	return 0;
+}
+
+/*
+ * alloc_kpages and free_kpages, one page and four at a time.
+ */
+int
+benchkpages(int nargs, char **args)
+{
+	struct bench b;
+	struct benchtime t;
+	vaddr_t va;
+	char name[32];
+	unsigned n, i, npages;
+	int result;
+
+	n = bench_count(nargs, args, 1, BENCH_DEFSAMPLES);
+	for (npages = 1; npages <= 4; npages *= 4) {
+		snprintf(name, sizeof(name), "alloc_kpages %u", npages);
+		result = bench_init(&b, name, 1, 0);
+		if (result) {
+			return result;
+		}
+		for (i = 0; i < n; i++) {
+			bench_now(&t);
+			va = alloc_kpages(npages);
+			if (va == 0) {
+				kprintf("bench: alloc_kpages: Out of memory\n");
+				break;
+			}
+			free_kpages(va);
+			bench_add(&b, &t);
+		}
+		bench_report(&b);
+	}
+	return 0;
+}
+
+struct benchvm {
+	unsigned bv_npages;
+	struct semaphore *bv_done;
+	int bv_result;
+};
+
+/*
+ * Runs in its own thread, so the address space it builds goes away
+ * with it.
+ */
+static
+void
+benchvmthread(void *p, unsigned long junk)
+{
+	struct benchvm *bv = p;
+	struct addrspace *as;
+	struct bench b;
+	struct benchtime t;
+	unsigned i, pass;
+	int result;
+
+	(void)junk;
+
+	as = as_create();
+	if (as == NULL) {
+		bv->bv_result = ENOMEM;
+		V(bv->bv_done);
+		return;
+	}
+	curthread->t_addrspace = as;
+	as_activate(as);
+
+	result = as_define_region(as, BENCH_VMBASE,
+				  bv->bv_npages * PAGE_SIZE, 1, 1, 0);
+	/* the first pass allocates each page, the second finds it there */
+	for (pass = 0; pass < 2 && result == 0; pass++) {
+		result = bench_init(&b, pass == 0 ?
+				    "vm_fault new" : "vm_fault resident", 1, 0);
+		if (result) {
+			break;
+		}
+		as_activate(as);
+		for (i = 0; i < bv->bv_npages; i++) {
+			bench_now(&t);
+			result = vm_fault(VM_FAULT_WRITE,
+					  BENCH_VMBASE + i * PAGE_SIZE);
+			if (result) {
+				kprintf("bench: vm_fault: %s\n",
+					strerror(result));
+				break;
+			}
+			bench_add(&b, &t);
+		}
+		bench_report(&b);
+	}
+
+	bv->bv_result = result;
+	V(bv->bv_done);
+	/* thread_exit destroys the address space */
+}
+
+/*
+ * vm_fault service time, for pages touched for the first time and for
+ * pages already resident (just a TLB reload). Takes a page count.
+ */
+int
+benchvm(int nargs, char **args)
+{
+	struct benchvm bv;
+	int result;
+
+	bv.bv_npages = bench_count(nargs, args, 1, BENCH_DEFPAGES);
+	bv.bv_done = sem_create("bench", 0);
+	if (bv.bv_done == NULL) {
+		return ENOMEM;
+	}
+	bv.bv_result = 0;
+	result = thread_fork("bench-vm", benchvmthread, &bv, 0, NULL);
+	if (result == 0) {
+		P(bv.bv_done);
+		result = bv.bv_result;
+	}
+	sem_destroy(bv.bv_done);
+	return result;
+}
+
+/*
+ * uiomove between two kernel buffers, at a few sizes.
+ */
+int
+benchuiomove(int nargs, char **args)
+{
+	struct bench b;
+	struct benchtime t;
+	struct iovec iov;
+	struct uio ku;
+	char *src, *dst;
+	char name[32];
+	unsigned n, i;
+	size_t size;
+	int result;
+
+	n = bench_count(nargs, args, 1, BENCH_DEFSAMPLES);
+	src = kmalloc(BENCH_MAXBUF);
+	dst = kmalloc(BENCH_MAXBUF);
+	if (src == NULL || dst == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	bzero(src, BENCH_MAXBUF);
+
+	result = 0;
+	for (size = 64; size <= BENCH_MAXBUF; size *= 16) {
+		snprintf(name, sizeof(name), "uiomove %u", size);
+		result = bench_init(&b, name, 1, size);
+		if (result) {
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			uio_kinit(&iov, &ku, dst, size, 0, UIO_READ);
+			bench_now(&t);
+			result = uiomove(src, size, &ku);
+			bench_add(&b, &t);
+			if (result) {
+				break;
+			}
+		}
+		bench_report(&b);
+	}
+
+ out:
+	if (src != NULL) {
+		kfree(src);
+	}
+	if (dst != NULL) {
+		kfree(dst);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Filesystem
+
+/*
+ * Write a file of N blocks one block at a time, then read it back,
+ * then remove it.
+ */
+int
+benchsfs(int nargs, char **args)
+{
+	struct bench b;
+	struct benchtime t;
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char name[64], path[64];
+	char *buf;
+	unsigned n, i, pass;
+	int result;
+
+	if (nargs < 2) {
+		kprintf("Usage: bfs filesystem: [blocks]\n");
+		return EINVAL;
+	}
+	n = bench_count(nargs, args, 2, BENCH_DEFBLOCKS);
+
+	/* Allow (but do not require) colon after device name */
+	if (args[1][strlen(args[1])-1] == ':') {
+		args[1][strlen(args[1])-1] = 0;
+	}
+	snprintf(name, sizeof(name), "%s:bench.tmp", args[1]);
+
+	buf = kmalloc(BENCH_BLOCKSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	bzero(buf, BENCH_BLOCKSIZE);
+
+	result = 0;
+	for (pass = 0; pass < 2 && result == 0; pass++) {
+		/* vfs_open destroys the string it's passed */
+		strcpy(path, name);
+		result = vfs_open(path, pass == 0 ?
+				  O_WRONLY|O_CREAT|O_TRUNC : O_RDONLY,
+				  0664, &vn);
+		if (result) {
+			kprintf("bench: %s: %s\n", name, strerror(result));
+			break;
+		}
+		result = bench_init(&b, pass == 0 ? "sfs write" : "sfs read",
+				    1, BENCH_BLOCKSIZE);
+		if (result) {
+			vfs_close(vn);
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			uio_kinit(&iov, &ku, buf, BENCH_BLOCKSIZE,
+				  (off_t)i * BENCH_BLOCKSIZE,
+				  pass == 0 ? UIO_WRITE : UIO_READ);
+			bench_now(&t);
+			result = pass == 0 ? VOP_WRITE(vn, &ku) :
+				VOP_READ(vn, &ku);
+			bench_add(&b, &t);
+			if (result) {
+				kprintf("bench: %s: %s\n", name,
+					strerror(result));
+				break;
+			}
+		}
+		bench_report(&b);
+		vfs_close(vn);
+	}
+
+	strcpy(path, name);
+	vfs_remove(path);
+	kfree(buf);
+	return result;
+}
+
+/*
+ * Everything but bfs, which needs a filesystem, with default counts.
+ */
+int
+benchall(int nargs, char **args)
+{
+	int (*const all[])(int, char **) = {
+		benchlock, benchlockc, benchcv, benchthread,
+		benchkmalloc, benchkpages, benchvm, benchuiomove,
+	};
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+		result = all[i](1, args);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
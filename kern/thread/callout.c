@@ -0,0 +1,183 @@
+/*
+ * Callout timing wheel. See callout.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <callout.h>
+
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)	/* slots per level */
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+/* Protects everything below and every pending callout. */
+static struct spinlock callout_lock = SPINLOCK_INITIALIZER;
+
+static struct callout *callout_wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* The next tick callout_tick will process. */
+static uint32_t callout_ticks;
+
+/* Callouts callout_tick has taken off the wheel but not yet run. */
+static struct callout *callout_due;
+
+/* Slot of level LEVEL that TICK falls in. */
+#define WHEEL_SLOT(tick, level) \
+	(((tick) >> ((level) * WHEEL_BITS)) & WHEEL_MASK)
+
+/*
+ * File CO on the wheel according to how far away it is.
+ */
+static
+void
+callout_insert(struct callout *co)
+{
+	struct callout **slot;
+	uint32_t delta, when;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+
+	delta = co->co_expire - callout_ticks;
+	when = co->co_expire;
+	if ((int32_t)delta < 0) {
+		/* overdue; do it at the next tick */
+		when = callout_ticks;
+		delta = 0;
+	}
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (1U << ((level + 1) * WHEEL_BITS))) {
+			break;
+		}
+	}
+	if (level == WHEEL_LEVELS - 1 &&
+	    delta >= (1U << (WHEEL_LEVELS * WHEEL_BITS))) {
+		/* too far out; park it at the end and re-file later */
+		when = callout_ticks + (1U << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+	}
+
+	slot = &callout_wheel[level][WHEEL_SLOT(when, level)];
+	co->co_next = *slot;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = slot;
+	*slot = co;
+}
+
+static
+void
+callout_remove(struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Move everything in slot INDEX of LEVEL down to where it now belongs.
+ * Returns INDEX, so the caller knows whether to go up another level.
+ */
+static
+unsigned
+callout_cascade(unsigned level, unsigned index)
+{
+	struct callout *co, *next;
+
+	co = callout_wheel[level][index];
+	callout_wheel[level][index] = NULL;
+	for (; co != NULL; co = next) {
+		next = co->co_next;
+		co->co_prevp = NULL;
+		callout_insert(co);
+	}
+	return index;
+}
+
+void
+callout_init(struct callout *co)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_func = NULL;
+	co->co_arg = NULL;
+}
+
+void
+callout_reset(struct callout *co, unsigned ticks,
+	      void (*func)(void *), void *arg)
+{
+	spinlock_acquire(&callout_lock);
+	if (co->co_prevp != NULL) {
+		callout_remove(co);
+	}
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_expire = callout_ticks + ticks;
+	callout_insert(co);
+	spinlock_release(&callout_lock);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	bool pending;
+
+	spinlock_acquire(&callout_lock);
+	pending = co->co_prevp != NULL;
+	if (pending) {
+		callout_remove(co);
+	}
+	spinlock_release(&callout_lock);
+	return pending;
+}
+
+void
+callout_tick(void)
+{
+	struct callout *co;
+	struct callout **slot;
+	void (*func)(void *);
+	void *arg;
+	unsigned index, level;
+
+	spinlock_acquire(&callout_lock);
+
+	index = WHEEL_SLOT(callout_ticks, 0);
+	for (level = 1; level < WHEEL_LEVELS && index == 0; level++) {
+		index = callout_cascade(level,
+					WHEEL_SLOT(callout_ticks, level));
+	}
+
+	/*
+	 * Move the due slot to callout_due before running anything, as a
+	 * function may re-arm its callout into the very same slot for 64
+	 * ticks from now. Until it runs, each one can still be stopped.
+	 */
+	slot = &callout_wheel[0][WHEEL_SLOT(callout_ticks, 0)];
+	callout_due = *slot;
+	*slot = NULL;
+	if (callout_due != NULL) {
+		callout_due->co_prevp = &callout_due;
+	}
+	callout_ticks++;
+
+	while ((co = callout_due) != NULL) {
+		callout_remove(co);
+		func = co->co_func;
+		arg = co->co_arg;
+		spinlock_release(&callout_lock);
+		func(arg);
+		spinlock_acquire(&callout_lock);
+	}
+
+	spinlock_release(&callout_lock);
+}
@@ -28,10 +28,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <callout.h>
 #include <thread.h>
 #include <current.h>
 
@@ -50,24 +53,92 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_MSECS		40	/* Reschedule every 40 ms. */
+#define MIGRATE_MSECS		160	/* Migrate every 160 ms. */
+
+unsigned clock_hz = HZ;
+unsigned clock_quantum;
+
+/* SCHEDULE_MSECS and MIGRATE_MSECS in hardclocks at the current rate */
+static unsigned schedule_hardclocks;
+static unsigned migrate_hardclocks;
+static unsigned quantum_msecs = QUANTUM_MSECS;
+
+/* Convert MSECS to hardclocks at the current rate, at least one. */
+static
+unsigned
+msecs_to_hardclocks(unsigned msecs)
+{
+	unsigned n;
+
+	n = msecs * clock_hz / 1000;
+	return n > 0 ? n : 1;
+}
+
+static
+void
+clock_recompute(void)
+{
+	schedule_hardclocks = msecs_to_hardclocks(SCHEDULE_MSECS);
+	migrate_hardclocks = msecs_to_hardclocks(MIGRATE_MSECS);
+	clock_quantum = quantum_msecs * clock_hz / 1000;
+}
+
+int
+clock_sethz(unsigned hz)
+{
+	if (hz < HZ_MIN || hz > HZ_MAX) {
+		return EINVAL;
+	}
+	clock_hz = hz;
+	clock_recompute();
+	return 0;
+}
+
+int
+clock_setquantum(unsigned msecs)
+{
+	if (msecs > 1000) {
+		return EINVAL;
+	}
+	quantum_msecs = msecs;
+	clock_recompute();
+	return 0;
+}
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
  */
 static struct wchan *lbolt;
 
+/*
+ * Threads in thread_sleep_until wait on one of these, picked by
+ * address, so a wakeup doesn't disturb every sleeper in the system.
+ * sleep_lock protects the sleepers' s_done flags.
+ */
+#define SLEEP_NCHANS 16
+static struct wchan *sleep_wchans[SLEEP_NCHANS];
+static struct spinlock sleep_lock = SPINLOCK_INITIALIZER;
+
 /*
  * Setup.
  */
 void
 hardclock_bootstrap(void)
 {
+	unsigned i;
+
 	lbolt = wchan_create("lbolt");
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	for (i = 0; i < SLEEP_NCHANS; i++) {
+		sleep_wchans[i] = wchan_create("sleep");
+		if (sleep_wchans[i] == NULL) {
+			panic("Couldn't create sleep channels\n");
+		}
+	}
+	clock_recompute();
 }
 
 /*
@@ -82,8 +153,8 @@ timerclock(void)
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * This is called clock_hz times a second (on each processor) by the
+ * timer code.
  */
 void
 hardclock(void)
@@ -93,13 +164,30 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	ru_tick(curthread->t_intr_user);
+	if (curcpu->c_number == 0) {
+		callout_tick();
+	}
+	if ((curcpu->c_hardclocks % schedule_hardclocks) == 0) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	if ((curcpu->c_hardclocks % migrate_hardclocks) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+
+	/*
+	 * Preempt only once the slice is used up, and only if there is
+	 * someone to switch to. Looking at the run queue without its lock
+	 * is fine here: if we guess wrong, thread_switch finds the queue
+	 * empty and returns, or we catch it at the next hardclock.
+	 */
+	if (curthread->t_slice > 0) {
+		curthread->t_slice--;
+	}
+	if (curthread->t_slice == 0 &&
+	    !threadlist_isempty(&curcpu->c_runqueue)) {
+		thread_yield();
+	}
 }
 
 /*
@@ -114,3 +202,72 @@ clocksleep(int num_secs)
 		num_secs--;
 	}
 }
+
+struct sleeper {
+	struct wchan *s_wchan;
+	bool s_done;		/* set by sleep_wakeup */
+};
+
+static
+void
+sleep_wakeup(void *arg)
+{
+	struct sleeper *s = arg;
+
+	spinlock_acquire(&sleep_lock);
+	s->s_done = true;
+	wchan_wakeall(s->s_wchan);
+	spinlock_release(&sleep_lock);
+}
+
+/*
+ * Hardclocks from now until SECS.NSECS from now, rounded up, and
+ * capped at a day; thread_sleep_until goes round again if needed.
+ */
+static
+unsigned
+clock_delta_to_hardclocks(time_t secs, uint32_t nsecs)
+{
+	if (secs >= 86400) {
+		return 86400 * clock_hz;
+	}
+	return secs * clock_hz + DIVROUNDUP(nsecs, 1000000000 / clock_hz);
+}
+
+/*
+ * Suspend execution until gettime() reaches SECS.NSECS. This can only
+ * wake at a hardclock, so it may overshoot by up to a tick, but it
+ * never returns early.
+ */
+void
+thread_sleep_until(time_t secs, uint32_t nsecs)
+{
+	struct sleeper s;
+	struct callout co;
+	time_t nowsecs, dsecs;
+	uint32_t nownsecs, dnsecs;
+
+	s.s_wchan = sleep_wchans[((uintptr_t)&s >> 4) % SLEEP_NCHANS];
+	callout_init(&co);
+
+	while (1) {
+		gettime(&nowsecs, &nownsecs);
+		if (nowsecs > secs || (nowsecs == secs && nownsecs >= nsecs)) {
+			break;
+		}
+		getinterval(nowsecs, nownsecs, secs, nsecs, &dsecs, &dnsecs);
+
+		s.s_done = false;
+		callout_reset(&co, clock_delta_to_hardclocks(dsecs, dnsecs),
+			      sleep_wakeup, &s);
+
+		spinlock_acquire(&sleep_lock);
+		while (!s.s_done) {
+			wchan_lock(s.s_wchan);
+			spinlock_release(&sleep_lock);
+			wchan_sleep(s.s_wchan);
+			spinlock_acquire(&sleep_lock);
+		}
+		spinlock_release(&sleep_lock);
+	}
+}
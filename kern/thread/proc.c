@@ -0,0 +1,734 @@
+/*
+ * Processes: pid allocation, parent/child links, exit and wait, and
+ * resource usage. See proc.h for the overall picture.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <kern/signal.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <bitmap.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <proc.h>
+#include <syscall.h>
+
+/* pid of the kernel process; below PID_MIN so no user process gets it */
+#define KPROC_PID 1
+
+struct proc *kproc;
+
+/* Protects the pid map and every struct proc. */
+static struct spinlock proc_lock = SPINLOCK_INITIALIZER;
+
+/* Which pids are in use, and where to start looking for a free one. */
+static struct bitmap *proc_pids;
+static pid_t proc_nextpid = PID_MIN;
+
+/* Every process but kproc, newest first. */
+static struct proc *proc_all;
+
+static
+struct proc *
+proc_alloc(void)
+{
+	struct proc *p;
+
+	p = kmalloc(sizeof(struct proc));
+	if (p == NULL) {
+		return NULL;
+	}
+	p->p_wchan = wchan_create("proc");
+	if (p->p_wchan == NULL) {
+		kfree(p);
+		return NULL;
+	}
+	p->p_pid = 0;
+	p->p_parent = NULL;
+	p->p_children = NULL;
+	p->p_sibling = NULL;
+	p->p_nthreads = 1;
+	p->p_uthreads = NULL;
+	p->p_hasstatus = false;
+	p->p_exiting = false;
+	p->p_killer = NULL;
+	p->p_exited = false;
+	p->p_exitcode = 0;
+	p->p_threads = NULL;
+	bzero(&p->p_ru, sizeof(p->p_ru));
+	bzero(&p->p_cru, sizeof(p->p_cru));
+	p->p_allnext = NULL;
+	p->p_allprevp = NULL;
+	p->p_name[0] = '\0';
+	return p;
+}
+
+/*
+ * Take P off the list of all processes, if it is on it.
+ */
+static
+void
+proc_unlinkall(struct proc *p)
+{
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+
+	if (p->p_allprevp == NULL) {
+		return;
+	}
+	*p->p_allprevp = p->p_allnext;
+	if (p->p_allnext != NULL) {
+		p->p_allnext->p_allprevp = p->p_allprevp;
+	}
+	p->p_allnext = NULL;
+	p->p_allprevp = NULL;
+}
+
+/*
+ * Give back the pid of P and the ids of its threads, and take it off
+ * the list of all processes.
+ */
+static
+void
+proc_releaseids(struct proc *p)
+{
+	struct uthread *ut;
+
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+	proc_unlinkall(p);
+	bitmap_unmark(proc_pids, p->p_pid);
+	for (ut = p->p_uthreads; ut != NULL; ut = ut->ut_next) {
+		bitmap_unmark(proc_pids, ut->ut_tid);
+	}
+}
+
+/*
+ * Free a process whose ids have already been released and which is on
+ * nobody's list.
+ */
+static
+void
+proc_free(struct proc *p)
+{
+	struct uthread *ut;
+
+	KASSERT(p->p_children == NULL);
+	while ((ut = p->p_uthreads) != NULL) {
+		p->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
+	wchan_destroy(p->p_wchan);
+	kfree(p);
+}
+
+void
+proc_bootstrap(void)
+{
+	proc_pids = bitmap_create(PID_MAX + 1);
+	if (proc_pids == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+	/* pids below PID_MIN are never handed out */
+	for (pid_t i = 0; i < PID_MIN; i++) {
+		bitmap_mark(proc_pids, i);
+	}
+
+	kproc = proc_alloc();
+	if (kproc == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+	kproc->p_pid = KPROC_PID;
+	strcpy(kproc->p_name, "[kernel]");
+}
+
+/*
+ * Find an unused pid, starting where the last search left off. Pids are
+ * rarely all in use, so this almost always looks at one bit.
+ */
+static
+int
+proc_allocpid(pid_t *ret)
+{
+	pid_t pid;
+	int tries;
+
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+
+	pid = proc_nextpid;
+	for (tries = PID_MIN; tries <= PID_MAX; tries++) {
+		if (!bitmap_isset(proc_pids, pid)) {
+			bitmap_mark(proc_pids, pid);
+			proc_nextpid = pid < PID_MAX ? pid + 1 : PID_MIN;
+			*ret = pid;
+			return 0;
+		}
+		pid = pid < PID_MAX ? pid + 1 : PID_MIN;
+	}
+	return ENPROC;
+}
+
+int
+proc_create(struct proc *parent, struct proc **ret)
+{
+	struct proc *p;
+	int result;
+
+	p = proc_alloc();
+	if (p == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&proc_lock);
+	result = proc_allocpid(&p->p_pid);
+	if (result) {
+		spinlock_release(&proc_lock);
+		proc_free(p);
+		return result;
+	}
+	if (parent != NULL) {
+		p->p_parent = parent;
+		p->p_sibling = parent->p_children;
+		parent->p_children = p;
+		strcpy(p->p_name, parent->p_name);
+	}
+	p->p_allnext = proc_all;
+	if (proc_all != NULL) {
+		proc_all->p_allprevp = &p->p_allnext;
+	}
+	p->p_allprevp = &proc_all;
+	proc_all = p;
+	spinlock_release(&proc_lock);
+
+	*ret = p;
+	return 0;
+}
+
+/*
+ * Take P off its parent's list of children. P must be on it.
+ */
+static
+void
+proc_unlink(struct proc *p)
+{
+	struct proc **pp;
+
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+	KASSERT(p->p_parent != NULL);
+
+	for (pp = &p->p_parent->p_children; *pp != p; pp = &(*pp)->p_sibling) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = p->p_sibling;
+	p->p_sibling = NULL;
+	p->p_parent = NULL;
+}
+
+void
+proc_destroy(struct proc *p)
+{
+	KASSERT(!p->p_exited);
+
+	spinlock_acquire(&proc_lock);
+	if (p->p_parent != NULL) {
+		proc_unlink(p);
+	}
+	proc_unlinkall(p);
+	bitmap_unmark(proc_pids, p->p_pid);
+	spinlock_release(&proc_lock);
+
+	proc_free(p);
+}
+
+/*
+ * True if threads of P other than the current one must leave.
+ */
+static
+bool
+proc_mustleave(struct proc *p)
+{
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+	return p->p_exiting ||
+		(p->p_killer != NULL && p->p_killer != curthread);
+}
+
+/*
+ * Take the current thread out of its process. ISEXIT says STATUS is
+ * from _exit (or a fatal trap) rather than just this thread's.
+ */
+static
+void
+proc_leave(int status, bool isexit)
+{
+	struct proc *p, *child, *next, *zombies;
+	struct uthread *ut;
+	struct thread **tp;
+
+	p = curthread->t_proc;
+	ut = curthread->t_uthread;
+	KASSERT(p != NULL);
+	KASSERT(p != kproc);
+	curthread->t_proc = NULL;
+	curthread->t_uthread = NULL;
+
+	if (ut != NULL && ut->ut_stack != UT_NOSTACK) {
+		as_freestack(curthread->t_addrspace, ut->ut_stack);
+	}
+
+	spinlock_acquire(&proc_lock);
+
+	/* Our usage stays with the process. */
+	for (tp = &p->p_threads; *tp != curthread; tp = &(*tp)->t_psibling) {
+		KASSERT(*tp != NULL);
+	}
+	*tp = curthread->t_psibling;
+	curthread->t_psibling = NULL;
+	ru_add(&p->p_ru, &curthread->t_ru);
+
+	if (ut != NULL) {
+		ut->ut_status = status;
+		ut->ut_exited = true;
+	}
+	if (ut != NULL || p->p_killer != NULL) {
+		/* for threadjoin, or proc_singlethread counting us out */
+		wchan_wakeall(p->p_wchan);
+	}
+	if (isexit && !p->p_hasstatus) {
+		p->p_exitcode = status;
+		p->p_hasstatus = true;
+	}
+	KASSERT(p->p_nthreads > 0);
+	if (--p->p_nthreads > 0) {
+		spinlock_release(&proc_lock);
+		return;
+	}
+
+	/*
+	 * Nobody will wait for our children now. The ones that have
+	 * already exited are freed below; the rest free themselves when
+	 * they exit.
+	 */
+	zombies = NULL;
+	for (child = p->p_children; child != NULL; child = next) {
+		next = child->p_sibling;
+		child->p_parent = NULL;
+		child->p_sibling = NULL;
+		if (child->p_exited) {
+			proc_releaseids(child);
+			child->p_sibling = zombies;
+			zombies = child;
+		}
+	}
+	p->p_children = NULL;
+
+	if (!p->p_hasstatus) {
+		p->p_exitcode = status;
+	}
+	p->p_exited = true;
+	if (p->p_parent != NULL) {
+		/* the parent can't go away while we hold the lock */
+		wchan_wakeall(p->p_parent->p_wchan);
+	}
+	else {
+		proc_releaseids(p);
+		p->p_sibling = zombies;
+		zombies = p;
+	}
+
+	spinlock_release(&proc_lock);
+
+	for (child = zombies; child != NULL; child = next) {
+		next = child->p_sibling;
+		proc_free(child);
+	}
+}
+
+/*
+ * Tell the current thread's process that all its threads must leave,
+ * and wake any that are asleep in waitpid, threadjoin or futex_wait so
+ * they notice. The ones in user mode notice on their next trap.
+ */
+static
+void
+proc_killothers(void)
+{
+	struct proc *p = curthread->t_proc;
+	bool others;
+
+	spinlock_acquire(&proc_lock);
+	p->p_exiting = true;
+	others = p->p_nthreads > 1;
+	if (others) {
+		wchan_wakeall(p->p_wchan);
+	}
+	spinlock_release(&proc_lock);
+
+	/* after setting p_exiting; see sys_futex_wait */
+	if (others) {
+		futex_wakeall(curthread->t_addrspace);
+	}
+}
+
+void
+proc_exit(int status)
+{
+	proc_killothers();
+	proc_leave(status, true);
+}
+
+void
+proc_threadexit(int status)
+{
+	proc_leave(status, false);
+}
+
+int
+proc_wait(struct proc *parent, pid_t pid, int options,
+	  int *status, pid_t *retpid)
+{
+	struct proc *child;
+
+	spinlock_acquire(&proc_lock);
+	while (1) {
+		/*
+		 * Look the child up each time around, in case another
+		 * thread of the parent reaped it while we slept.
+		 */
+		for (child = parent->p_children; child != NULL;
+		     child = child->p_sibling) {
+			if (child->p_pid == pid) {
+				break;
+			}
+		}
+		if (child == NULL) {
+			int result;
+
+			if (pid >= PID_MIN && pid <= PID_MAX &&
+			    bitmap_isset(proc_pids, pid)) {
+				result = ECHILD;
+			}
+			else {
+				result = ESRCH;
+			}
+			spinlock_release(&proc_lock);
+			return result;
+		}
+		if (child->p_exited) {
+			break;
+		}
+		if (options & WNOHANG) {
+			spinlock_release(&proc_lock);
+			*retpid = 0;
+			return 0;
+		}
+		if (proc_mustleave(parent)) {
+			spinlock_release(&proc_lock);
+			return EINTR;
+		}
+
+		/* children wake this channel while holding proc_lock */
+		wchan_lock(parent->p_wchan);
+		spinlock_release(&proc_lock);
+		wchan_sleep(parent->p_wchan);
+		spinlock_acquire(&proc_lock);
+	}
+
+	ru_add(&parent->p_cru, &child->p_ru);
+	ru_add(&parent->p_cru, &child->p_cru);
+	proc_unlink(child);
+	proc_releaseids(child);
+	spinlock_release(&proc_lock);
+
+	*status = child->p_exitcode;
+	*retpid = pid;
+	proc_free(child);
+	return 0;
+}
+
+void
+proc_setname(struct proc *p, const char *path)
+{
+	const char *name;
+	size_t len;
+
+	name = strrchr(path, '/');
+	name = name != NULL ? name + 1 : path;
+	len = strlen(name);
+	if (len >= PROC_NAMELEN) {
+		len = PROC_NAMELEN - 1;
+	}
+
+	spinlock_acquire(&proc_lock);
+	memcpy(p->p_name, name, len);
+	p->p_name[len] = '\0';
+	spinlock_release(&proc_lock);
+}
+
+/*
+ * Add up the usage of P's threads, live and gone, into RU.
+ */
+static
+void
+proc_selfusage(struct proc *p, struct ru_counts *ru)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+
+	*ru = p->p_ru;
+	for (t = p->p_threads; t != NULL; t = t->t_psibling) {
+		ru_add(ru, &t->t_ru);
+	}
+}
+
+int
+proc_getrusage(struct proc *p, int who, struct ru_counts *ret)
+{
+	switch (who) {
+	    case RUSAGE_SELF:
+		spinlock_acquire(&proc_lock);
+		proc_selfusage(p, ret);
+		spinlock_release(&proc_lock);
+		return 0;
+	    case RUSAGE_CHILDREN:
+		spinlock_acquire(&proc_lock);
+		*ret = p->p_cru;
+		spinlock_release(&proc_lock);
+		return 0;
+	}
+	return EINVAL;
+}
+
+int
+proc_foreach(void (*func)(struct proc *p, const struct ru_counts *ru,
+			  void *arg),
+	     void *arg)
+{
+	struct ru_counts *ru;
+	struct proc *p;
+
+	/* too big for the stack */
+	ru = kmalloc(sizeof(*ru));
+	if (ru == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&proc_lock);
+	for (p = proc_all; p != NULL; p = p->p_allnext) {
+		if (p->p_exited) {
+			continue;
+		}
+		proc_selfusage(p, ru);
+		func(p, ru, arg);
+	}
+	spinlock_release(&proc_lock);
+
+	kfree(ru);
+	return 0;
+}
+
+void
+proc_attach(struct proc *p, struct thread *t)
+{
+	KASSERT(t->t_psibling == NULL);
+
+	spinlock_acquire(&proc_lock);
+	t->t_psibling = p->p_threads;
+	p->p_threads = t;
+	spinlock_release(&proc_lock);
+}
+
+int
+proc_addthread(struct proc *p, unsigned stack, struct uthread **ret)
+{
+	struct uthread *ut;
+	int result;
+
+	ut = kmalloc(sizeof(struct uthread));
+	if (ut == NULL) {
+		return ENOMEM;
+	}
+	ut->ut_stack = stack;
+	ut->ut_exited = false;
+	ut->ut_status = 0;
+
+	spinlock_acquire(&proc_lock);
+	result = proc_allocpid(&ut->ut_tid);
+	if (result) {
+		spinlock_release(&proc_lock);
+		kfree(ut);
+		return result;
+	}
+	KASSERT(p->p_nthreads > 0);
+	p->p_nthreads++;
+	ut->ut_next = p->p_uthreads;
+	p->p_uthreads = ut;
+	spinlock_release(&proc_lock);
+
+	*ret = ut;
+	return 0;
+}
+
+/*
+ * Take UT off P's list. UT must be on it.
+ */
+static
+void
+proc_unlinkthread(struct proc *p, struct uthread *ut)
+{
+	struct uthread **pp;
+
+	KASSERT(spinlock_do_i_hold(&proc_lock));
+
+	for (pp = &p->p_uthreads; *pp != ut; pp = &(*pp)->ut_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = ut->ut_next;
+	bitmap_unmark(proc_pids, ut->ut_tid);
+}
+
+void
+proc_removethread(struct proc *p, struct uthread *ut)
+{
+	KASSERT(!ut->ut_exited);
+
+	spinlock_acquire(&proc_lock);
+	proc_unlinkthread(p, ut);
+	KASSERT(p->p_nthreads > 1);
+	p->p_nthreads--;
+	spinlock_release(&proc_lock);
+
+	kfree(ut);
+}
+
+int
+proc_jointhread(struct proc *p, pid_t tid, int *status)
+{
+	struct uthread *ut;
+
+	if (curthread->t_uthread != NULL && curthread->t_uthread->ut_tid == tid) {
+		/* would wait forever */
+		return EINVAL;
+	}
+
+	spinlock_acquire(&proc_lock);
+	while (1) {
+		/* as in proc_wait, someone else may have joined it meanwhile */
+		for (ut = p->p_uthreads; ut != NULL; ut = ut->ut_next) {
+			if (ut->ut_tid == tid) {
+				break;
+			}
+		}
+		if (ut == NULL) {
+			spinlock_release(&proc_lock);
+			return ESRCH;
+		}
+		if (ut->ut_exited) {
+			break;
+		}
+		if (proc_mustleave(p)) {
+			spinlock_release(&proc_lock);
+			return EINTR;
+		}
+		wchan_lock(p->p_wchan);
+		spinlock_release(&proc_lock);
+		wchan_sleep(p->p_wchan);
+		spinlock_acquire(&proc_lock);
+	}
+	proc_unlinkthread(p, ut);
+	spinlock_release(&proc_lock);
+
+	*status = ut->ut_status;
+	kfree(ut);
+	return 0;
+}
+
+bool
+proc_killed(void)
+{
+	struct proc *p = curthread->t_proc;
+	bool killed;
+
+	if (p == NULL) {
+		return false;
+	}
+	spinlock_acquire(&proc_lock);
+	killed = proc_mustleave(p);
+	spinlock_release(&proc_lock);
+	return killed;
+}
+
+void
+proc_checkkill(void)
+{
+	struct proc *p = curthread->t_proc;
+
+	/* this runs on every trap from user mode, so peek first */
+	if (p == NULL || (!p->p_exiting && p->p_killer == NULL)) {
+		return;
+	}
+	if (!proc_killed()) {
+		return;
+	}
+	proc_threadexit(_MKWAIT_SIG(SIGKILL));
+	thread_exit();
+}
+
+int
+proc_singlethread(void)
+{
+	struct proc *p = curthread->t_proc;
+	struct uthread *ut, *next, *dead;
+	bool exiting;
+
+	spinlock_acquire(&proc_lock);
+	if (proc_mustleave(p)) {
+		spinlock_release(&proc_lock);
+		return EINTR;
+	}
+	if (p->p_nthreads == 1) {
+		spinlock_release(&proc_lock);
+		return 0;
+	}
+	p->p_killer = curthread;
+	wchan_wakeall(p->p_wchan);
+	spinlock_release(&proc_lock);
+
+	/* after setting p_killer; see sys_futex_wait */
+	futex_wakeall(curthread->t_addrspace);
+
+	spinlock_acquire(&proc_lock);
+	/* if someone calls _exit meanwhile, we're going anyway */
+	while (p->p_nthreads > 1 && !p->p_exiting) {
+		wchan_lock(p->p_wchan);
+		spinlock_release(&proc_lock);
+		wchan_sleep(p->p_wchan);
+		spinlock_acquire(&proc_lock);
+	}
+	p->p_killer = NULL;
+	exiting = p->p_exiting;
+
+	/* Nobody is left to join the others. */
+	dead = NULL;
+	if (!exiting) {
+		for (ut = p->p_uthreads; ut != NULL; ut = next) {
+			next = ut->ut_next;
+			if (ut != curthread->t_uthread) {
+				KASSERT(ut->ut_exited);
+				proc_unlinkthread(p, ut);
+				ut->ut_next = dead;
+				dead = ut;
+			}
+		}
+	}
+	spinlock_release(&proc_lock);
+
+	for (ut = dead; ut != NULL; ut = next) {
+		next = ut->ut_next;
+		kfree(ut);
+	}
+	return exiting ? EINTR : 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Resource accounting: the counters each thread keeps for itself.
+ * See rusage.h.
+ */
+#include <types.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <rusage.h>
+
+void
+ru_add(struct ru_counts *to, const struct ru_counts *from)
+{
+	unsigned i;
+
+	to->rc_uticks += from->rc_uticks;
+	to->rc_sticks += from->rc_sticks;
+	to->rc_utime += from->rc_utime;
+	to->rc_stime += from->rc_stime;
+	to->rc_nvcsw += from->rc_nvcsw;
+	to->rc_nivcsw += from->rc_nivcsw;
+	to->rc_minflt += from->rc_minflt;
+	to->rc_majflt += from->rc_majflt;
+	to->rc_nswapin += from->rc_nswapin;
+	to->rc_inbytes += from->rc_inbytes;
+	to->rc_outbytes += from->rc_outbytes;
+	if (from->rc_maxrss > to->rc_maxrss) {
+		to->rc_maxrss = from->rc_maxrss;
+	}
+	to->rc_nsyscalls += from->rc_nsyscalls;
+	for (i=0; i<RU_NSYSCALLS; i++) {
+		to->rc_syscalls[i] += from->rc_syscalls[i];
+	}
+}
+
+/*
+ * Called from hardclock. USER says the interrupt came from user mode.
+ * A tick that finds the cpu idle belongs to nobody; curthread then is
+ * just whoever went to sleep last.
+ */
+void
+ru_tick(bool user)
+{
+	struct ru_counts *ru;
+	unsigned usecs;
+
+	if (curcpu->c_isidle) {
+		curcpu->c_iticks++;
+		return;
+	}
+
+	ru = &curthread->t_ru;
+	usecs = 1000000 / clock_hz;
+	if (user) {
+		curcpu->c_uticks++;
+		ru->rc_uticks++;
+		ru->rc_utime += usecs;
+	}
+	else {
+		curcpu->c_sticks++;
+		ru->rc_sticks++;
+		ru->rc_stime += usecs;
+	}
+}
+
+void
+ru_syscall(int callno, int err, int32_t retval)
+{
+	struct ru_counts *ru = &curthread->t_ru;
+
+	ru->rc_nsyscalls++;
+	if (callno >= 0 && callno < RU_NSYSCALLS) {
+		ru->rc_syscalls[callno]++;
+	}
+	if (err) {
+		return;
+	}
+
+	/* for these, the return value is the number of bytes moved */
+	switch (callno) {
+	    case SYS_read:
+	    case SYS_readv:
+	    case SYS_pread:
+		ru->rc_inbytes += (uint32_t)retval;
+		break;
+	    case SYS_write:
+	    case SYS_writev:
+	    case SYS_pwrite:
+		ru->rc_outbytes += (uint32_t)retval;
+		break;
+	    case SYS_sendfile:
+		ru->rc_inbytes += (uint32_t)retval;
+		ru->rc_outbytes += (uint32_t)retval;
+		break;
+	}
+}
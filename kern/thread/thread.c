@@ -38,6 +38,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <clock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -45,9 +46,12 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <mainbus.h>
 #include <vnode.h>
-#include <kern/procsys.h>
+#include <filetable.h>
+#include <proc.h>
+#include <trace.h>
 
 #include "opt-synchprobs.h"
 #include "opt-defaultscheduler.h"
@@ -58,10 +62,6 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
-/************ RB:Global process table ************/
-struct pdesc* g_pdtable[PID_LIMIT];
-struct lock * process_lock;
-
 
 /* Wait channel. */
 struct wchan {
@@ -151,6 +151,7 @@ thread_create(const char *name)
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
+	thread->t_intr_user = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
@@ -163,72 +164,17 @@ thread_create(const char *name)
 	/* If you add to struct thread, be sure to initialize here */
 	/* RB: Priority init */
 	thread->t_priority = 0;
+	thread->t_slice = 0;
 
-	/* RR: FD table */
-	for (int i = 0; i < OPEN_MAX; ++i)
-	{
-		thread->t_fdtable[i] = 0;
-	}
+	/* FD table */
+	thread->t_filetable = NULL;
 
-	/************ RB:PID allocation ************/
-	if (process_lock == NULL)
-	{
-		process_lock = lock_create("process_lock");
-		if (process_lock == NULL)
-		{
-			return NULL;
-		}
-	}
-	for (int i = 1; i < PID_LIMIT; ++i)
-	{
-		lock_acquire(process_lock);
-		if (g_pdtable[i] == NULL)
-		{
-			struct pdesc * pd = kmalloc(sizeof(struct pdesc));
-			if (pd == NULL)
-			{
-				kfree(thread->t_name);
-				kfree(thread);
-				lock_release(process_lock);
-				return NULL;
-			}
-			pd->wait_cv = cv_create(thread->t_name);
-			if (pd->wait_cv == NULL)
-			{
-				kfree(pd);
-				kfree(thread->t_name);
-				kfree(thread);
-				lock_release(process_lock);
-				return NULL;
-			}
-			pd->wait_lock = lock_create(thread->t_name);
-			if (pd->wait_lock == NULL)
-			{
-				cv_destroy(pd->wait_cv);
-				kfree(pd);
-				kfree(thread->t_name);
-				kfree(thread);
-				lock_release(process_lock);
-				return NULL;
-			}
+	/* Process; set by thread_fork_proc for user processes */
+	thread->t_proc = NULL;
+	thread->t_uthread = NULL;
+	thread->t_psibling = NULL;
 
-			pd->exited = false;
-			if (curthread == NULL)
-			{
-				pd->ppid = -1;
-			}else{
-				pd->ppid = curthread->t_pid;
-			}
-			pd->exitcode = -1;
-			pd->self = thread;
-			g_pdtable[i] = pd;
-			thread->t_pid = i;
-			lock_release(process_lock);
-			break;
-		}
-		lock_release(process_lock);
-
-	}
+	bzero(&thread->t_ru, sizeof(thread->t_ru));
 
 	return thread;
 }
@@ -259,6 +205,10 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_uticks = 0;
+	c->c_sticks = 0;
+	c->c_iticks = 0;
+	c->c_nswitches = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -273,6 +223,8 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+	trace_cpu_init(c);
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
 	if (c->c_curthread == NULL) {
@@ -322,20 +274,12 @@ thread_destroy(struct thread *thread)
 	 * either here or in thread_exit(). (And not both...)
 	 */
 
-	/************ RB:Free the file table ************/
-	for (int i = 0; i < OPEN_MAX; ++i)
-	{
-		if (thread->t_fdtable[i] != NULL)
-		{
-			if (thread->t_fdtable[i]->ref_count == 1)
-			{
-				kfree(thread->t_fdtable[i]);
-			}
-		}
-	 }
-
 	/* VFS fields, cleaned up in thread_exit */
 	KASSERT(thread->t_cwd == NULL);
+	KASSERT(thread->t_filetable == NULL);
+
+	/* Process, let go of by proc_exit */
+	KASSERT(thread->t_proc == NULL);
 
 	/* VM fields, cleaned up in thread_exit */
 	KASSERT(thread->t_addrspace == NULL);
@@ -515,6 +459,18 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned number)
+{
+	return cpuarray_get(&allcpus, number);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -569,6 +525,22 @@ thread_fork(const char *name,
 	    void (*entrypoint)(void *data1, unsigned long data2),
 	    void *data1, unsigned long data2,
 	    struct thread **ret)
+{
+	return thread_fork_proc(name, NULL, entrypoint, data1, data2, ret);
+}
+
+/*
+ * Like thread_fork, but the new thread belongs to process PROC (which
+ * may be NULL for a kernel thread). PROC is attached before the thread
+ * can run, so it can safely _exit right away. If PROC is the caller's
+ * own process, the new thread is another thread of it and shares the
+ * caller's address space.
+ */
+int
+thread_fork_proc(const char *name, struct proc *proc,
+		 void (*entrypoint)(void *data1, unsigned long data2),
+		 void *data1, unsigned long data2,
+		 struct thread **ret)
 {
 	struct thread *newthread;
 
@@ -594,33 +566,40 @@ thread_fork(const char *name,
 	 * Now we clone various fields from the parent thread.
 	 */
 
-	/************ RB:Copy file table ************/
-	for (int i = 0; i < OPEN_MAX; ++i)
+	/*
+	 * Another thread of the same process shares its file table and
+	 * address space; a new process gets its own copy of the file
+	 * table, and its address space is up to the caller.
+	 */
+	if (proc != NULL && proc == curthread->t_proc)
 	{
-		struct fdesc * fd = curthread->t_fdtable[i];
-		if (fd != NULL)
+		KASSERT(curthread->t_addrspace != NULL);
+		if (curthread->t_filetable != NULL)
 		{
-			fd->ref_count++;
+			filetable_incref(curthread->t_filetable);
+			newthread->t_filetable = curthread->t_filetable;
 		}
-		newthread->t_fdtable[i] = fd;
+		as_incref(curthread->t_addrspace);
+		newthread->t_addrspace = curthread->t_addrspace;
 	}
-
-	 /************ RB:Assign address space ************/
-	if (curthread->t_addrspace != NULL)
+	/************ RB:Copy file table ************/
+	else if (curthread->t_filetable != NULL)
 	{
-		struct addrspace *child_as;
-		int err = as_copy(curthread->t_addrspace, &child_as);
+		int err = filetable_copy(curthread->t_filetable,
+			&newthread->t_filetable);
 		if (err)
 		{
+			thread_destroy(newthread);
 			return err;
 		}
-		newthread->t_addrspace = child_as;
-		as_activate(newthread->t_addrspace);
 	}
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
 
+	/* Process */
+	newthread->t_proc = proc;
+
 	/* VM fields */
 	/* do not clone address space -- let caller decide on that */
 
@@ -640,6 +619,11 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
+	/* The process can count it from here on */
+	if (proc != NULL) {
+		proc_attach(proc, newthread);
+	}
+
 	/* Lock the current cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
@@ -759,6 +743,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	}
 	cur->t_state = newstate;
 
+	/* Count the switch. Being preempted is the only involuntary kind. */
+	curcpu->c_nswitches++;
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_ru.rc_nivcsw++;
+	}
+	else if (newstate != S_ZOMBIE) {
+		cur->t_ru.rc_nvcsw++;
+	}
+
 	/*
 	 * Get the next thread. While there isn't one, call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
@@ -788,6 +781,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Whoever runs next gets a full time slice. */
+	next->t_slice = clock_quantum;
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -940,6 +936,11 @@ thread_exit(void)
 		VOP_DECREF(cur->t_cwd);
 		cur->t_cwd = NULL;
 	}
+	if (cur->t_filetable) {
+		struct filetable *ft = cur->t_filetable;
+		cur->t_filetable = NULL;
+		filetable_decref(ft);
+	}
 
 	/* VM fields */
 	if (cur->t_addrspace) {
@@ -1406,22 +1407,24 @@ interprocessor_interrupt(void)
 	spinlock_release(&curcpu->c_ipi_lock);
 }
 
+/*
+ * Drop the mapping for VADDR from every cpu's TLB, this one's included.
+ * ipi_tlbshootdown copies the request, so it can live on the stack.
+ */
 int allcpu_tlbshootdown(vaddr_t vaddr)
 {
 	unsigned i;
 	struct cpu *c;
-	struct tlbshootdown *tlb_wrap = (struct tlbshootdown *)kmalloc(sizeof(struct tlbshootdown));
-	if (tlb_wrap == NULL)
-	{
-		return ENOMEM;
-	}
-	tlb_wrap->ts_addrspace = NULL;
-	tlb_wrap->ts_vaddr = vaddr;
+	struct tlbshootdown ts;
+
+	ts.ts_addrspace = NULL;
+	ts.ts_vaddr = vaddr;
 
+	vm_tlbshootdown(&ts);
 	for (i=0; i < cpuarray_num(&allcpus); i++) {
 		c = cpuarray_get(&allcpus, i);
 		if (c != curcpu->c_self) {
-			ipi_tlbshootdown(c, (const struct tlbshootdown *)tlb_wrap);
+			ipi_tlbshootdown(c, &ts);
 		}
 	}
 	return 0;
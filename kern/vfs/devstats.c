@@ -0,0 +1,224 @@
+/*
+ * The stats device, "stats:", which reads as a text snapshot of what
+ * each cpu and each process has used (see rusage.h). Each read makes a
+ * fresh snapshot and hands back the part of it at the current offset,
+ * so to get a consistent picture read it all at once; reopen it to
+ * start over. The lines are:
+ *
+ *    hz HZ
+ *    cpu NUM UTICKS STICKS ITICKS SWITCHES
+ *    proc PID PPID THREADS UTIME STIME VCSW IVCSW MINFLT MAJFLT SWAPIN
+ *         INBYTES OUTBYTES MAXRSS NSYSCALLS NAME
+ *    sys PID CALLNO=COUNT ...
+ *
+ * all on one line each, with times in microseconds and MAXRSS in
+ * kilobytes. A process's "sys" line follows its "proc" line and lists
+ * the system calls it has made, by number; it is left out if there
+ * are none.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <stdarg.h>
+#include <lib.h>
+#include <uio.h>
+#include <cpu.h>
+#include <clock.h>
+#include <proc.h>
+#include <vm.h>
+#include <vfs.h>
+#include <device.h>
+
+/* Room needed for each kind of line, at most. */
+#define STATS_HEADLEN	32
+#define STATS_CPULEN	80
+#define STATS_PROCLEN	(256 + RU_NSYSCALLS * 16)
+
+/* Slack for processes that appear between sizing and filling. */
+#define STATS_EXTRAPROCS 4
+
+struct statsbuf {
+	char *sb_buf;
+	size_t sb_size;
+	size_t sb_len;
+};
+
+static void stats_printf(struct statsbuf *sb, const char *fmt, ...) __PF(2,3);
+
+static
+void
+stats_printf(struct statsbuf *sb, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(sb->sb_buf + sb->sb_len, sb->sb_size - sb->sb_len,
+		      fmt, ap);
+	va_end(ap);
+
+	/* if it didn't all fit, keep what did */
+	sb->sb_len += n;
+	if (sb->sb_len >= sb->sb_size) {
+		sb->sb_len = sb->sb_size - 1;
+	}
+}
+
+/* proc_foreach function to count the processes */
+static
+void
+stats_count(struct proc *p, const struct ru_counts *ru, void *arg)
+{
+	unsigned *nprocs = arg;
+
+	(void)p;
+	(void)ru;
+	(*nprocs)++;
+}
+
+/* proc_foreach function to print one process */
+static
+void
+stats_proc(struct proc *p, const struct ru_counts *ru, void *arg)
+{
+	struct statsbuf *sb = arg;
+	unsigned i;
+
+	stats_printf(sb, "proc %d %d %d %llu %llu %u %u %u %u %u "
+		     "%llu %llu %u %u %s\n",
+		     p->p_pid, p->p_parent != NULL ? p->p_parent->p_pid : 0,
+		     p->p_nthreads,
+		     (unsigned long long)ru->rc_utime,
+		     (unsigned long long)ru->rc_stime,
+		     ru->rc_nvcsw, ru->rc_nivcsw,
+		     ru->rc_minflt, ru->rc_majflt, ru->rc_nswapin,
+		     (unsigned long long)ru->rc_inbytes,
+		     (unsigned long long)ru->rc_outbytes,
+		     ru->rc_maxrss * (PAGE_SIZE / 1024),
+		     ru->rc_nsyscalls,
+		     p->p_name[0] != '\0' ? p->p_name : "-");
+
+	if (ru->rc_nsyscalls == 0) {
+		return;
+	}
+	stats_printf(sb, "sys %d", p->p_pid);
+	for (i=0; i<RU_NSYSCALLS; i++) {
+		if (ru->rc_syscalls[i] > 0) {
+			stats_printf(sb, " %u=%u", i, ru->rc_syscalls[i]);
+		}
+	}
+	stats_printf(sb, "\n");
+}
+
+/* For open() */
+static
+int
+statsopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+/* For close() */
+static
+int
+statsclose(struct device *dev)
+{
+	(void)dev;
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+statsio(struct device *dev, struct uio *uio)
+{
+	struct statsbuf sb;
+	struct cpu *c;
+	unsigned i, ncpus, nprocs;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		return EINVAL;
+	}
+
+	nprocs = 0;
+	result = proc_foreach(stats_count, &nprocs);
+	if (result) {
+		return result;
+	}
+	ncpus = cpu_count();
+
+	sb.sb_size = STATS_HEADLEN + ncpus * STATS_CPULEN +
+		(nprocs + STATS_EXTRAPROCS) * STATS_PROCLEN;
+	sb.sb_buf = kmalloc(sb.sb_size);
+	if (sb.sb_buf == NULL) {
+		return ENOMEM;
+	}
+	sb.sb_len = 0;
+
+	stats_printf(&sb, "hz %u\n", clock_hz);
+	for (i=0; i<ncpus; i++) {
+		/* another cpu's counters may be a tick behind; no matter */
+		c = cpu_get(i);
+		stats_printf(&sb, "cpu %u %u %u %u %u\n", c->c_number,
+			     c->c_uticks, c->c_sticks, c->c_iticks,
+			     c->c_nswitches);
+	}
+	result = proc_foreach(stats_proc, &sb);
+
+	if (result == 0 && uio->uio_offset < (off_t)sb.sb_len) {
+		result = uiomove(sb.sb_buf + uio->uio_offset,
+				 sb.sb_len - uio->uio_offset, uio);
+	}
+
+	kfree(sb.sb_buf);
+	return result;
+}
+
+/* For ioctl() */
+static
+int
+statsioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+/*
+ * Function to create and attach stats:
+ */
+void
+devstats_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add stats device: out of memory\n");
+	}
+
+	dev->d_open = statsopen;
+	dev->d_close = statsclose;
+	dev->d_io = statsio;
+	dev->d_ioctl = statsioctl;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("stats", dev, 0);
+	if (result) {
+		panic("Could not add stats device: %s\n", strerror(result));
+	}
+}
@@ -38,6 +38,11 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <cpu.h>
+#include <uio.h>
+#include <vnode.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <synch.h>
 // /*
 //  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
 //  * assignment, this file is not compiled or linked or in any way
@@ -47,6 +52,9 @@
 int copy_page_table(struct addrspace *newas,
 	struct page_table_entry *oldpt, struct page_table_entry **newpt);
 int copy_regions(struct region_entry *old_regions, struct region_entry **new_region);
+static void as_flushrange(struct addrspace *as, vaddr_t start, vaddr_t end);
+static void region_unmap_pages(struct addrspace *as, vaddr_t start,
+	vaddr_t end);
 
 struct addrspace *
 as_create(void)
@@ -62,15 +70,72 @@ as_create(void)
 	as->heap_end = 0;
 	as->regions = NULL;
 	as->stack_end = USERSTACK;
+	as->mmap_start = (USERSTACKBASE);
 	as->page_table = NULL;
 	as->swap_wc =  wchan_create("swap");
 	if (as->swap_wc == NULL)
 	{
+		kfree(as);
 		return NULL;
 	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL)
+	{
+		wchan_destroy(as->swap_wc);
+		kfree(as);
+		return NULL;
+	}
+	as->as_refcount = 1;
+	as->as_stacks = 0;
+	as->as_nresident = 0;
 	return as;
 }
 
+/*
+ * Wake up whoever is waiting for PTE, which we had busy. Called with
+ * as_lock held.
+ */
+static
+void
+as_unlockpte(struct addrspace *as, struct page_table_entry *pte)
+{
+	KASSERT(pte->pte_state.pte_lock_ondisk & PTE_LOCKED);
+	pte->pte_state.pte_lock_ondisk &= ~(PTE_LOCKED);
+	wchan_wakeall(as->swap_wc);
+}
+
+void
+as_waitpte(struct addrspace *as, struct page_table_entry *pte)
+{
+	/* the evictor clears PTE_LOCKED without as_lock; check again here */
+	wchan_lock(as->swap_wc);
+	if ((pte->pte_state.pte_lock_ondisk & PTE_LOCKED) == 0) {
+		wchan_unlock(as->swap_wc);
+		return;
+	}
+	lock_release(as->as_lock);
+	wchan_sleep(as->swap_wc);
+	lock_acquire(as->as_lock);
+}
+
+/*
+ * Find a busy page in [START, END), if any.
+ */
+static
+struct page_table_entry *
+as_busypte(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct page_table_entry *pte;
+
+	for (pte = as->page_table; pte != NULL; pte = pte->next) {
+		if (pte->vaddr >= start && pte->vaddr < end &&
+		    (pte->pte_state.pte_lock_ondisk & PTE_LOCKED)) {
+			return pte;
+		}
+	}
+	return NULL;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -79,9 +144,18 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	if (newas==NULL) {
 		return ENOMEM;
 	}
+	/* other threads may be faulting in OLD */
+	lock_acquire(old->as_lock);
+	/* and a page being read in isn't all there yet */
+	struct page_table_entry *busy;
+	while ((busy = as_busypte(old, 0, USERSPACETOP)) != NULL)
+	{
+		as_waitpte(old, busy);
+	}
 	int result = copy_page_table(newas,old->page_table, &(newas->page_table));
 	if (result != 0)
 	{
+		lock_release(old->as_lock);
 		kfree(newas);
 		return ENOMEM;
 	}
@@ -94,6 +168,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 			newas->page_table = newas->page_table->next;
 			kfree(temp);
 		}
+		lock_release(old->as_lock);
 		kfree(newas);
 		return ENOMEM;
 	}
@@ -101,6 +176,9 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	newas->heap_start = old->heap_start;
 	newas->heap_end = old->heap_end;
 	newas->stack_end = old->stack_end;
+	newas->mmap_start = old->mmap_start;
+	newas->as_stacks = old->as_stacks;
+	lock_release(old->as_lock);
 	*ret = newas;
 	return 0;
 }
@@ -177,6 +255,10 @@ copy_regions(struct region_entry *old_regions, struct region_entry **new_region)
 		(*new_region)->bounds = old_regions->bounds;
 		(*new_region)->original_perm = old_regions->original_perm;
 		(*new_region)->backup_perm = old_regions->backup_perm;
+		(*new_region)->reg_type = old_regions->reg_type;
+		(*new_region)->reg_flags = old_regions->reg_flags;
+		(*new_region)->reg_vn = old_regions->reg_vn;
+		(*new_region)->reg_offset = old_regions->reg_offset;
 		// kprintf("Copied region : %lx -> %lx\n",(unsigned long int)(*new_region)->reg_base,
 		// 	(unsigned long int)((*new_region)->reg_base+(*new_region)->bounds));
 		int result =  copy_regions(old_regions->next,&(*new_region)->next);
@@ -185,17 +267,53 @@ copy_regions(struct region_entry *old_regions, struct region_entry **new_region)
 			kfree(*new_region);
 			return ENOMEM;
 		}
+		if ((*new_region)->reg_vn != NULL)
+		{
+			VOP_INCREF((*new_region)->reg_vn);
+		}
 		return 0;
 	}
 }
 
 
+void
+as_incref(struct addrspace *as)
+{
+	lock_acquire(as->as_lock);
+	KASSERT(as->as_refcount > 0);
+	as->as_refcount++;
+	lock_release(as->as_lock);
+}
+
 void
 as_destroy(struct addrspace *as)
 {
 	// kprintf("AS Destroyed: %p\n",as);
 	if (as != NULL)
 	{
+		/************ Other threads may still be using it ************/
+		lock_acquire(as->as_lock);
+		KASSERT(as->as_refcount > 0);
+		if (--as->as_refcount > 0)
+		{
+			lock_release(as->as_lock);
+			return;
+		}
+		lock_release(as->as_lock);
+
+		/************ Write back shared file mappings before the pages go ************/
+		struct region_entry *reg;
+		lock_acquire(as->as_lock);
+		for (reg = as->regions; reg != NULL; reg = reg->next) {
+			if (reg->reg_type == RT_FILE && reg->reg_flags == MAP_SHARED)
+			{
+				as_flushrange(as, reg->reg_base,
+					reg->reg_base + reg->bounds);
+				region_unmap_pages(as, reg->reg_base,
+					reg->reg_base + reg->bounds);
+			}
+		}
+		lock_release(as->as_lock);
 		while(as->page_table != NULL){
 			struct page_table_entry *temp_page_t = as->page_table;
 			page_free(temp_page_t);
@@ -206,8 +324,14 @@ as_destroy(struct addrspace *as)
 		while(as->regions != NULL){
 			struct region_entry *temp_region = as->regions;
 			as->regions = as->regions->next;
+			if (temp_region->reg_vn != NULL)
+			{
+				VOP_DECREF(temp_region->reg_vn);
+			}
 			kfree(temp_region);
 		}
+		lock_destroy(as->as_lock);
+		wchan_destroy(as->swap_wc);
 	}
 	kfree(as);
 
@@ -310,6 +434,38 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 }
 
 
+int
+as_allocstack(struct addrspace *as, unsigned *slot, vaddr_t *stackptr)
+{
+	unsigned i;
+
+	lock_acquire(as->as_lock);
+	for (i = 0; i < AS_NSTACKS; i++)
+	{
+		if ((as->as_stacks & ((uint32_t)1 << i)) == 0)
+		{
+			as->as_stacks |= (uint32_t)1 << i;
+			lock_release(as->as_lock);
+			*slot = i;
+			*stackptr = (USERSTACKBASE) + (i + 1) * AS_STACKSIZE;
+			return 0;
+		}
+	}
+	lock_release(as->as_lock);
+	return ENOMEM;
+}
+
+void
+as_freestack(struct addrspace *as, unsigned slot)
+{
+	KASSERT(slot < AS_NSTACKS);
+
+	lock_acquire(as->as_lock);
+	KASSERT(as->as_stacks & ((uint32_t)1 << slot));
+	as->as_stacks &= ~((uint32_t)1 << slot);
+	lock_release(as->as_lock);
+}
+
 /************ RB:Sanity checks for address space ************/
 void
 as_check_regions(struct addrspace *as)
@@ -347,6 +503,7 @@ int page_alloc(struct page_table_entry *pte, struct addrspace *as){
 			entry.va = pte->vaddr & PAGE_FRAME;
 			entry.as = as;
 			coremap[i] = entry;
+			as->as_nresident++;
 			spinlock_release(&coremap_lock);
 			pte->paddr = i*PAGE_SIZE;
 			bzero((void *)PADDR_TO_KVADDR(pte->paddr), PAGE_SIZE);
@@ -376,6 +533,7 @@ int page_alloc(struct page_table_entry *pte, struct addrspace *as){
 
 	/************ RB:Check if selected clean or dirty page to decide swap out ************/
 	struct coremap_entry evict_page = coremap[s_index];
+	struct addrspace *ev_as = evict_page.as;
 	struct page_table_entry *ev_pte = get_pte(evict_page.as->page_table,evict_page.va);
 	KASSERT(ev_pte != NULL);
 	KASSERT((ev_pte->pte_state.pte_lock_ondisk & PTE_LOCKED) != PTE_LOCKED);
@@ -400,10 +558,13 @@ int page_alloc(struct page_table_entry *pte, struct addrspace *as){
 
 	/************ RB:Mark state coremap entry: clean if just swapped in, dirty if new ************/
 	/************ RB:Will change clean to dirty if faulttype is write when this function is called ************/
+	spinlock_acquire(&coremap_lock);
+	evict_page.as->as_nresident--;
 	evict_page.chunk_size = 1;
 	evict_page.va = pte->vaddr & PAGE_FRAME;
 	evict_page.as = as;
 	coremap[s_index] = evict_page;
+	as->as_nresident++;
 	spinlock_release(&coremap_lock);
 	pte->paddr = s_index * PAGE_SIZE;
 	if ((pte->pte_state.pte_lock_ondisk & PTE_ONDISK) == PTE_ONDISK)
@@ -415,7 +576,7 @@ int page_alloc(struct page_table_entry *pte, struct addrspace *as){
 	}
 	bzero((void *)PADDR_TO_KVADDR(pte->paddr), PAGE_SIZE);
 	ev_pte->pte_state.pte_lock_ondisk &= ~(PTE_LOCKED);
-	wchan_wakeall(as->swap_wc);
+	wchan_wakeall(ev_as->swap_wc);
 	return 0;
 }
 
@@ -426,6 +587,7 @@ void page_free(struct page_table_entry *pte){
 		int core_index = pte->paddr/PAGE_SIZE;
 		pte->paddr = (vaddr_t)NULL;
 		spinlock_acquire(&coremap_lock);
+		coremap[core_index].as->as_nresident--;
 		coremap[core_index].chunk_size = -1;
 		coremap[core_index].p_state = PS_FREE;
 		spinlock_release(&coremap_lock);
@@ -500,6 +662,10 @@ struct region_entry * add_region(struct addrspace* as, vaddr_t rbase,size_t sz,i
 	new_entry->original_perm = 0;
 	new_entry->original_perm = r|w|x;
 	new_entry->backup_perm = new_entry->original_perm;
+	new_entry->reg_type = RT_SEGMENT;
+	new_entry->reg_flags = 0;
+	new_entry->reg_vn = NULL;
+	new_entry->reg_offset = 0;
 
 	if (as->regions == NULL)
 	{
@@ -530,3 +696,352 @@ struct region_entry * get_region(struct region_entry* regions, vaddr_t vaddr)
 	}
 	return found?new_entry:NULL;
 }
+
+/************ mmap regions ************/
+
+/*
+ * Find a region overlapping [START, END), if any.
+ */
+static
+struct region_entry *
+region_overlap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct region_entry *reg;
+
+	for (reg = as->regions; reg != NULL; reg = reg->next) {
+		if (reg->reg_base < end && reg->reg_base + reg->bounds > start) {
+			return reg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Write the page at PADDR back to VN at POS, for a MAP_SHARED file
+ * mapping. Only the part before EOF is written; mapping a file never
+ * extends it.
+ */
+static
+int
+region_writeback(struct vnode *vn, off_t pos, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	size_t len;
+	int result;
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		return result;
+	}
+	if (pos >= st.st_size) {
+		return 0;
+	}
+	len = PAGE_SIZE;
+	if (st.st_size - pos < PAGE_SIZE) {
+		len = st.st_size - pos;
+	}
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), len, pos,
+		UIO_WRITE);
+	return VOP_WRITE(vn, &ku);
+}
+
+/*
+ * Get [START, END) ready to be unmapped: wait out pages that are busy,
+ * and write back the modified pages of shared file mappings. Each
+ * write is done with the page busy and as_lock let go, and then we
+ * start over, since anything may have changed meanwhile. Returns with
+ * as_lock held and nothing in the range busy or left to write back.
+ */
+static
+void
+as_flushrange(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct page_table_entry *pte;
+	struct region_entry *reg;
+	struct vnode *vn;
+	off_t pos;
+	int result;
+
+ again:
+	pte = as_busypte(as, start, end);
+	if (pte != NULL) {
+		as_waitpte(as, pte);
+		goto again;
+	}
+	for (pte = as->page_table; pte != NULL; pte = pte->next) {
+		if (pte->vaddr < start || pte->vaddr >= end ||
+		    pte->paddr == 0 ||
+		    (pte->pte_state.pte_lock_ondisk & PTE_MODIFIED) == 0) {
+			continue;
+		}
+		reg = region_overlap(as, pte->vaddr, pte->vaddr + PAGE_SIZE);
+		if (reg == NULL || reg->reg_type != RT_FILE ||
+		    reg->reg_flags != MAP_SHARED) {
+			continue;
+		}
+
+		/* writes from here on fault, and wait, and mark it again */
+		pte->pte_state.pte_lock_ondisk |= PTE_LOCKED;
+		pte->pte_state.pte_lock_ondisk &= ~(PTE_MODIFIED);
+		allcpu_tlbshootdown(pte->vaddr);
+		vn = reg->reg_vn;
+		pos = reg->reg_offset + (pte->vaddr - reg->reg_base);
+
+		lock_release(as->as_lock);
+		result = region_writeback(vn, pos, pte->paddr);
+		if (result) {
+			kprintf("vm: writeback of mapped page 0x%lx: %s\n",
+				(unsigned long)pte->vaddr, strerror(result));
+		}
+		lock_acquire(as->as_lock);
+
+		as_unlockpte(as, pte);
+		goto again;
+	}
+}
+
+/*
+ * Drop the pages that fall in [START, END). Call as_flushrange
+ * first, without letting go of as_lock in between.
+ */
+static
+void
+region_unmap_pages(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct page_table_entry *pte, *prev, *next;
+
+	prev = NULL;
+	for (pte = as->page_table; pte != NULL; pte = next) {
+		next = pte->next;
+		if (pte->vaddr < start || pte->vaddr >= end) {
+			prev = pte;
+			continue;
+		}
+		KASSERT((pte->pte_state.pte_lock_ondisk & PTE_LOCKED) == 0);
+		/*
+		 * Get it out of every TLB before the frame goes back, or a
+		 * thread on another cpu could keep writing into a frame
+		 * that now belongs to someone else.
+		 */
+		allcpu_tlbshootdown(pte->vaddr);
+		page_free(pte);
+		if (prev == NULL) {
+			as->page_table = next;
+		}
+		else {
+			prev->next = next;
+		}
+		kfree(pte);
+	}
+}
+
+static
+int
+as_mmap_locked(struct addrspace *as, vaddr_t *addr, size_t len, int prot,
+	int flags, struct vnode *vn, off_t offset)
+{
+	struct region_entry *reg;
+	vaddr_t base, heaptop;
+
+	KASSERT(len > 0 && (len & PAGE_FRAME) == len);
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	/* mappings go between the heap and the stack, top down */
+	heaptop = (as->heap_end + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (len > (USERSTACKBASE) - heaptop) {
+		return ENOMEM;
+	}
+	if (flags & MAP_FIXED) {
+		base = *addr;
+		if ((base & PAGE_FRAME) != base || base < heaptop ||
+		    base > (USERSTACKBASE) - len ||
+		    region_overlap(as, base, base + len) != NULL) {
+			return EINVAL;
+		}
+	}
+	else {
+		base = (USERSTACKBASE) - len;
+		while ((reg = region_overlap(as, base, base + len)) != NULL) {
+			if (reg->reg_base < heaptop + len) {
+				return ENOMEM;
+			}
+			base = reg->reg_base - len;
+		}
+	}
+
+	reg = add_region(as, base, len,
+		(prot & (PROT_READ|PROT_WRITE)) ? AX_READ : 0,
+		(prot & PROT_WRITE) ? AX_WRITE : 0,
+		(prot & PROT_EXEC) ? AX_EXECUTE : 0);
+	if (reg == NULL) {
+		return ENOMEM;
+	}
+	reg->reg_type = (vn == NULL) ? RT_ANON : RT_FILE;
+	reg->reg_flags = flags & MAP_TYPE;
+	reg->reg_vn = vn;
+	reg->reg_offset = offset;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+
+	if (base < as->mmap_start) {
+		as->mmap_start = base;
+	}
+	*addr = base;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *addr, size_t len, int prot,
+	int flags, struct vnode *vn, off_t offset)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_mmap_locked(as, addr, len, prot, flags, vn, offset);
+	lock_release(as->as_lock);
+	return result;
+}
+
+static
+int
+as_munmap_locked(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region_entry *reg, *prev, *next, *tail;
+	vaddr_t end, top, start_cut, end_cut;
+
+	KASSERT((addr & PAGE_FRAME) == addr);
+	KASSERT((len & PAGE_FRAME) == len);
+	end = addr + len;
+
+	/*
+	 * A hole in the middle of a mapping splits it in two. That can
+	 * only happen to one mapping, the one the whole range is inside,
+	 * and it's the only thing that needs memory; get that first, so
+	 * running out leaves everything as it was.
+	 */
+	tail = NULL;
+	for (reg = as->regions; reg != NULL; reg = reg->next) {
+		if (reg->reg_type != RT_SEGMENT && reg->reg_base < addr &&
+		    reg->reg_base + reg->bounds > end) {
+			tail = kmalloc(sizeof(struct region_entry));
+			if (tail == NULL) {
+				return ENOMEM;
+			}
+			break;
+		}
+	}
+
+	prev = NULL;
+	for (reg = as->regions; reg != NULL; reg = next) {
+		next = reg->next;
+		top = reg->reg_base + reg->bounds;
+		if (reg->reg_type == RT_SEGMENT || reg->reg_base >= end ||
+		    top <= addr) {
+			prev = reg;
+			continue;
+		}
+		start_cut = (addr > reg->reg_base) ? addr : reg->reg_base;
+		end_cut = (end < top) ? end : top;
+
+		if (start_cut > reg->reg_base && end_cut < top) {
+			/* hole in the middle: split off the part above it */
+			KASSERT(tail != NULL);
+			*tail = *reg;
+			tail->reg_base = end_cut;
+			tail->bounds = top - end_cut;
+			tail->reg_offset += end_cut - reg->reg_base;
+			if (tail->reg_vn != NULL) {
+				VOP_INCREF(tail->reg_vn);
+			}
+			region_unmap_pages(as, start_cut, end_cut);
+			reg->bounds = start_cut - reg->reg_base;
+			reg->next = tail;
+			prev = tail;
+			continue;
+		}
+
+		region_unmap_pages(as, start_cut, end_cut);
+		if (start_cut == reg->reg_base && end_cut == top) {
+			if (prev == NULL) {
+				as->regions = next;
+			}
+			else {
+				prev->next = next;
+			}
+			if (reg->reg_vn != NULL) {
+				VOP_DECREF(reg->reg_vn);
+			}
+			kfree(reg);
+			continue;
+		}
+		if (start_cut == reg->reg_base) {
+			/* cut off the bottom */
+			reg->reg_offset += end_cut - reg->reg_base;
+			reg->reg_base = end_cut;
+			reg->bounds = top - end_cut;
+		}
+		else {
+			/* cut off the top */
+			reg->bounds = start_cut - reg->reg_base;
+		}
+		prev = reg;
+	}
+
+	as->mmap_start = (USERSTACKBASE);
+	for (reg = as->regions; reg != NULL; reg = reg->next) {
+		if (reg->reg_type != RT_SEGMENT && reg->reg_base < as->mmap_start) {
+			as->mmap_start = reg->reg_base;
+		}
+	}
+
+	/* the unmapped pages may still be in the TLB */
+	if (as == curthread->t_addrspace) {
+		as_activate(as);
+	}
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	as_flushrange(as, addr, addr + len);
+	result = as_munmap_locked(as, addr, len);
+	lock_release(as->as_lock);
+	return result;
+}
+
+int
+as_fillpage(struct addrspace *as, struct region_entry *reg,
+	struct page_table_entry *pte)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct vnode *vn;
+	int result;
+
+	KASSERT(reg->reg_type == RT_FILE);
+	KASSERT(pte->paddr != 0);
+	KASSERT((pte->pte_state.pte_lock_ondisk & PTE_LOCKED) == 0);
+
+	/* page_alloc zeroed the page, so a short read past EOF is fine */
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pte->paddr), PAGE_SIZE,
+		reg->reg_offset + (pte->vaddr - reg->reg_base), UIO_READ);
+	vn = reg->reg_vn;
+
+	/*
+	 * munmap and fork wait while the page is busy, so PTE stays put;
+	 * REG might be trimmed meanwhile, hence taking VN first.
+	 */
+	pte->pte_state.pte_lock_ondisk |= PTE_LOCKED;
+	lock_release(as->as_lock);
+	result = VOP_READ(vn, &ku);
+	lock_acquire(as->as_lock);
+	as_unlockpte(as, pte);
+	return result;
+}
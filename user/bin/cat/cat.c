@@ -38,6 +38,35 @@
 
 
 
+/* Bytes asked of each sendfile call */
+#define KCOPY_CHUNK (64*1024)
+
+/*
+ * Have the kernel copy the rest of the open file FD to stdout with
+ * sendfile, so the data never has to come out to a user buffer and go
+ * back in. Returns -1, having copied nothing, if sendfile doesn't
+ * work here; then the caller has to copy the data itself.
+ */
+static
+int
+kcat(const char *name, int fd)
+{
+	int len;
+
+	len = sendfile(STDOUT_FILENO, fd, NULL, KCOPY_CHUNK);
+	if (len < 0) {
+		return -1;
+	}
+	/* Zero means EOF. */
+	while (len > 0) {
+		len = sendfile(STDOUT_FILENO, fd, NULL, KCOPY_CHUNK);
+	}
+	if (len < 0) {
+		err(1, "%s", name);
+	}
+	return 0;
+}
+
 /* Print a file that's already been opened. */
 static
 void
@@ -46,6 +75,10 @@ docat(const char *name, int fd)
 	char buf[1024];
 	int len, wr, wrtot;
 
+	if (kcat(name, fd) == 0) {
+		return;
+	}
+
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
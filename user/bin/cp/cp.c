@@ -36,6 +36,35 @@
  */
 
 
+/* Bytes asked of each sendfile call */
+#define KCOPY_CHUNK (64*1024)
+
+/*
+ * Have the kernel copy everything from FROMFD to TOFD with sendfile,
+ * so the data never has to come out to a user buffer and go back in.
+ * Returns -1, having copied nothing, if sendfile doesn't work on
+ * these files; then the caller has to copy the data itself.
+ */
+static
+int
+kcopy(const char *from, const char *to, int fromfd, int tofd)
+{
+	int len;
+
+	len = sendfile(tofd, fromfd, NULL, KCOPY_CHUNK);
+	if (len < 0) {
+		return -1;
+	}
+	/* Zero means EOF. */
+	while (len > 0) {
+		len = sendfile(tofd, fromfd, NULL, KCOPY_CHUNK);
+	}
+	if (len < 0) {
+		err(1, "%s to %s", from, to);
+	}
+	return 0;
+}
+
 /* Copy one file to another. */
 static
 void
@@ -58,31 +87,33 @@ copy(const char *from, const char *to)
 		err(1, "%s", to);
 	}
 
-	/*
-	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
-	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
+	if (kcopy(from, to, fromfd, tofd) < 0) {
 		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
+		 * As long as we get more than zero bytes, we haven't hit EOF.
+		 * Zero means EOF. Less than zero means an error occurred.
+		 * We may read less than we asked for, though, in various cases
+		 * for various reasons.
 		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "%s", to);
+		while ((len = read(fromfd, buf, sizeof(buf)))>0) {
+			/*
+			 * Likewise, we may actually write less than we attempted
+			 * to. So loop until we're done.
+			 */
+			wrtot = 0;
+			while (wrtot < len) {
+				wr = write(tofd, buf+wrtot, len-wrtot);
+				if (wr<0) {
+					err(1, "%s", to);
+				}
+				wrtot += wr;
 			}
-			wrtot += wr;
 		}
-	}
-	/*
-	 * If we got a read error, print it and exit.
-	 */
-	if (len<0) {
-		err(1, "%s", from);
+		/*
+		 * If we got a read error, print it and exit.
+		 */
+		if (len<0) {
+			err(1, "%s", from);
+		}
 	}
 
 	if (close(fromfd) < 0) {
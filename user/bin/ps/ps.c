@@ -0,0 +1,341 @@
+/*
+ * ps - show what each process has used, from the stats: device.
+ * Usage: ps [-s] [-w secs [-n count]]
+ *
+ *    -s        also list each process's system calls, by number
+ *    -w secs   keep going, top-style, every SECS seconds, showing what
+ *              was used in each interval rather than since the start
+ *              and busiest first
+ *    -n count  with -w, stop after COUNT intervals
+ *
+ * %CPU is the process's share of all the cpus' time over the period
+ * shown. The system call counts from -s are always totals.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#define STATSDEV	"stats:"
+#define BUFSIZE		65536
+#define MAXCPUS		32
+#define MAXPROCS	256
+#define NAMELEN		32
+
+struct cpuinfo {
+	unsigned long long uticks, sticks, iticks, switches;
+};
+
+struct procinfo {
+	int pid, ppid, nthreads;
+	unsigned long long utime, stime;	/* microseconds */
+	unsigned long long vcsw, ivcsw, minflt, majflt, swapin;
+	unsigned long long inbytes, outbytes, maxrss, nsyscalls;
+	char name[NAMELEN];
+	const char *sys;			/* rest of its "sys" line */
+};
+
+struct snapshot {
+	unsigned hz;
+	unsigned ncpus;
+	struct cpuinfo cpus[MAXCPUS];
+	unsigned nprocs;
+	struct procinfo procs[MAXPROCS];
+	char buf[BUFSIZE];
+};
+
+static struct snapshot snaps[2];
+static int showsys;
+
+////////////////////////////////////////////////////////////
+// reading stats:
+
+static
+unsigned long long
+getnum(char **context)
+{
+	unsigned long long v = 0;
+	char *s;
+
+	s = strtok_r(NULL, " ", context);
+	if (s == NULL) {
+		errx(1, "%s: short line", STATSDEV);
+	}
+	while (*s >= '0' && *s <= '9') {
+		v = v * 10 + (*s++ - '0');
+	}
+	return v;
+}
+
+static
+void
+parseproc(struct snapshot *sn, char **context)
+{
+	struct procinfo *pi;
+	const char *name;
+
+	if (sn->nprocs == MAXPROCS) {
+		return;
+	}
+	pi = &sn->procs[sn->nprocs++];
+	pi->pid = getnum(context);
+	pi->ppid = getnum(context);
+	pi->nthreads = getnum(context);
+	pi->utime = getnum(context);
+	pi->stime = getnum(context);
+	pi->vcsw = getnum(context);
+	pi->ivcsw = getnum(context);
+	pi->minflt = getnum(context);
+	pi->majflt = getnum(context);
+	pi->swapin = getnum(context);
+	pi->inbytes = getnum(context);
+	pi->outbytes = getnum(context);
+	pi->maxrss = getnum(context);
+	pi->nsyscalls = getnum(context);
+	name = strtok_r(NULL, " ", context);
+	snprintf(pi->name, NAMELEN, "%s", name != NULL ? name : "?");
+	pi->sys = NULL;
+}
+
+/*
+ * Read the whole of stats: into SN and pick it apart.
+ */
+static
+void
+readstats(struct snapshot *sn)
+{
+	char *line, *word, *lcontext, *context;
+	size_t len;
+	int fd, r;
+	unsigned num;
+
+	fd = open(STATSDEV, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", STATSDEV);
+	}
+	len = 0;
+	while (len < sizeof(sn->buf) - 1) {
+		r = read(fd, sn->buf + len, sizeof(sn->buf) - 1 - len);
+		if (r < 0) {
+			err(1, "%s: read", STATSDEV);
+		}
+		if (r == 0) {
+			break;
+		}
+		len += r;
+	}
+	close(fd);
+	sn->buf[len] = 0;
+
+	sn->hz = 0;
+	sn->ncpus = 0;
+	sn->nprocs = 0;
+	for (line = strtok_r(sn->buf, "\n", &lcontext); line != NULL;
+	     line = strtok_r(NULL, "\n", &lcontext)) {
+		word = strtok_r(line, " ", &context);
+		if (word == NULL) {
+			continue;
+		}
+		if (!strcmp(word, "hz")) {
+			sn->hz = getnum(&context);
+		}
+		else if (!strcmp(word, "cpu")) {
+			num = getnum(&context);
+			if (num >= MAXCPUS) {
+				continue;
+			}
+			if (num >= sn->ncpus) {
+				sn->ncpus = num + 1;
+			}
+			sn->cpus[num].uticks = getnum(&context);
+			sn->cpus[num].sticks = getnum(&context);
+			sn->cpus[num].iticks = getnum(&context);
+			sn->cpus[num].switches = getnum(&context);
+		}
+		else if (!strcmp(word, "proc")) {
+			parseproc(sn, &context);
+		}
+		else if (!strcmp(word, "sys") && sn->nprocs > 0) {
+			/* it goes with the proc line just before */
+			getnum(&context);
+			sn->procs[sn->nprocs - 1].sys = context;
+		}
+	}
+	if (sn->hz == 0) {
+		errx(1, "%s: no clock rate", STATSDEV);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// output
+
+/* What PI has used since OLD, if there is an OLD for the same process. */
+static
+void
+procdelta(struct procinfo *pi, const struct snapshot *old)
+{
+	const struct procinfo *op;
+	unsigned i;
+
+	if (old == NULL) {
+		return;
+	}
+	for (i=0; i<old->nprocs; i++) {
+		op = &old->procs[i];
+		if (op->pid != pi->pid || strcmp(op->name, pi->name)) {
+			continue;
+		}
+		pi->utime -= op->utime;
+		pi->stime -= op->stime;
+		pi->vcsw -= op->vcsw;
+		pi->ivcsw -= op->ivcsw;
+		pi->minflt -= op->minflt;
+		pi->majflt -= op->majflt;
+		pi->swapin -= op->swapin;
+		pi->inbytes -= op->inbytes;
+		pi->outbytes -= op->outbytes;
+		pi->nsyscalls -= op->nsyscalls;
+		return;
+	}
+}
+
+/*
+ * Print SN, less OLD if it isn't NULL. Works on a copy of the numbers,
+ * so SN can serve as the OLD of the next round.
+ */
+static
+void
+show(const struct snapshot *sn, const struct snapshot *old)
+{
+	static struct procinfo procs[MAXPROCS];
+	struct procinfo tmp;
+	struct cpuinfo ci;
+	unsigned long long u, s, i, total, alltotal, usecs;
+	unsigned n, j, k;
+
+	/* per cpu, as a share of its ticks */
+	alltotal = 0;
+	for (n=0; n<sn->ncpus; n++) {
+		ci = sn->cpus[n];
+		if (old != NULL && n < old->ncpus) {
+			ci.uticks -= old->cpus[n].uticks;
+			ci.sticks -= old->cpus[n].sticks;
+			ci.iticks -= old->cpus[n].iticks;
+			ci.switches -= old->cpus[n].switches;
+		}
+		u = ci.uticks;
+		s = ci.sticks;
+		i = ci.iticks;
+		total = u + s + i;
+		alltotal += total;
+		if (total == 0) {
+			total = 1;
+		}
+		printf("cpu%u: %3llu%% user %3llu%% sys %3llu%% idle "
+		       "%llu switches\n", n, u * 100 / total, s * 100 / total,
+		       i * 100 / total, ci.switches);
+	}
+	/* all the cpu time there was, in microseconds */
+	usecs = alltotal * (1000000 / sn->hz);
+	if (usecs == 0) {
+		usecs = 1;
+	}
+
+	for (n=0; n<sn->nprocs; n++) {
+		procs[n] = sn->procs[n];
+		procdelta(&procs[n], old);
+	}
+	if (old != NULL) {
+		/* busiest first */
+		for (j=1; j<sn->nprocs; j++) {
+			tmp = procs[j];
+			for (k=j; k>0 && procs[k-1].utime + procs[k-1].stime <
+				     tmp.utime + tmp.stime; k--) {
+				procs[k] = procs[k-1];
+			}
+			procs[k] = tmp;
+		}
+	}
+
+	printf("  PID  PPID THR  USER_MS   SYS_MS %%CPU   VCSW  IVCSW "
+	       "MINFLT MAJFLT SWAPIN  READ_K WRITE_K  RSS_K   CALLS NAME\n");
+	for (n=0; n<sn->nprocs; n++) {
+		struct procinfo *pi = &procs[n];
+
+		printf("%5d %5d %3d %8llu %8llu %4llu %6llu %6llu "
+		       "%6llu %6llu %6llu %7llu %7llu %6llu %7llu %s\n",
+		       pi->pid, pi->ppid, pi->nthreads,
+		       pi->utime / 1000, pi->stime / 1000,
+		       (pi->utime + pi->stime) * 100 / usecs,
+		       pi->vcsw, pi->ivcsw, pi->minflt, pi->majflt,
+		       pi->swapin, pi->inbytes / 1024, pi->outbytes / 1024,
+		       pi->maxrss, pi->nsyscalls, pi->name);
+		if (showsys && pi->sys != NULL) {
+			printf("      syscalls: %s\n", pi->sys);
+		}
+	}
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: ps [-s] [-w secs [-n count]]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec ts;
+	int secs = 0, count = 0;
+	int i, cur;
+
+	for (i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-s")) {
+			showsys = 1;
+		}
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			secs = atoi(argv[++i]);
+			if (secs <= 0) {
+				usage();
+			}
+		}
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			count = atoi(argv[++i]);
+			if (count <= 0) {
+				usage();
+			}
+		}
+		else {
+			usage();
+		}
+	}
+	if (count > 0 && secs == 0) {
+		usage();
+	}
+
+	cur = 0;
+	readstats(&snaps[cur]);
+	if (secs == 0) {
+		show(&snaps[cur], NULL);
+		return 0;
+	}
+
+	ts.tv_sec = secs;
+	ts.tv_nsec = 0;
+	for (i=0; count == 0 || i < count; i++) {
+		if (nanosleep(&ts, NULL) < 0) {
+			err(1, "nanosleep");
+		}
+		cur = !cur;
+		readstats(&snaps[cur]);
+		printf("\n");
+		show(&snaps[cur], &snaps[!cur]);
+	}
+	return 0;
+}
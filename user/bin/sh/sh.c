@@ -354,26 +354,14 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	/*
+	 * spawnv starts the program in a new process directly, so the
+	 * cost doesn't depend on how big the shell is.
+	 */
+	pid = spawnv(args[0], args);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
 	}
 
 	/* parent */
@@ -41,6 +41,25 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/*
+ * Output streams. stdout is line buffered if it can't seek (the
+ * console, a pipe) and fully buffered otherwise; stderr is unbuffered.
+ * Streams are flushed by fflush, by exit, and by the libc wrappers for
+ * fork and execv. Input is not buffered, but reading with getchar
+ * flushes line-buffered streams first so prompts appear.
+ */
+typedef struct __file FILE;
+
+extern FILE *stdout;
+extern FILE *stderr;
+
+#define BUFSIZ	1024
+
+/* Modes for setvbuf */
+#define _IOFBF	0	/* fully buffered */
+#define _IOLBF	1	/* line buffered */
+#define _IONBF	2	/* unbuffered */
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -50,6 +69,9 @@ int __vprintf(void (*sendfunc)(void *clientdata, const char *, size_t len),
 	      const char *fmt,
 	      __va_list ap);
 
+/* Flush every line-buffered stream (for libc internal use only) */
+void __stdio_flushlinebuf(void);
+
 /* Printf calls for user programs */
 int printf(const char *fmt, ...);
 int vprintf(const char *fmt, __va_list ap);
@@ -66,6 +88,15 @@ int __puts(const char *);
 /* Writes one character. Returns it. */
 int putchar(int);
 
+/* Stream output. fflush(NULL) flushes every stream. */
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
+int fputc(int ch, FILE *f);
+int fputs(const char *s, FILE *f);
+size_t fwrite(const void *buf, size_t size, size_t count, FILE *f);
+int fflush(FILE *f);
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+
 /* Reads one character (0-255) or returns EOF on error. */
 int getchar(void);
 
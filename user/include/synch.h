@@ -0,0 +1,36 @@
+#ifndef _SYNCH_H_
+#define _SYNCH_H_
+
+/*
+ * Mutexes and condition variables for threads of one process (see
+ * threadfork). Both are built on futex_wait/futex_wake: taking a free
+ * mutex or signalling a condition variable nobody waits on is a couple
+ * of atomic instructions, and only contention enters the kernel.
+ *
+ * Either may be set up with the initializer or the init function.
+ * Neither needs to be destroyed.
+ */
+
+struct mutex {
+	volatile int m_state;	/* 0 free, 1 held, 2 held with waiters */
+};
+
+struct cond {
+	volatile int c_seq;	/* bumped by each signal/broadcast */
+	volatile int c_waiters;	/* threads in cond_wait */
+};
+
+#define MUTEX_INITIALIZER	{ 0 }
+#define COND_INITIALIZER	{ 0, 0 }
+
+void mutex_init(struct mutex *m);
+void mutex_lock(struct mutex *m);
+int mutex_trylock(struct mutex *m);	/* returns 0 if it got the lock */
+void mutex_unlock(struct mutex *m);
+
+void cond_init(struct cond *c);
+void cond_wait(struct cond *c, struct mutex *m);
+void cond_signal(struct cond *c);
+void cond_broadcast(struct cond *c);
+
+#endif /* _SYNCH_H_ */
@@ -38,10 +38,12 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/iovec.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -116,8 +118,8 @@
 
 /* Required. */
 __DEAD void _exit(int code);
-int execv(const char *prog, char *const *args);
-pid_t fork(void);
+int __execv(const char *prog, char *const *args);
+pid_t __fork(void);
 int waitpid(pid_t pid, int *returncode, int flags);
 /* 
  * Open actually takes either two or three args: the optional third
@@ -153,7 +155,21 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int readv(int filehandle, const struct iovec *iov, int iovcnt);
+int writev(int filehandle, const struct iovec *iov, int iovcnt);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+int sendfile(int outhandle, int inhandle, off_t *pos, size_t size);
+pid_t __spawnv(const char *prog, char *const *args);
+int __threadfork(void (*entry)(void (*)(void *), void *),
+		 void (*func)(void *), void *arg);
+int threadjoin(int tid, int *status);
+__DEAD void threadexit(int code);
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int count);
 int __getcwd(char *buf, size_t buflen);
+int getrusage(int who, struct rusage *usage);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -161,6 +177,10 @@ int __getcwd(char *buf, size_t buflen);
  * These are not themselves system calls, but wrapper routines in libc.
  */
 
+pid_t fork(void);					/* calls __fork */
+int execv(const char *prog, char *const *args);		/* calls __execv */
+pid_t spawnv(const char *prog, char *const *args);	/* calls __spawnv */
+int threadfork(void (*func)(void *), void *arg);	/* calls __threadfork */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
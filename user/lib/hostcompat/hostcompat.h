@@ -33,3 +33,4 @@
 void hostcompat_init(int argc, char **argv);
 
 time_t __time(time_t *secs, unsigned long *nsecs);
+pid_t spawnv(const char *prog, char *const *args);
@@ -0,0 +1,27 @@
+/*
+ * OS/161 spawnv implementation in terms of Unix fork() and execv().
+ *
+ * Unlike the real thing, a failed exec is only reported by the child's
+ * exit status, not by spawnv's return value.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "hostcompat.h"
+
+pid_t
+spawnv(const char *prog, char *const *args)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		execv(prog, args);
+		perror(prog);
+		/* _exit, so the child doesn't run our atexit handlers */
+		_exit(1);
+	}
+	return pid;
+}
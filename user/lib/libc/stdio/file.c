@@ -0,0 +1,247 @@
+/*
+ * Buffered output streams. See stdio.h.
+ *
+ * Each stream has a fixed buffer and a mutex, since threads may share
+ * it. The buffering mode of stdout is decided on first use.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <synch.h>
+
+/* f_mode before the first write: not decided yet */
+#define MODE_UNKNOWN	(-1)
+
+struct __file {
+	int f_fd;
+	int f_mode;		/* _IOFBF, _IOLBF, _IONBF, or MODE_UNKNOWN */
+	int f_error;		/* a write failed */
+	size_t f_len;		/* bytes waiting in f_buf */
+	size_t f_size;		/* size of f_buf */
+	char *f_buf;
+	struct mutex f_lock;
+};
+
+static char __stdout_buf[BUFSIZ];
+
+static FILE __stdout = {
+	STDOUT_FILENO, MODE_UNKNOWN, 0, 0, BUFSIZ, __stdout_buf,
+	MUTEX_INITIALIZER
+};
+static FILE __stderr = {
+	STDERR_FILENO, _IONBF, 0, 0, 0, NULL,
+	MUTEX_INITIALIZER
+};
+
+FILE *stdout = &__stdout;
+FILE *stderr = &__stderr;
+
+static FILE *const __streams[] = { &__stdout, &__stderr };
+#define NSTREAMS (sizeof(__streams) / sizeof(__streams[0]))
+
+/*
+ * Write LEN bytes straight to the file, coping with short writes.
+ */
+static
+int
+__stdio_write(FILE *f, const char *data, size_t len)
+{
+	int r;
+
+	while (len > 0) {
+		r = write(f->f_fd, data, len);
+		if (r <= 0) {
+			f->f_error = 1;
+			return EOF;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static
+int
+__stdio_flush(FILE *f)
+{
+	int r;
+
+	if (f->f_len == 0) {
+		return 0;
+	}
+	r = __stdio_write(f, f->f_buf, f->f_len);
+	f->f_len = 0;
+	return r;
+}
+
+/*
+ * Interactive things (the console, pipes) can't seek; files can.
+ */
+static
+void
+__stdio_setmode(FILE *f)
+{
+	int olderrno = errno;
+
+	if (lseek(f->f_fd, 0, SEEK_CUR) < 0 && errno == ESPIPE) {
+		f->f_mode = _IOLBF;
+	}
+	else {
+		f->f_mode = _IOFBF;
+	}
+	errno = olderrno;
+}
+
+/*
+ * Add LEN bytes to F's buffer, writing it out as the mode requires.
+ * Call with F locked.
+ */
+static
+int
+__stdio_put(FILE *f, const char *data, size_t len)
+{
+	size_t n, i;
+	int newline = 0, r = 0;
+
+	if (f->f_mode == MODE_UNKNOWN) {
+		__stdio_setmode(f);
+	}
+	if (f->f_mode == _IONBF) {
+		return __stdio_write(f, data, len);
+	}
+
+	/* too big to be worth copying: send it along with what we have */
+	if (len >= f->f_size) {
+		if (__stdio_flush(f)) {
+			return EOF;
+		}
+		return __stdio_write(f, data, len);
+	}
+
+	while (len > 0) {
+		n = f->f_size - f->f_len;
+		if (n > len) {
+			n = len;
+		}
+		for (i=0; i<n; i++) {
+			f->f_buf[f->f_len++] = data[i];
+			if (data[i] == '\n') {
+				newline = 1;
+			}
+		}
+		data += n;
+		len -= n;
+		if (f->f_len == f->f_size) {
+			if (__stdio_flush(f)) {
+				r = EOF;
+			}
+			newline = 0;
+		}
+	}
+	if (f->f_mode == _IOLBF && newline && __stdio_flush(f)) {
+		r = EOF;
+	}
+	return r;
+}
+
+size_t
+fwrite(const void *buf, size_t size, size_t count, FILE *f)
+{
+	int r;
+
+	if (size == 0 || count == 0) {
+		return 0;
+	}
+	mutex_lock(&f->f_lock);
+	r = __stdio_put(f, buf, size * count);
+	mutex_unlock(&f->f_lock);
+	return r ? 0 : count;
+}
+
+int
+fputc(int ch, FILE *f)
+{
+	char c = ch;
+	int r;
+
+	mutex_lock(&f->f_lock);
+	r = __stdio_put(f, &c, 1);
+	mutex_unlock(&f->f_lock);
+	return r ? EOF : (int)(unsigned char)c;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	int r;
+
+	mutex_lock(&f->f_lock);
+	r = __stdio_put(f, s, strlen(s));
+	mutex_unlock(&f->f_lock);
+	return r ? EOF : 0;
+}
+
+int
+fflush(FILE *f)
+{
+	unsigned i;
+	int r = 0;
+
+	if (f == NULL) {
+		for (i=0; i<NSTREAMS; i++) {
+			if (fflush(__streams[i])) {
+				r = EOF;
+			}
+		}
+		return r;
+	}
+	mutex_lock(&f->f_lock);
+	r = __stdio_flush(f);
+	mutex_unlock(&f->f_lock);
+	return r;
+}
+
+void
+__stdio_flushlinebuf(void)
+{
+	unsigned i;
+
+	for (i=0; i<NSTREAMS; i++) {
+		if (__streams[i]->f_mode == _IOLBF) {
+			fflush(__streams[i]);
+		}
+	}
+}
+
+/*
+ * Change the buffering mode of F. A NULL BUF keeps the current buffer
+ * (if any), so only the mode changes.
+ */
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+		errno = EINVAL;
+		return EOF;
+	}
+
+	mutex_lock(&f->f_lock);
+	if (__stdio_flush(f)) {
+		mutex_unlock(&f->f_lock);
+		return EOF;
+	}
+	if (buf != NULL && size > 0) {
+		f->f_buf = buf;
+		f->f_size = size;
+	}
+	if (f->f_buf == NULL && mode != _IONBF) {
+		mutex_unlock(&f->f_lock);
+		errno = EINVAL;
+		return EOF;
+	}
+	f->f_mode = mode;
+	mutex_unlock(&f->f_lock);
+	return 0;
+}
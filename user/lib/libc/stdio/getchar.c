@@ -33,6 +33,9 @@
 /*
  * C standard I/O function - read character from stdin
  * and return it or the symbolic constant EOF (-1).
+ *
+ * Input isn't buffered, but pending line-buffered output is flushed
+ * first so a prompt shows up before we wait for the answer.
  */
 
 int
@@ -41,6 +44,7 @@ getchar(void)
 	char ch;
 	int len;
 
+	__stdio_flushlinebuf();
 	len = read(STDIN_FILENO, &ch, 1);
 	if (len<=0) {
 		/* end of file or error */
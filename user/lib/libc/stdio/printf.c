@@ -31,23 +31,19 @@
 #include <stdarg.h>
 
 /*
- * printf - C standard I/O function.
+ * printf and fprintf - C standard I/O functions.
  */
 
 
 /*
  * Function passed to __vprintf to do the actual output.
+ * MYDATA is the stream.
  */
 static
 void
 __printf_send(void *mydata, const char *data, size_t len)
 {
-	unsigned i;
-	(void)mydata;  /* not needed */
-
-	for (i=0; i<len; i++) {
-		putchar(data[i]);
-	}
+	fwrite(data, 1, len, mydata);
 }
 
 /* printf: hand off to vprintf */
@@ -66,5 +62,23 @@ printf(const char *fmt, ...)
 int
 vprintf(const char *fmt, va_list ap)
 {
-	return __vprintf(__printf_send, NULL, fmt, ap);
+	return __vprintf(__printf_send, stdout, fmt, ap);
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	return __vprintf(__printf_send, f, fmt, ap);
 }
@@ -30,16 +30,28 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * Blocks carry the same 8-byte boundary-tag header as always (offsets
+ * to the neighbouring blocks, an in-use bit, magic numbers), so free
+ * can coalesce with both neighbours in constant time. Free blocks are
+ * kept on doubly linked lists threaded through their data areas:
+ *
+ *    - one list per size for small blocks (up to MSMALLMAX bytes, in
+ *      MBLOCKSIZE steps), which are always an exact fit;
+ *    - one list per power of two for larger blocks, searched best-fit.
+ *
+ * A bitmap of nonempty lists lets malloc skip straight to the first
+ * list that can satisfy a request, so neither malloc nor free ever
+ * walks the heap. The heap grows in MCHUNK steps to keep sbrk calls
+ * rare. See design/usermalloc.txt.
+ *
+ * All of this is protected by one mutex so threads can share the heap.
  */
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
+#include <synch.h>
 
 #undef MALLOCDEBUG
 
@@ -133,12 +145,43 @@ struct mheader {
 
 #define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
 
+/*
+ * Free list links, kept in the data area of a free block. Every block
+ * has at least MBLOCKSIZE bytes of data, which is enough for these.
+ */
+struct mlinks {
+	struct mheader *ml_next;
+	struct mheader *ml_prev;
+};
+
+#define M_LINKS(mh)	((struct mlinks *)M_DATA(mh))
+
+/*
+ * Free list bins.
+ *
+ * MSMALLMAX:	largest data size with an exact-size bin
+ * NSMALLBINS:	number of exact-size bins (sizes MBLOCKSIZE..MSMALLMAX)
+ * NBINS:	total bins; the rest each hold one power of two of sizes
+ * MCHUNK:	minimum amount to grow the heap by
+ */
+#define MSMALLMAX	512
+#define MSMALLSHIFT	9		/* log2(MSMALLMAX) */
+#define NSMALLBINS	(MSMALLMAX / MBLOCKSIZE)
+#define NBINS		(NSMALLBINS + (int)(sizeof(size_t) * 8) - MSMALLSHIFT)
+#define MBINWORDS	((NBINS + 31) / 32)
+#define MCHUNK		(64 * 1024)
+
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the heap, the
+ * highest block, the free lists, and the lock for all of them.
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mheader *__heaplast;
+static struct mheader *__bins[NBINS];
+static uint32_t __binmap[MBINWORDS];
+static struct mutex __malloc_lock = MUTEX_INITIALIZER;
 
 /*
  * Setup function.
@@ -254,6 +297,137 @@ __malloc_dump(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Bin for a free block with SIZE bytes of data.
+ */
+static
+int
+__malloc_bin(size_t size)
+{
+	int bin;
+
+	if (size <= MSMALLMAX) {
+		return size / MBLOCKSIZE - 1;
+	}
+	bin = NSMALLBINS;
+	size >>= MSMALLSHIFT + 1;
+	while (size > 0) {
+		bin++;
+		size >>= 1;
+	}
+	return bin;
+}
+
+static
+void
+__malloc_link(struct mheader *mh)
+{
+	struct mlinks *ml = M_LINKS(mh);
+	int bin = __malloc_bin(M_SIZE(mh));
+
+	ml->ml_prev = NULL;
+	ml->ml_next = __bins[bin];
+	if (ml->ml_next != NULL) {
+		M_LINKS(ml->ml_next)->ml_prev = mh;
+	}
+	__bins[bin] = mh;
+	__binmap[bin / 32] |= (uint32_t)1 << (bin % 32);
+}
+
+static
+void
+__malloc_unlink(struct mheader *mh)
+{
+	struct mlinks *ml = M_LINKS(mh);
+	int bin = __malloc_bin(M_SIZE(mh));
+
+	if (ml->ml_prev != NULL) {
+		M_LINKS(ml->ml_prev)->ml_next = ml->ml_next;
+	}
+	else {
+		__bins[bin] = ml->ml_next;
+		if (ml->ml_next == NULL) {
+			__binmap[bin / 32] &= ~((uint32_t)1 << (bin % 32));
+		}
+	}
+	if (ml->ml_next != NULL) {
+		M_LINKS(ml->ml_next)->ml_prev = ml->ml_prev;
+	}
+}
+
+/*
+ * Find the first nonempty bin at or above BIN, or -1.
+ */
+static
+int
+__malloc_nextbin(int bin)
+{
+	int w;
+	uint32_t bits;
+
+	for (w = bin / 32; w < MBINWORDS; w++) {
+		bits = __binmap[w];
+		if (w == bin / 32) {
+			bits &= ~(uint32_t)0 << (bin % 32);
+		}
+		if (bits != 0) {
+			bin = w * 32;
+			while ((bits & 1) == 0) {
+				bits >>= 1;
+				bin++;
+			}
+			return bin;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Find and unlink a free block with at least SIZE bytes of data, or
+ * return NULL. Small bins hold one size, so their first block will do;
+ * in the power-of-two bins take the best fit.
+ */
+static
+struct mheader *
+__malloc_find(size_t size)
+{
+	struct mheader *mh, *best;
+	int bin;
+
+	for (bin = __malloc_nextbin(__malloc_bin(size)); bin >= 0;
+	     bin = __malloc_nextbin(bin + 1)) {
+		if (bin < NSMALLBINS) {
+			best = __bins[bin];
+		}
+		else {
+			best = NULL;
+			for (mh = __bins[bin]; mh != NULL;
+			     mh = M_LINKS(mh)->ml_next) {
+				if (M_SIZE(mh) < size) {
+					continue;
+				}
+				if (best == NULL || M_SIZE(mh) < M_SIZE(best)) {
+					best = mh;
+					if (M_SIZE(mh) == size) {
+						break;
+					}
+				}
+			}
+		}
+		if (best != NULL) {
+			if (!M_OK(best) || best->mh_inuse) {
+				errx(1, "malloc: Heap corrupt; free block at %p"
+				     " is damaged", best);
+			}
+			__malloc_unlink(best);
+			return best;
+		}
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Get more memory (at the top of the heap) using sbrk, and 
  * return a pointer to it.
@@ -279,6 +453,53 @@ __malloc_sbrk(size_t size)
 	return x;
 }
 
+/*
+ * Grow the heap so there's a free block at the top with at least SIZE
+ * bytes of data, and return it (unlinked). Grow by MCHUNK if possible
+ * so we aren't back here on the next call.
+ */
+static
+struct mheader *
+__malloc_grow(size_t size)
+{
+	struct mheader *mh, *last;
+	size_t need, amount;
+
+	last = __heaplast;
+	need = size + MBLOCKSIZE;
+	if (last != NULL && !last->mh_inuse) {
+		/* the top block will be merged in */
+		need = size > M_SIZE(last) ? size - M_SIZE(last) : MBLOCKSIZE;
+		need = (need + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1);
+	}
+	amount = need < MCHUNK ? MCHUNK : need;
+
+	mh = __malloc_sbrk(amount);
+	if (mh == NULL && amount > need) {
+		amount = need;
+		mh = __malloc_sbrk(amount);
+	}
+	if (mh == NULL) {
+		return NULL;
+	}
+
+	mh->mh_prevblock = last != NULL ? M_MKFIELD((uintptr_t)mh -
+						    (uintptr_t)last) : 0;
+	mh->mh_magic1 = MMAGIC;
+	mh->mh_magic2 = MMAGIC;
+	mh->mh_pad = 0;
+	mh->mh_inuse = 0;
+	mh->mh_nextblock = M_MKFIELD(amount);
+	__heaplast = mh;
+
+	if (last != NULL && !last->mh_inuse) {
+		__malloc_unlink(last);
+		last->mh_nextblock = M_MKFIELD(M_NEXTOFF(last) + amount);
+		__heaplast = mh = last;
+	}
+	return mh;
+}
+
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
@@ -324,6 +545,10 @@ __malloc_split(struct mheader *mh, size_t size)
 	if (mhnext != (struct mheader *) __heaptop) {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+	else {
+		__heaplast = mhnew;
+	}
+	__malloc_link(mhnew);
 }
 
 /*
@@ -333,8 +558,8 @@ void *
 malloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
+
+	mutex_lock(&__malloc_lock);
 
 	if (__heapbase==0) {
 		__malloc_init();
@@ -351,84 +576,44 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
 	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
+	 * Round size up to an integral number of blocks, and to at least
+	 * one block so a free block can hold its list links. Refuse sizes
+	 * so large that rounding wraps around.
 	 */
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i, 
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
-		}
-
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
-		}
-
-		/* Try splitting block. */
-		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
-		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
+	if (size > (size_t)-1 - 2*MBLOCKSIZE) {
+		mutex_unlock(&__malloc_lock);
+		return NULL;
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
 	}
 
-	/*
-	 * Didn't find anything. Expand the heap.
-	 */
-
-	mh = __malloc_sbrk(size + MBLOCKSIZE);
+	mh = __malloc_find(size);
 	if (mh == NULL) {
-		return NULL;
+		mh = __malloc_grow(size);
+		if (mh == NULL) {
+			mutex_unlock(&__malloc_lock);
+			return NULL;
+		}
 	}
 
-	mh->mh_prevblock = rightprevblock;
-	mh->mh_magic1 = MMAGIC;
-	mh->mh_magic2 = MMAGIC;
-	mh->mh_pad = 0;
+	/* Give back what we don't need, then allocate. */
+	__malloc_split(mh, size);
 	mh->mh_inuse = 1;
-	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
 
 #ifdef MALLOCDEBUG
 	warnx("malloc: allocating at %p", M_DATA(mh));
 	__malloc_dump();
 #endif
+	mutex_unlock(&__malloc_lock);
 	return M_DATA(mh);
 }
 
 ////////////////////////////////////////////////////////////
 
+#ifdef MALLOCDEBUG
 /*
  * Clear a range of memory with 0xdeadbeef.
  * ptr must be suitably aligned.
@@ -443,13 +628,15 @@ __malloc_deadbeef(void *ptr, size_t size)
 		x[i] = 0xdeadbeef;
 	}
 }
+#endif
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Merge free block mhnext into free block mh just below it. Neither
+ * may be on a free list.
  */
 static
 void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
+__malloc_merge(struct mheader *mh, struct mheader *mhnext)
 {
 	struct mheader *mhnextnext;
 
@@ -457,10 +644,6 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
 		     mh, mhnext);
 	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
-	}
 
 	mhnextnext = M_NEXT(mhnext);
 
@@ -470,9 +653,14 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 	if (mhnextnext != (struct mheader *)__heaptop) {
 		mhnextnext->mh_prevblock = mh->mh_nextblock;
 	}
+	else {
+		__heaplast = mh;
+	}
 
+#ifdef MALLOCDEBUG
 	/* Deadbeef out the memory used by the now-obsolete header */
 	__malloc_deadbeef(mhnext, sizeof(struct mheader));
+#endif
 }
 
 /*
@@ -488,6 +676,8 @@ free(void *x)
 		return;
 	}
 
+	mutex_lock(&__malloc_lock);
+
 	/* Consistency check. */
 	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
 		warnx("free: Internal error - local data corrupt");
@@ -517,23 +707,33 @@ free(void *x)
 	/* mark it free */
 	mh->mh_inuse = 0;
 
+#ifdef MALLOCDEBUG
 	/* wipe it */
 	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+#endif
 
 	/* Try merging with the block above (but not if we're at the top) */
 	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
+	if (mhnext != (struct mheader *)__heaptop && !mhnext->mh_inuse) {
+		__malloc_unlink(mhnext);
+		__malloc_merge(mh, mhnext);
 	}
 
 	/* Try merging with the block below (but not if we're at the bottom) */
 	if (mh != (struct mheader *)__heapbase) {
 		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+		if (!mhprev->mh_inuse) {
+			__malloc_unlink(mhprev);
+			__malloc_merge(mhprev, mh);
+			mh = mhprev;
+		}
 	}
 
+	__malloc_link(mh);
+
 #ifdef MALLOCDEBUG
 	warnx("free: freed %p", x);
 	__malloc_dump();
 #endif
+	mutex_unlock(&__malloc_lock);
 }
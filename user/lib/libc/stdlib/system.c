@@ -27,6 +27,7 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/wait.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -74,18 +75,12 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
-	switch (pid) {
-	    case -1:
-		return -1;
-	    case 0:
-		/* child */
-		execv(argv[0], argv);
-		/* exec only returns if it fails */
-		_exit(255);
-	    default:
-		/* parent */
-		waitpid(pid, &status, 0);
-		return status;
+	/* Start it without copying our address space first. */
+	pid = spawnv(argv[0], argv);
+	if (pid < 0) {
+		/* same status as if a forked child's exec had failed */
+		return _MKWAIT_EXIT(255);
 	}
+	waitpid(pid, &status, 0);
+	return status;
 }
@@ -84,6 +84,9 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 	 */
 	errmsg = strerror(errno);
 
+	/* stderr isn't buffered; get stdout's output out ahead of ours */
+	fflush(stdout);
+
 	/*
 	 * Look up the program name.
 	 * Strictly speaking we should pull off the rightmost
@@ -0,0 +1,31 @@
+/*
+ * fork, execv and spawnv: flush stdio, then make the system call.
+ *
+ * Unflushed output would otherwise be printed twice after fork (once
+ * by each process), be lost by execv, or come out after the output of
+ * a program started with spawnv.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+pid_t
+fork(void)
+{
+	fflush(NULL);
+	return __fork();
+}
+
+int
+execv(const char *prog, char *const *args)
+{
+	fflush(NULL);
+	return __execv(prog, args);
+}
+
+pid_t
+spawnv(const char *prog, char *const *args)
+{
+	fflush(NULL);
+	return __spawnv(prog, args);
+}
@@ -0,0 +1,177 @@
+/*
+ * Futex-based mutexes and condition variables. See synch.h.
+ *
+ * The mutex is the three-state one from Drepper's "Futexes Are
+ * Tricky": unlock only calls futex_wake if the state says someone
+ * might be asleep.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <synch.h>
+
+/* futex_wake count that wakes everyone */
+#define WAKE_ALL 0x7fffffff
+
+/*
+ * Atomic operations, using LL/SC. Each returns the old value.
+ */
+
+static
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) give up */
+		"move %1, %4;"		/*   y = new (delay slot) */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the store failed */
+		"nop;"
+		"2: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+static
+int
+atomic_swap(volatile int *p, int new)
+{
+	int x, y;
+
+	do {
+		y = new;
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"
+			: "=&r" (x), "+r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+static
+int
+atomic_add(volatile int *p, int n)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%3);"		/*   x = *p */
+			"addu %1, %0, %2;"	/*   y = x + n */
+			"sc %1, 0(%3);"		/*   *p = y; y = success? */
+			".set pop"
+			: "=&r" (x), "=&r" (y) : "r" (n), "r" (p) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+////////////////////////////////////////////////////////////
+// mutexes
+
+void
+mutex_init(struct mutex *m)
+{
+	m->m_state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+	int c;
+
+	c = atomic_cas(&m->m_state, 0, 1);
+	if (c == 0) {
+		return;
+	}
+	/* contended: say so, then sleep until we take it from free */
+	if (c != 2) {
+		c = atomic_swap(&m->m_state, 2);
+	}
+	while (c != 0) {
+		futex_wait(&m->m_state, 2);
+		c = atomic_swap(&m->m_state, 2);
+	}
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+	if (atomic_cas(&m->m_state, 0, 1) != 0) {
+		errno = EBUSY;
+		return -1;
+	}
+	return 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if (atomic_swap(&m->m_state, 0) == 2) {
+		futex_wake(&m->m_state, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// condition variables
+
+void
+cond_init(struct cond *c)
+{
+	c->c_seq = 0;
+	c->c_waiters = 0;
+}
+
+/*
+ * A signal that comes between reading c_seq and futex_wait changes
+ * c_seq, so futex_wait returns at once instead of missing it. We count
+ * ourselves in c_waiters before reading c_seq, so any signal that
+ * changes it after that sees us and makes the wake call.
+ */
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+	int seq;
+
+	atomic_add(&c->c_waiters, 1);
+	seq = c->c_seq;
+	mutex_unlock(m);
+	futex_wait(&c->c_seq, seq);
+	atomic_add(&c->c_waiters, -1);
+
+	/* others may be woken with us, so take the mutex as contended */
+	while (atomic_swap(&m->m_state, 2) != 0) {
+		futex_wait(&m->m_state, 2);
+	}
+}
+
+void
+cond_signal(struct cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	if (c->c_waiters > 0) {
+		futex_wake(&c->c_seq, 1);
+	}
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	if (c->c_waiters > 0) {
+		futex_wake(&c->c_seq, WAKE_ALL);
+	}
+}
@@ -0,0 +1,23 @@
+/*
+ * threadfork: start a thread in this process running FUNC(ARG).
+ */
+
+#include <unistd.h>
+
+/*
+ * Where new threads start. The kernel gives each one an empty stack
+ * with nothing to return to, so if FUNC returns, exit the thread here.
+ */
+static
+void
+__threadstart(void (*func)(void *), void *arg)
+{
+	func(arg);
+	threadexit(0);
+}
+
+int
+threadfork(void (*func)(void *), void *arg)
+{
+	return __threadfork(__threadstart, func, arg);
+}
@@ -56,33 +56,67 @@
 
 #include "disk.h"
 
+/* Hash buckets per directory, or 0 for flat directories */
+static uint32_t dirbuckets;
+
+/* Block size of the volume */
+static uint32_t blocksize;
+
+/* Indirect blocks (one per level) and directory blocks */
+static uint32_t ib[3][SFS_DBPERIDB(SFS_MAXBLOCKSIZE)];
+static struct sfs_dir sds[SFS_DIRPERBLOCK(SFS_MAXBLOCKSIZE)];
+
 static
 uint32_t
 dumpsb(void)
 {
 	struct sfs_super sp;
-	diskread(&sp, SFS_SB_LOCATION);
+	diskreadpart(&sp, SFS_SB_LOCATION, sizeof(sp));
 	if (SWAPL(sp.sp_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
-	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
-	       SWAPL(sp.sp_nblocks));
+
+	blocksize = SWAPL(sp.sp_blocksize);
+	if (blocksize == 0) {
+		blocksize = SFS_MINBLOCKSIZE;
+	}
+	if (blocksize < SFS_MINBLOCKSIZE || blocksize > SFS_MAXBLOCKSIZE ||
+	    (blocksize & (blocksize-1)) != 0) {
+		errx(1, "Invalid block size %u", blocksize);
+	}
+	disksetblocksize(blocksize);
+
+	printf("Volume name: %-40s  %u blocks of %u bytes\n", sp.sp_volname,
+	       SWAPL(sp.sp_nblocks), blocksize);
+
+	dirbuckets = SWAPL(sp.sp_dirbuckets);
+	if (dirbuckets != 0) {
+		printf("Directories: hashed, %u buckets\n", dirbuckets);
+	}
+	else {
+		printf("Directories: linear\n");
+	}
 
 	return SWAPL(sp.sp_nblocks);
 }
 
 static
 void
-dodirblock(uint32_t block)
+dodirblock(uint32_t block, uint32_t fileblock)
 {
-	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	int nsds = SFS_DIRPERBLOCK(blocksize);
 	int i;
 
-	diskread(&sds, block);
+	diskread(sds, block);
 
-	printf("    [block %u]\n", block);
+	if (dirbuckets != 0) {
+		printf("    [block %u: bucket %u, chain position %u]\n",
+		       block, fileblock % dirbuckets, fileblock / dirbuckets);
+	}
+	else {
+		printf("    [block %u]\n", block);
+	}
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAPL(sds[i].sfd_ino);
 		if (ino==SFS_NOINO) {
@@ -95,16 +129,59 @@ dodirblock(uint32_t block)
 	}
 }
 
+/*
+ * Dump the directory blocks under indirect block IBLOCK, which is
+ * INDIRECTION levels above the data and whose first entry maps file
+ * block FILEBLOCK. Returns the number of directory blocks found.
+ */
+static
+uint32_t
+dumpindirect(uint32_t iblock, int indirection, uint64_t fileblock)
+{
+	uint32_t *entries = ib[indirection-1];
+	uint32_t dbperidb = SFS_DBPERIDB(blocksize);
+	uint64_t span;
+	uint32_t block, nblocks=0;
+	uint32_t i;
+	int j;
+
+	if (iblock == 0) {
+		return 0;
+	}
+
+	span = 1;
+	for (j=1; j<indirection; j++) {
+		span *= dbperidb;
+	}
+
+	diskread(entries, iblock);
+	for (i=0; i<dbperidb; i++) {
+		block = SWAPL(entries[i]);
+		if (block == 0) {
+			continue;
+		}
+		if (indirection > 1) {
+			nblocks += dumpindirect(block, indirection-1,
+						fileblock + i*span);
+		}
+		else {
+			dodirblock(block, fileblock + i);
+			nblocks++;
+		}
+	}
+	return nblocks;
+}
+
 static
 void
 dumpdir(uint32_t ino)
 {
 	struct sfs_inode sfi;
-	uint32_t ib[SFS_DBPERIDB];
 	int nentries, i;
 	uint32_t block, nblocks=0;
+	uint64_t fileblock, dbperidb = SFS_DBPERIDB(blocksize);
 
-	diskread(&sfi, ino);
+	diskreadpart(&sfi, ino, sizeof(sfi));
 
 	nentries = SWAPL(sfi.sfi_size) / sizeof(struct sfs_dir);
 	if (SWAPL(sfi.sfi_size) % sizeof(struct sfs_dir) != 0) {
@@ -115,20 +192,16 @@ dumpdir(uint32_t ino)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = SWAPL(sfi.sfi_direct[i]);
 		if (block) {
-			dodirblock(block);
+			dodirblock(block, i);
 			nblocks++;
 		}
 	}
-	if (SWAPL(sfi.sfi_indirect)) {
-		diskread(&ib, SWAPL(sfi.sfi_indirect));
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			block = SWAPL(ib[i]);
-			if (block) {
-				dodirblock(block);
-				nblocks++;
-			}
-		}
-	}
+	fileblock = SFS_NDIRECT;
+	nblocks += dumpindirect(SWAPL(sfi.sfi_indirect), 1, fileblock);
+	fileblock += dbperidb;
+	nblocks += dumpindirect(SWAPL(sfi.sfi_dindirect), 2, fileblock);
+	fileblock += dbperidb*dbperidb;
+	nblocks += dumpindirect(SWAPL(sfi.sfi_tindirect), 3, fileblock);
 	printf("    %u blocks in directory\n", nblocks);
 }
 
@@ -136,15 +209,15 @@ static
 void
 dumpbits(uint32_t fsblocks)
 {
-	uint32_t nblocks = SFS_BITBLOCKS(fsblocks);
+	uint32_t nblocks = SFS_BITBLOCKS(fsblocks, blocksize);
 	uint32_t i, j;
-	char data[SFS_BLOCKSIZE];
+	static char data[SFS_MAXBLOCKSIZE];
 
-	printf("Freemap: %u blocks (%u %u %u)\n", nblocks, SFS_BITMAPSIZE(fsblocks), fsblocks, SFS_BLOCKBITS);
+	printf("Freemap: %u blocks (%u %u %u)\n", nblocks, SFS_BITMAPSIZE(fsblocks, blocksize), fsblocks, SFS_BLOCKBITS(blocksize));
 
 	for (i=0; i<nblocks; i++) {
 		diskread(data, SFS_MAP_LOCATION+i);
-		for (j=0; j<SFS_BLOCKSIZE; j++) {
+		for (j=0; j<blocksize; j++) {
 			printf("%02x", (unsigned char)data[j]);
 			if (j%32==31) {
 				printf("\n");
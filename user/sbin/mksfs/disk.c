@@ -41,14 +41,15 @@
 #include "disk.h"
 
 #define HOSTSTRING "System/161 Disk Image"
-#define BLOCKSIZE  512
+#define SECTORSIZE 512
 
 #ifndef EINTR
 #define EINTR 0
 #endif
 
 static int fd=-1;
-static uint32_t nblocks;
+static uint32_t nsectors;
+static uint32_t blocksize = SECTORSIZE;
 
 void
 opendisk(const char *path)
@@ -64,10 +65,10 @@ opendisk(const char *path)
 		err(1, "%s: fstat", path);
 	}
 
-	nblocks = statbuf.st_size / BLOCKSIZE;
+	nsectors = statbuf.st_size / SECTORSIZE;
 
 #ifdef HOST
-	nblocks--;
+	nsectors--;
 
 	{
 		char buf[64];
@@ -90,40 +91,77 @@ opendisk(const char *path)
 #endif
 }
 
+uint32_t
+disksectorsize(void)
+{
+	assert(fd>=0);
+	return SECTORSIZE;
+}
+
+/*
+ * Set the size of the blocks diskread and diskwrite work with. It
+ * starts out as the sector size.
+ */
+void
+disksetblocksize(uint32_t size)
+{
+	assert(size >= SECTORSIZE && size % SECTORSIZE == 0);
+	blocksize = size;
+}
+
 uint32_t
 diskblocksize(void)
 {
 	assert(fd>=0);
-	return BLOCKSIZE;
+	return blocksize;
 }
 
 uint32_t
 diskblocks(void)
 {
 	assert(fd>=0);
-	return nblocks;
+	return nsectors / (blocksize / SECTORSIZE);
 }
 
+/*
+ * Seek to byte offset 0 of block BLOCK.
+ */
+static
 void
-diskwrite(const void *data, uint32_t block)
+diskseek(uint32_t block)
 {
-	const char *cdata = data;
-	uint32_t tot=0;
-	int len;
+	off_t pos;
 
-	assert(fd>=0);
+	pos = (off_t)block * blocksize;
 
 #ifdef HOST
 	// skip over disk file header
-	block++;
+	pos += SECTORSIZE;
 #endif
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	if (lseek(fd, pos, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
+}
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
+/*
+ * Write the first SIZE bytes of block BLOCK. SIZE must be a multiple
+ * of the sector size.
+ */
+void
+diskwritepart(const void *data, uint32_t block, uint32_t size)
+{
+	const char *cdata = data;
+	uint32_t tot=0;
+	int len;
+
+	assert(fd>=0);
+	assert(size <= blocksize && size % SECTORSIZE == 0);
+
+	diskseek(block);
+
+	while (tot < size) {
+		len = write(fd, cdata + tot, size - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -137,26 +175,24 @@ diskwrite(const void *data, uint32_t block)
 	}
 }
 
+/*
+ * Read the first SIZE bytes of block BLOCK. SIZE must be a multiple
+ * of the sector size.
+ */
 void
-diskread(void *data, uint32_t block)
+diskreadpart(void *data, uint32_t block, uint32_t size)
 {
 	char *cdata = data;
 	uint32_t tot=0;
 	int len;
 
 	assert(fd>=0);
+	assert(size <= blocksize && size % SECTORSIZE == 0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
-		err(1, "lseek");
-	}
+	diskseek(block);
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < size) {
+		len = read(fd, cdata + tot, size - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -170,6 +206,18 @@ diskread(void *data, uint32_t block)
 	}
 }
 
+void
+diskwrite(const void *data, uint32_t block)
+{
+	diskwritepart(data, block, blocksize);
+}
+
+void
+diskread(void *data, uint32_t block)
+{
+	diskreadpart(data, block, blocksize);
+}
+
 void
 closedisk(void)
 {
@@ -29,10 +29,14 @@
 
 void opendisk(const char *path);
 
+uint32_t disksectorsize(void);
+void disksetblocksize(uint32_t blocksize);
 uint32_t diskblocksize(void);
 uint32_t diskblocks(void);
 
 void diskwrite(const void *data, uint32_t block);
 void diskread(void *data, uint32_t block);
+void diskwritepart(const void *data, uint32_t block, uint32_t size);
+void diskreadpart(void *data, uint32_t block, uint32_t size);
 
 void closedisk(void);
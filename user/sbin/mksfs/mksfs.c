@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -55,20 +56,23 @@
 
 #include "disk.h"
 
+/* Bitmap buffer size, in 512-byte units; at least one largest block */
 #define MAXBITBLOCKS 32
 
 static
 void
 check(void)
 {
-	assert(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
-	assert(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
-	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	assert(sizeof(struct sfs_super)==SFS_MINBLOCKSIZE);
+	assert(sizeof(struct sfs_inode)==SFS_MINBLOCKSIZE);
+	assert(SFS_MINBLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	assert(MAXBITBLOCKS*SFS_MINBLOCKSIZE >= SFS_MAXBLOCKSIZE);
 }
 
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks, uint32_t blocksize,
+	   uint32_t dirbuckets)
 {
 	struct sfs_super sp;
 
@@ -81,8 +85,10 @@ writesuper(const char *volname, uint32_t nblocks)
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
 	strcpy(sp.sp_volname, volname);
+	sp.sp_dirbuckets = SWAPL(dirbuckets);
+	sp.sp_blocksize = SWAPL(blocksize);
 
-	diskwrite(&sp, SFS_SB_LOCATION);
+	diskwritepart(&sp, SFS_SB_LOCATION, sizeof(sp));
 }
 
 static
@@ -97,10 +103,10 @@ writerootdir(void)
 	sfi.sfi_type = SWAPS(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAPS(1);
 
-	diskwrite(&sfi, SFS_ROOT_LOCATION);
+	diskwritepart(&sfi, SFS_ROOT_LOCATION, sizeof(sfi));
 }
 
-static char bitbuf[MAXBITBLOCKS*SFS_BLOCKSIZE];
+static char bitbuf[MAXBITBLOCKS*SFS_MINBLOCKSIZE];
 
 static
 void
@@ -115,15 +121,15 @@ doallocbit(uint32_t bit)
 
 static
 void
-writebitmap(uint32_t fsblocks)
+writebitmap(uint32_t fsblocks, uint32_t blocksize)
 {
 
-	uint32_t nbits = SFS_BITMAPSIZE(fsblocks);
-	uint32_t nblocks = SFS_BITBLOCKS(fsblocks);
+	uint32_t nbits = SFS_BITMAPSIZE(fsblocks, blocksize);
+	uint32_t nblocks = SFS_BITBLOCKS(fsblocks, blocksize);
 	char *ptr;
 	uint32_t i;
 
-	if (nblocks > MAXBITBLOCKS) {
+	if (nblocks*blocksize > sizeof(bitbuf)) {
 		errx(1, "Filesystem too large "
 		     "- increase MAXBITBLOCKS and recompile");
 	}
@@ -138,23 +144,65 @@ writebitmap(uint32_t fsblocks)
 	}
 
 	for (i=0; i<nblocks; i++) {
-		ptr = bitbuf + i*SFS_BLOCKSIZE;
+		ptr = bitbuf + i*blocksize;
 		diskwrite(ptr, SFS_MAP_LOCATION+i);
 	}
 }
 
+static
+void
+usage(void)
+{
+	errx(1, "Usage: mksfs [-b blocksize] [-H buckets] "
+	     "device/diskfile volume-name");
+}
+
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize = SFS_MINBLOCKSIZE, dirbuckets = 0;
 	char *volname, *s;
+	int i;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/*
+	 * -b blocksize: use blocks of this many bytes.
+	 * -H buckets: make directories hash tables with this many
+	 * buckets, rather than flat arrays.
+	 */
+	for (i=1; i<argc && argv[i][0]=='-'; i++) {
+		if (!strcmp(argv[i], "-b") && i+1 < argc) {
+			blocksize = atoi(argv[++i]);
+			if (blocksize < SFS_MINBLOCKSIZE ||
+			    blocksize > SFS_MAXBLOCKSIZE ||
+			    (blocksize & (blocksize-1)) != 0) {
+				errx(1, "Block size must be a power of 2 "
+				     "from %u to %u", SFS_MINBLOCKSIZE,
+				     SFS_MAXBLOCKSIZE);
+			}
+		}
+		else if (!strcmp(argv[i], "-H") && i+1 < argc) {
+			dirbuckets = atoi(argv[++i]);
+			if (dirbuckets == 0 ||
+			    dirbuckets > SFS_DIRHASH_MAXBUCKETS ||
+			    (dirbuckets & (dirbuckets-1)) != 0) {
+				errx(1, "Bucket count must be a power of 2 "
+				     "no larger than %u",
+				     SFS_DIRHASH_MAXBUCKETS);
+			}
+		}
+		else {
+			usage();
+		}
+	}
+	argc -= i-1;
+	argv += i-1;
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		usage();
 	}
 
 	check();
@@ -177,17 +225,17 @@ main(int argc, char **argv)
 	}
 
 	opendisk(argv[1]);
-	blocksize = diskblocksize();
 
-	if (blocksize!=SFS_BLOCKSIZE) {
-		errx(1, "Device has wrong blocksize %u (should be %u)\n",
-		     blocksize, SFS_BLOCKSIZE);
+	if (disksectorsize()!=SFS_MINBLOCKSIZE) {
+		errx(1, "Device has wrong sector size %u (should be %u)\n",
+		     disksectorsize(), SFS_MINBLOCKSIZE);
 	}
+	disksetblocksize(blocksize);
 	size = diskblocks();
 
-	writesuper(volname, size);
+	writesuper(volname, size, blocksize, dirbuckets);
 	writerootdir();
-	writebitmap(size);
+	writebitmap(size, blocksize);
 
 	closedisk();
 
@@ -65,6 +65,7 @@
 #define EXIT_CLEAN    0
 
 static int badness=0;
+static uint32_t blocksize;	/* volume block size, from superblock */
 
 static
 void
@@ -83,6 +84,8 @@ swapsb(struct sfs_super *sp)
 {
 	sp->sp_magic = SWAPL(sp->sp_magic);
 	sp->sp_nblocks = SWAPL(sp->sp_nblocks);
+	sp->sp_dirbuckets = SWAPL(sp->sp_dirbuckets);
+	sp->sp_blocksize = SWAPL(sp->sp_blocksize);
 }
 
 static
@@ -139,8 +142,8 @@ static
 void
 swapindir(uint32_t *entries)
 {
-	int i;
-	for (i=0; i<SFS_DBPERIDB; i++) {
+	uint32_t i;
+	for (i=0; i<SFS_DBPERIDB(blocksize); i++) {
 		entries[i] = SWAPL(entries[i]);
 	}
 }
@@ -181,6 +184,7 @@ typedef enum {
 } blockusage_t;
 
 static uint32_t nblocks, bitblocks;
+static uint32_t dirbuckets;	/* hash buckets per directory, or 0 */
 static uint32_t uniquecounter = 1;
 
 static unsigned long count_blocks=0, count_dirs=0, count_files=0;
@@ -194,7 +198,7 @@ static
 void
 bitmap_init(uint32_t bitblocks)
 {
-	size_t i, mapsize = bitblocks * SFS_BLOCKSIZE;
+	size_t i, mapsize = bitblocks * blocksize;
 	bitmapdata = domalloc(mapsize * sizeof(uint8_t));
 	tofreedata = domalloc(mapsize * sizeof(uint8_t));
 	for (i=0; i<mapsize; i++) {
@@ -292,7 +296,8 @@ reportbits(uint32_t bitblock, uint32_t byte, uint8_t val, const char *what)
 
 	for (x=1, y=0; x; x<<=1, y++) {
 		if (val & x) {
-			blocknum = bitblock*SFS_BLOCKBITS + byte*CHAR_BIT + y;
+			blocknum = bitblock*SFS_BLOCKBITS(blocksize) +
+				byte*CHAR_BIT + y;
 			warnx("Block %lu erroneously shown %s in bitmap",
 			      (unsigned long) blocknum, what);
 		}
@@ -303,18 +308,19 @@ static
 void
 check_bitmap(void)
 {
-	uint8_t bits[SFS_BLOCKSIZE], *found, *tofree, tmp;
+	static uint8_t bits[SFS_MAXBLOCKSIZE];
+	uint8_t *found, *tofree, tmp;
 	uint32_t alloccount=0, freecount=0, i, j;
 	int bchanged;
 
 	for (i=0; i<bitblocks; i++) {
 		diskread(bits, SFS_MAP_LOCATION+i);
 		swapbits(bits);
-		found = bitmapdata + i*SFS_BLOCKSIZE;
-		tofree = tofreedata + i*SFS_BLOCKSIZE;
+		found = bitmapdata + i*blocksize;
+		tofree = tofreedata + i*blocksize;
 		bchanged = 0;
 
-		for (j=0; j<SFS_BLOCKSIZE; j++) {
+		for (j=0; j<blocksize; j++) {
 			/* we shouldn't have blocks marked both ways */
 			assert((found[j] & tofree[j])==0);
 
@@ -457,7 +463,7 @@ adjust_filelinks(void)
 			/* directory */
 			continue;
 		}
-		diskread(&sfi, inodes[i].ino);
+		diskreadpart(&sfi, inodes[i].ino, sizeof(sfi));
 		swapinode(&sfi);
 		assert(sfi.sfi_type == SFS_TYPE_FILE);
 		if (sfi.sfi_linkcount != inodes[i].linkcount) {
@@ -468,7 +474,7 @@ adjust_filelinks(void)
 			sfi.sfi_linkcount = inodes[i].linkcount;
 			setbadness(EXIT_RECOV);
 			swapinode(&sfi);
-			diskwrite(&sfi, inodes[i].ino);
+			diskwritepart(&sfi, inodes[i].ino, sizeof(sfi));
 		}
 		count_files++;
 	}
@@ -516,21 +522,36 @@ check_sb(void)
 	uint32_t i;
 	int schanged=0;
 
-	diskread(&sp, SFS_SB_LOCATION);
+	diskreadpart(&sp, SFS_SB_LOCATION, sizeof(sp));
 	swapsb(&sp);
 	if (sp.sp_magic != SFS_MAGIC) {
 		errx(EXIT_UNRECOV, "Not an sfs filesystem");
 	}
 
+	/*
+	 * There's no way to guess the right block size if it's bad.
+	 * 0 means the volume predates sp_blocksize, and is fine.
+	 */
+	blocksize = sp.sp_blocksize;
+	if (blocksize == 0) {
+		blocksize = SFS_MINBLOCKSIZE;
+	}
+	if (blocksize < SFS_MINBLOCKSIZE || blocksize > SFS_MAXBLOCKSIZE ||
+	    (blocksize & (blocksize-1)) != 0) {
+		errx(EXIT_UNRECOV, "Invalid block size %lu",
+		     (unsigned long) sp.sp_blocksize);
+	}
+	disksetblocksize(blocksize);
+
 	assert(nblocks==0);
 	assert(bitblocks==0);
 	nblocks = sp.sp_nblocks;
-	bitblocks = SFS_BITBLOCKS(nblocks);
+	bitblocks = SFS_BITBLOCKS(nblocks, blocksize);
 	assert(nblocks>0);
 	assert(bitblocks>0);
 
 	bitmap_init(bitblocks);
-	for (i=nblocks; i<bitblocks*SFS_BLOCKBITS; i++) {
+	for (i=nblocks; i<bitblocks*SFS_BLOCKBITS(blocksize); i++) {
 		bitmap_mark(i, B_PASTEND, 0);
 	}
 
@@ -545,9 +566,24 @@ check_sb(void)
 		schanged = 1;
 	}
 
+	/*
+	 * A bad bucket count can be fixed by making directories flat
+	 * again: linear search finds entries in any slot, and the
+	 * holes in hashed directories read as free entries.
+	 */
+	if (sp.sp_dirbuckets > SFS_DIRHASH_MAXBUCKETS ||
+	    (sp.sp_dirbuckets & (sp.sp_dirbuckets - 1)) != 0) {
+		warnx("Invalid directory hash bucket count %lu (fixed)",
+		      (unsigned long) sp.sp_dirbuckets);
+		setbadness(EXIT_RECOV);
+		sp.sp_dirbuckets = 0;
+		schanged = 1;
+	}
+	dirbuckets = sp.sp_dirbuckets;
+
 	if (schanged) {
 		swapsb(&sp);
-		diskwrite(&sp, SFS_SB_LOCATION);
+		diskwritepart(&sp, SFS_SB_LOCATION, sizeof(sp));
 	}
 
 	bitmap_mark(SFS_SB_LOCATION, B_SUPERBLOCK, 0);
@@ -564,8 +600,28 @@ check_indirect_block(uint32_t ino, uint32_t *ientry, uint32_t *blockp,
 		     uint32_t nblocks, uint32_t *badcountp, 
 		     int isdir, int indirection)
 {
-	uint32_t entries[SFS_DBPERIDB];
+	const uint32_t dbperidb = SFS_DBPERIDB(blocksize);
+	uint32_t *entries;
 	uint32_t i, ct;
+	uint64_t span;
+
+	if (*ientry == 0 && indirection > 1) {
+		/*
+		 * Empty subtree; just skip over the blocks it would map.
+		 * (With large blocks that can be more than 32 bits'
+		 * worth; since we only compare against the file size,
+		 * stopping at the maximum is fine.)
+		 */
+		span = dbperidb;
+		for (i=1; i<(uint32_t)indirection; i++) {
+			span *= dbperidb;
+		}
+		span += *blockp;
+		*blockp = span > 0xffffffffU ? 0xffffffffU : span;
+		return;
+	}
+
+	entries = domalloc(blocksize);
 
 	if (*ientry !=0) {
 		diskread(entries, *ientry);
@@ -573,13 +629,13 @@ check_indirect_block(uint32_t ino, uint32_t *ientry, uint32_t *blockp,
 		bitmap_mark(*ientry, B_IBLOCK, ino);
 	}
 	else {
-		for (i=0; i<SFS_DBPERIDB; i++) {
+		for (i=0; i<dbperidb; i++) {
 			entries[i] = 0;
 		}
 	}
 
 	if (indirection > 1) {
-		for (i=0; i<SFS_DBPERIDB; i++) {
+		for (i=0; i<dbperidb; i++) {
 			check_indirect_block(ino, &entries[i], 
 					     blockp, nblocks, 
 					     badcountp,
@@ -590,7 +646,7 @@ check_indirect_block(uint32_t ino, uint32_t *ientry, uint32_t *blockp,
 	else {
 		assert(indirection==1);
 
-		for (i=0; i<SFS_DBPERIDB; i++) {
+		for (i=0; i<dbperidb; i++) {
 			if (*blockp < nblocks) {
 				if (entries[i] != 0) {
 					bitmap_mark(entries[i],
@@ -612,7 +668,7 @@ check_indirect_block(uint32_t ino, uint32_t *ientry, uint32_t *blockp,
 	}
 
 	ct=0;
-	for (i=ct=0; i<SFS_DBPERIDB; i++) {
+	for (i=ct=0; i<dbperidb; i++) {
 		if (entries[i]!=0) ct++;
 	}
 	if (ct==0) {
@@ -629,6 +685,7 @@ check_indirect_block(uint32_t ino, uint32_t *ientry, uint32_t *blockp,
 			diskwrite(entries, *ientry);
 		}
 	}
+	free(entries);
 }
 
 /* returns nonzero if inode modified */
@@ -640,8 +697,8 @@ check_inode_blocks(uint32_t ino, struct sfs_inode *sfi, int isdir)
 
 	badcount = 0;
 
-	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
-	nblocks = size/SFS_BLOCKSIZE;
+	size = SFS_ROUNDUP((uint64_t)sfi->sfi_size, blocksize);
+	nblocks = size/blocksize;
 
 	for (block=0; block<SFS_NDIRECT; block++) {
 		if (block < nblocks) {
@@ -709,23 +766,29 @@ static
 uint32_t
 ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 {
-	uint32_t entries[SFS_DBPERIDB];
+	uint32_t *entries, index, ret;
 
 	if (iblock == 0) {
 		return 0;
 	}
 
+	entries = domalloc(blocksize);
 	diskread(entries, iblock);
 	swapindir(entries);
 
 	if (entrysize > 1) {
-		uint32_t index = offset / entrysize;
+		index = offset / entrysize;
 		offset %= entrysize;
-		return ibmap(entries[index], offset, entrysize/SFS_DBPERIDB);
+		iblock = entries[index];
+		free(entries);
+		return ibmap(iblock, offset,
+			     entrysize/SFS_DBPERIDB(blocksize));
 	}
 	else {
-		assert(offset < SFS_DBPERIDB);
-		return entries[offset];
+		assert(offset < SFS_DBPERIDB(blocksize));
+		ret = entries[offset];
+		free(entries);
+		return ret;
 	}
 }
 
@@ -766,15 +829,18 @@ ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 #endif
 #endif
 
+/* 64 bits, as the triple indirect range overflows 32 with big blocks */
+#define BMAP_DBPERIDB	((uint64_t)SFS_DBPERIDB(blocksize))
+
 #define BMAP_DMAX   BMAP_ND
-#define BMAP_IMAX   (BMAP_DMAX+SFS_DBPERIDB*BMAP_NI)
-#define BMAP_IIMAX  (BMAP_IMAX+SFS_DBPERIDB*BMAP_NII)
-#define BMAP_IIIMAX (BMAP_IIMAX+SFS_DBPERIDB*BMAP_NIII)
+#define BMAP_IMAX   (BMAP_DMAX+BMAP_DBPERIDB*BMAP_NI)
+#define BMAP_IIMAX  (BMAP_IMAX+BMAP_DBPERIDB*BMAP_NII)
+#define BMAP_IIIMAX (BMAP_IIMAX+BMAP_DBPERIDB*BMAP_NIII)
 
 #define BMAP_DSIZE	1
-#define BMAP_ISIZE	(BMAP_DSIZE*SFS_DBPERIDB)
-#define BMAP_IISIZE	(BMAP_ISIZE*SFS_DBPERIDB)
-#define BMAP_IIISIZE	(BMAP_IISIZE*SFS_DBPERIDB)
+#define BMAP_ISIZE	(BMAP_DSIZE*BMAP_DBPERIDB)
+#define BMAP_IISIZE	(BMAP_ISIZE*BMAP_DBPERIDB)
+#define BMAP_IIISIZE	(BMAP_IISIZE*BMAP_DBPERIDB)
 
 static
 uint32_t
@@ -807,7 +873,7 @@ static
 void
 dirread(struct sfs_inode *sfi, struct sfs_dir *d, unsigned nd)
 {
-	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	const unsigned atonce = SFS_DIRPERBLOCK(blocksize);
 	unsigned nblocks = SFS_ROUNDUP(nd, atonce) / atonce;
 	unsigned i, j;
 
@@ -820,8 +886,11 @@ dirread(struct sfs_inode *sfi, struct sfs_dir *d, unsigned nd)
 			}
 		}
 		else {
-			warnx("Warning: sparse directory found");
-			bzero(d + i*atonce, SFS_BLOCKSIZE);
+			/* hashed directories are normally sparse */
+			if (dirbuckets == 0) {
+				warnx("Warning: sparse directory found");
+			}
+			bzero(d + i*atonce, blocksize);
 		}
 	}
 }
@@ -830,7 +899,7 @@ static
 void
 dirwrite(const struct sfs_inode *sfi, struct sfs_dir *d, int nd)
 {
-	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	const unsigned atonce = SFS_DIRPERBLOCK(blocksize);
 	unsigned nblocks = SFS_ROUNDUP(nd, atonce) / atonce;
 	unsigned i, j, bad;
 
@@ -901,14 +970,56 @@ sortdir(int *vector, struct sfs_dir *d, int nd)
 	qsort(vector, nd, sizeof(int), dirsortfunc);
 }
 
+static
+uint32_t
+dirhash_bucket(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+
+	for (; *name; name++) {
+		h = SFS_DIRHASH_STEP(h, *name);
+	}
+	return h & (dirbuckets - 1);
+}
+
+/*
+ * Returns nonzero if the kernel will look for NAME in directory slot
+ * SLOT. In a flat directory that's any slot. In a hashed directory
+ * the slot must be in the chain for NAME's bucket, with no
+ * unallocated blocks in the chain ahead of it.
+ */
+static
+int
+dir_slotok(const struct sfs_inode *sfi, const char *name, uint32_t slot)
+{
+	const unsigned atonce = SFS_DIRPERBLOCK(blocksize);
+	uint32_t fileblock = slot / atonce;
+	uint32_t block;
+
+	if (dirbuckets == 0) {
+		return 1;
+	}
+	if (fileblock % dirbuckets != dirhash_bucket(name)) {
+		return 0;
+	}
+	for (block = fileblock % dirbuckets; block <= fileblock;
+	     block += dirbuckets) {
+		if (dobmap(sfi, block) == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /* tries to add a directory entry; returns 0 on success */
 static
 int
-dir_tryadd(struct sfs_dir *d, int nd, const char *name, uint32_t ino)
+dir_tryadd(const struct sfs_inode *sfi, struct sfs_dir *d, int nd,
+	   const char *name, uint32_t ino)
 {
 	int i;
 	for (i=0; i<nd; i++) {
-		if (d[i].sfd_ino==SFS_NOINO) {
+		if (d[i].sfd_ino==SFS_NOINO && dir_slotok(sfi, name, i)) {
 			d[i].sfd_ino = ino;
 			assert(strlen(name) < sizeof(d[i].sfd_name));
 			strcpy(d[i].sfd_name, name);
@@ -976,7 +1087,7 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	uint32_t dirsize, ndirentries, maxdirentries, subdircount, i;
 	int ichanged=0, dchanged=0, dotseen=0, dotdotseen=0;
 
-	diskread(&sfi, ino);
+	diskreadpart(&sfi, ino, sizeof(sfi));
 	swapinode(&sfi);
 
 	if (remember_dir(ino, pathsofar)) {
@@ -1001,8 +1112,8 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	}
 
 	ndirentries = sfi.sfi_size/sizeof(struct sfs_dir);
-	maxdirentries = SFS_ROUNDUP(ndirentries, 
-				    SFS_BLOCKSIZE/sizeof(struct sfs_dir));
+	maxdirentries = SFS_ROUNDUP(ndirentries,
+				    SFS_DIRPERBLOCK(blocksize));
 	dirsize = maxdirentries * sizeof(struct sfs_dir);
 	direntries = domalloc(dirsize);
 	sortvector = domalloc(ndirentries * sizeof(int));
@@ -1055,6 +1166,34 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		}
 	}
 
+	/*
+	 * Make sure entries in hashed directories are where the kernel
+	 * will look for them. (This has to come after the name fixups
+	 * above, since renaming an entry changes its hash.)
+	 */
+	for (i=0; i<ndirentries; i++) {
+		struct sfs_dir *sfd = &direntries[i];
+
+		if (sfd->sfd_ino == SFS_NOINO ||
+		    dir_slotok(&sfi, sfd->sfd_name, i)) {
+			continue;
+		}
+		if (dir_tryadd(&sfi, direntries, ndirentries,
+			       sfd->sfd_name, sfd->sfd_ino)==0) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory /%s: %s in wrong hash bucket (moved)",
+			      pathsofar, sfd->sfd_name);
+			sfd->sfd_ino = SFS_NOINO;
+			sfd->sfd_name[0] = 0;
+			dchanged = 1;
+		}
+		else {
+			setbadness(EXIT_UNRECOV);
+			warnx("Directory /%s: %s in wrong hash bucket "
+			      "(NOT FIXED)", pathsofar, sfd->sfd_name);
+		}
+	}
+
 	for (i=0; i<ndirentries; i++) {
 		if (!strcmp(direntries[i].sfd_name, ".")) {
 			if (direntries[i].sfd_ino != ino) {
@@ -1081,13 +1220,13 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	}
 
 	if (!dotseen) {
-		if (dir_tryadd(direntries, ndirentries, ".", ino)==0) {
+		if (dir_tryadd(&sfi, direntries, ndirentries, ".", ino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory /%s: No `.' entry (added)",
 			      pathsofar);
 			dchanged = 1;
 		}
-		else if (dir_tryadd(direntries, maxdirentries, ".", ino)==0) {
+		else if (dir_tryadd(&sfi, direntries, maxdirentries, ".", ino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory /%s: No `.' entry (added)",
 			      pathsofar);
@@ -1104,13 +1243,13 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	}
 
 	if (!dotdotseen) {
-		if (dir_tryadd(direntries, ndirentries, "..", parentino)==0) {
+		if (dir_tryadd(&sfi, direntries, ndirentries, "..", parentino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory /%s: No `..' entry (added)",
 			      pathsofar);
 			dchanged = 1;
 		}
-		else if (dir_tryadd(direntries, maxdirentries, "..", 
+		else if (dir_tryadd(&sfi, direntries, maxdirentries, "..",
 				    parentino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory /%s: No `..' entry (added)",
@@ -1142,7 +1281,8 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 			char path[strlen(pathsofar)+SFS_NAMELEN+1];
 			struct sfs_inode subsfi;
 
-			diskread(&subsfi, direntries[i].sfd_ino);
+			diskreadpart(&subsfi, direntries[i].sfd_ino,
+				     sizeof(subsfi));
 			swapinode(&subsfi);
 			snprintf(path, sizeof(path), "%s/%s", 
 				 pathsofar, direntries[i].sfd_name);
@@ -1152,8 +1292,9 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 				if (check_inode_blocks(direntries[i].sfd_ino,
 						       &subsfi, 0)) {
 					swapinode(&subsfi);
-					diskwrite(&subsfi, 
-						  direntries[i].sfd_ino);
+					diskwritepart(&subsfi,
+						      direntries[i].sfd_ino,
+						      sizeof(subsfi));
 				}
 				observe_filelink(direntries[i].sfd_ino);
 				break;
@@ -1200,7 +1341,7 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 
 	if (ichanged) {
 		swapinode(&sfi);
-		diskwrite(&sfi, ino);
+		diskwritepart(&sfi, ino, sizeof(sfi));
 	}
 
 	free(direntries);
@@ -1215,7 +1356,7 @@ void
 check_root_dir(void)
 {
 	struct sfs_inode sfi;
-	diskread(&sfi, SFS_ROOT_LOCATION);
+	diskreadpart(&sfi, SFS_ROOT_LOCATION, sizeof(sfi));
 	swapinode(&sfi);
 
 	switch (sfi.sfi_type) {
@@ -1231,7 +1372,7 @@ check_root_dir(void)
 		setbadness(EXIT_RECOV);
 		sfi.sfi_type = SFS_TYPE_DIR;
 		swapinode(&sfi);
-		diskwrite(&sfi, SFS_ROOT_LOCATION);
+		diskwritepart(&sfi, SFS_ROOT_LOCATION, sizeof(sfi));
 		break;
 	}
 
@@ -1251,9 +1392,9 @@ main(int argc, char **argv)
 		errx(EXIT_USAGE, "Usage: sfsck device/diskfile");
 	}
 
-	assert(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
-	assert(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
-	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	assert(sizeof(struct sfs_super)==SFS_MINBLOCKSIZE);
+	assert(sizeof(struct sfs_inode)==SFS_MINBLOCKSIZE);
+	assert(SFS_MINBLOCKSIZE % sizeof(struct sfs_dir) == 0);
 
 	opendisk(argv[1]);
 
@@ -0,0 +1,458 @@
+/*
+ * bench - run a standard set of workloads and print the results in a
+ * form that can be compared from one kernel to the next.
+ *
+ * Usage: bench [-n runs] [workload ...]
+ *
+ * Workloads (all of them if none are named):
+ *    syscall   getpid() round trip
+ *    fork      fork, _exit in the child, waitpid
+ *    exec      fork, exec this program, _exit, waitpid
+ *    create    create, close and remove a file
+ *    write     write a file 4K at a time
+ *    read      read it back 4K at a time
+ *    fault     touch fresh pages of an anonymous mapping, one fault each
+ *    pingpong  hand a token between two threads and back, with futexes
+ *    malloc    malloc and free random sizes
+ *
+ * Each workload is run RUNS times (default 3). Every run prints one
+ * line of key=value pairs, and then a summary line gives the best,
+ * median and worst time per operation:
+ *
+ *    bench=syscall run=1 ops=10000 usecs=24012 ns_per_op=2401 ops_per_sec=416458
+ *    ...
+ *    bench=syscall runs=3 ns_per_op_min=2390 ns_per_op_med=2401 ns_per_op_max=2560
+ *
+ * The file workloads use bench.tmp in the current directory.
+ *
+ * There's no pipe() here, so pingpong isn't the usual pipe round trip
+ * between two processes: it's two threads of one process passing a
+ * token through futex_wait/futex_wake. Don't compare it with pipe
+ * numbers from elsewhere.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define PROG		"/testbin/bench"
+#define FILENAME	"bench.tmp"
+#define DEFAULT_RUNS	3
+#define MAXRUNS		100
+#define CHUNK		4096
+#define FILECHUNKS	64		/* 256K file */
+#define FAULTPAGES	256
+#define PAGESIZE	4096
+#define MALLOCSLOTS	64
+
+static char chunk[CHUNK];
+
+/* nanoseconds since S0/NS0 */
+static
+unsigned long long
+nsecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	return (unsigned long long)(s1 - s0) * 1000000000 + (ns1 - ns0);
+}
+
+////////////////////////////////////////////////////////////
+// workloads
+//
+// Each does its work OPS times and returns the time taken in
+// nanoseconds, leaving out any setup.
+
+static
+unsigned long long
+do_syscall(int ops)
+{
+	time_t s0;
+	unsigned long ns0;
+	int i;
+
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		getpid();
+	}
+	return nsecs_since(s0, ns0);
+}
+
+static
+unsigned long long
+forkwait(int ops, int doexec)
+{
+	char *args[3];
+	time_t s0;
+	unsigned long ns0;
+	int i, pid, status;
+
+	args[0] = (char *)PROG;
+	args[1] = (char *)"-child";
+	args[2] = NULL;
+
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			if (doexec) {
+				execv(PROG, args);
+				warn("execv");
+				_exit(1);
+			}
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "child failed");
+		}
+	}
+	return nsecs_since(s0, ns0);
+}
+
+static
+unsigned long long
+do_fork(int ops)
+{
+	return forkwait(ops, 0);
+}
+
+static
+unsigned long long
+do_exec(int ops)
+{
+	return forkwait(ops, 1);
+}
+
+static
+unsigned long long
+do_create(int ops)
+{
+	time_t s0;
+	unsigned long ns0;
+	int i, fd;
+
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		fd = open(FILENAME, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s: create", FILENAME);
+		}
+		close(fd);
+		if (remove(FILENAME) < 0) {
+			err(1, "%s: remove", FILENAME);
+		}
+	}
+	return nsecs_since(s0, ns0);
+}
+
+static
+unsigned long long
+do_write(int ops)
+{
+	time_t s0;
+	unsigned long ns0;
+	unsigned long long ns;
+	int i, fd;
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		if (write(fd, chunk, CHUNK) != CHUNK) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+	ns = nsecs_since(s0, ns0);
+	close(fd);
+	return ns;
+}
+
+static
+unsigned long long
+do_read(int ops)
+{
+	time_t s0;
+	unsigned long ns0;
+	unsigned long long ns;
+	int i, fd;
+
+	/* make sure there's something to read */
+	do_write(ops);
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		if (read(fd, chunk, CHUNK) != CHUNK) {
+			err(1, "%s: read", FILENAME);
+		}
+	}
+	ns = nsecs_since(s0, ns0);
+	close(fd);
+	remove(FILENAME);
+	return ns;
+}
+
+static
+unsigned long long
+do_fault(int ops)
+{
+	time_t s0;
+	unsigned long ns0;
+	unsigned long long ns;
+	char *p;
+	int i;
+
+	/*
+	 * A new mapping each run, unmapped afterwards, so every touch
+	 * allocates a page. (Shrinking the heap with sbrk wouldn't do:
+	 * the pages would stay, and later runs would only refill the
+	 * TLB.)
+	 */
+	p = mmap(NULL, ops * PAGESIZE, PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		p[i * PAGESIZE] = 1;
+	}
+	ns = nsecs_since(s0, ns0);
+	if (munmap(p, ops * PAGESIZE) < 0) {
+		err(1, "munmap");
+	}
+	return ns;
+}
+
+static volatile int pp_turn;
+static int pp_ops;
+
+static
+void
+pp_wait(int want)
+{
+	int cur;
+
+	while ((cur = pp_turn) != want) {
+		futex_wait(&pp_turn, cur);
+	}
+}
+
+static
+void
+pp_give(int to)
+{
+	pp_turn = to;
+	futex_wake(&pp_turn, 1);
+}
+
+static
+void
+ponger(void *arg)
+{
+	int i;
+
+	(void)arg;
+	for (i=0; i<pp_ops; i++) {
+		pp_wait(1);
+		pp_give(0);
+	}
+}
+
+static
+unsigned long long
+do_pingpong(int ops)
+{
+	time_t s0;
+	unsigned long ns0;
+	unsigned long long ns;
+	int i, tid, status;
+
+	pp_turn = 0;
+	pp_ops = ops;
+	tid = threadfork(ponger, NULL);
+	if (tid < 0) {
+		err(1, "threadfork");
+	}
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		pp_give(1);
+		pp_wait(0);
+	}
+	ns = nsecs_since(s0, ns0);
+	if (threadjoin(tid, &status) < 0) {
+		err(1, "threadjoin");
+	}
+	return ns;
+}
+
+static
+unsigned long long
+do_malloc(int ops)
+{
+	void *slots[MALLOCSLOTS];
+	time_t s0;
+	unsigned long ns0;
+	unsigned long long ns;
+	int i, j;
+
+	srandom(1);
+	memset(slots, 0, sizeof(slots));
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		j = random() % MALLOCSLOTS;
+		free(slots[j]);
+		slots[j] = malloc(1 + random() % CHUNK);
+		if (slots[j] == NULL) {
+			errx(1, "malloc failed");
+		}
+	}
+	ns = nsecs_since(s0, ns0);
+	for (j=0; j<MALLOCSLOTS; j++) {
+		free(slots[j]);
+	}
+	return ns;
+}
+
+static const struct {
+	const char *name;
+	unsigned long long (*func)(int ops);
+	int ops;		/* operations per run */
+	int bytes;		/* bytes per operation, if it moves data */
+} workloads[] = {
+	{ "syscall",	do_syscall,	10000,		0 },
+	{ "fork",	do_fork,	50,		0 },
+	{ "exec",	do_exec,	20,		0 },
+	{ "create",	do_create,	100,		0 },
+	{ "write",	do_write,	FILECHUNKS,	CHUNK },
+	{ "read",	do_read,	FILECHUNKS,	CHUNK },
+	{ "fault",	do_fault,	FAULTPAGES,	0 },
+	{ "pingpong",	do_pingpong,	1000,		0 },
+	{ "malloc",	do_malloc,	10000,		0 },
+};
+
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+////////////////////////////////////////////////////////////
+
+static
+void
+runworkload(unsigned w, int runs)
+{
+	unsigned long long ns, perop[MAXRUNS], v;
+	int ops = workloads[w].ops;
+	int i, j;
+
+	for (i=0; i<runs; i++) {
+		ns = workloads[w].func(ops);
+		if (ns == 0) {
+			ns = 1;
+		}
+		perop[i] = ns / ops;
+		printf("bench=%s run=%d ops=%d usecs=%llu ns_per_op=%llu "
+		       "ops_per_sec=%llu", workloads[w].name, i + 1, ops,
+		       ns / 1000, perop[i],
+		       (unsigned long long)ops * 1000000000 / ns);
+		if (workloads[w].bytes > 0) {
+			printf(" kb_per_sec=%llu",
+			       (unsigned long long)ops * workloads[w].bytes *
+			       1000000000 / 1024 / ns);
+		}
+		printf("\n");
+	}
+
+	/* insertion sort for the summary */
+	for (i=1; i<runs; i++) {
+		v = perop[i];
+		for (j=i; j>0 && perop[j-1] > v; j--) {
+			perop[j] = perop[j-1];
+		}
+		perop[j] = v;
+	}
+	printf("bench=%s runs=%d ns_per_op_min=%llu ns_per_op_med=%llu "
+	       "ns_per_op_max=%llu\n", workloads[w].name, runs,
+	       perop[0], perop[runs / 2], perop[runs - 1]);
+}
+
+static
+void
+usage(void)
+{
+	unsigned w;
+
+	fprintf(stderr, "Usage: bench [-n runs] [workload ...]\n");
+	fprintf(stderr, "Workloads:");
+	for (w=0; w<NWORKLOADS; w++) {
+		fprintf(stderr, " %s", workloads[w].name);
+	}
+	fprintf(stderr, "\n");
+	fprintf(stderr, "(pingpong is a futex hand-off between two threads, "
+		"not a pipe round trip)\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int runs = DEFAULT_RUNS;
+	int i, any;
+	unsigned w;
+
+	if (argc > 1 && !strcmp(argv[1], "-child")) {
+		return 0;
+	}
+
+	i = 1;
+	if (argc > 2 && !strcmp(argv[1], "-n")) {
+		runs = atoi(argv[2]);
+		if (runs <= 0 || runs > MAXRUNS) {
+			usage();
+		}
+		i = 3;
+	}
+
+	memset(chunk, 'b', CHUNK);
+
+	any = 0;
+	for (; i<argc; i++) {
+		for (w=0; w<NWORKLOADS; w++) {
+			if (!strcmp(argv[i], workloads[w].name)) {
+				break;
+			}
+		}
+		if (w == NWORKLOADS) {
+			usage();
+		}
+		runworkload(w, runs);
+		any = 1;
+	}
+	if (!any) {
+		for (w=0; w<NWORKLOADS; w++) {
+			runworkload(w, runs);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * execbench - time fork+exec+exit+wait for argument lists of various
+ * sizes.
+ *
+ * Usage: execbench [iterations]
+ *
+ * For each argument list size, the parent repeatedly forks a child that
+ * execs this program again with the list; the exec'd copy sees the
+ * "-child" flag and exits at once. The average round trip is printed
+ * per size, so the cost of argument passing shows up as the difference
+ * between rows.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define PROG		"/testbin/execbench"
+#define DEFAULT_ITERS	20
+#define MAXARGS		1024
+#define ARGLEN		32
+
+/* argument lists to try: count of ARGLEN-byte arguments after -child */
+static const int sizes[] = { 0, 1, 8, 64, 256, 1024 };
+
+static char argbuf[MAXARGS][ARGLEN];
+static char *args[MAXARGS + 3];
+
+/* microseconds since S0/NS0 */
+static
+unsigned long
+usecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	return (unsigned long)(s1 - s0) * 1000000 + (ns1 - ns0) / 1000;
+}
+
+static
+void
+runone(int nargs, int iters)
+{
+	time_t s0;
+	unsigned long ns0, usecs;
+	int i, pid, status;
+
+	args[0] = (char *)PROG;
+	args[1] = (char *)"-child";
+	for (i=0; i<nargs; i++) {
+		args[i+2] = argbuf[i];
+	}
+	args[nargs+2] = NULL;
+
+	__time(&s0, &ns0);
+	for (i=0; i<iters; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(PROG, args);
+			warn("execv");
+			_exit(1);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "child with %d args failed", nargs);
+		}
+	}
+	usecs = usecs_since(s0, ns0);
+
+	printf("%5d args %7d bytes: %8lu us per fork+exec\n",
+	       nargs, nargs * ARGLEN, usecs / iters);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int iters = DEFAULT_ITERS;
+	unsigned i;
+	int j;
+
+	if (argc > 1 && !strcmp(argv[1], "-child")) {
+		return 0;
+	}
+	if (argc > 1) {
+		iters = atoi(argv[1]);
+		if (iters <= 0) {
+			errx(1, "Usage: execbench [iterations]");
+		}
+	}
+
+	for (j=0; j<MAXARGS; j++) {
+		memset(argbuf[j], 'a' + j % 26, ARGLEN - 1);
+		argbuf[j][ARGLEN - 1] = 0;
+	}
+
+	printf("execbench: %d iterations per size\n", iters);
+	for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+		runone(sizes[i], iters);
+	}
+	return 0;
+}
@@ -48,21 +48,13 @@ static int pids[MAXPROCS], npids;
 
 static
 void
-spawnv(const char *prog, char **argv)
+spawn(const char *prog, char **argv)
 {
-	int pid = fork();
-	switch (pid) {
-	    case -1:
-		err(1, "fork");
-	    case 0:
-		/* child */
-		execv(prog, argv);
+	int pid = spawnv(prog, argv);
+	if (pid < 0) {
 		err(1, "%s", prog);
-	    default:
-		/* parent */
-		pids[npids++] = pid;
-		break;
 	}
+	pids[npids++] = pid;
 }
 
 static
@@ -87,14 +79,14 @@ static
 void
 hog(void)
 {
-	spawnv("/testbin/hog", hargv);
+	spawn("/testbin/hog", hargv);
 }
 
 static
 void
 cat(void)
 {
-	spawnv("/bin/cat", cargv);
+	spawn("/bin/cat", cargv);
 }
 
 int
@@ -36,12 +36,16 @@
  * testing your file system code.
  *
  * This should really be replaced with a real hash, like MD5 or SHA-1.
+ *
+ * If the file can be mapped with mmap it's hashed in place; otherwise
+ * it's read a byte at a time.
  */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <err.h>
+#include <sys/mman.h>
 
 #ifdef HOST
 #include "hostcompat.h"
@@ -55,6 +59,8 @@ main(int argc, char *argv[])
 	int fd;
 	char readbuf[1];
 	int j = 0;
+	off_t size, i;
+	const char *map;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
@@ -70,9 +76,23 @@ main(int argc, char *argv[])
 		err(1, "%s", argv[1]);
 	}
 
-	for (;;) {
-		if (read(fd, readbuf, 1) <= 0) break;
-		j = ((j*8) + (int) readbuf[0]) % HASHP;
+	size = lseek(fd, 0, SEEK_END);
+	map = MAP_FAILED;
+	if (size > 0) {
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (map != MAP_FAILED) {
+		for (i=0; i<size; i++) {
+			j = ((j*8) + (int) map[i]) % HASHP;
+		}
+		munmap((void *)map, size);
+	}
+	else {
+		lseek(fd, 0, SEEK_SET);
+		for (;;) {
+			if (read(fd, readbuf, 1) <= 0) break;
+			j = ((j*8) + (int) readbuf[0]) % HASHP;
+		}
 	}
 
 	close(fd);
@@ -30,7 +30,8 @@
 /* 
  * malloctest.c
  *
- * This program contains a variety of tests for malloc and free.
+ * This program contains a variety of tests for malloc and free, and a
+ * benchmark (test 8).
  * XXX most tests leak on error.
  *
  * These tests (subject to restrictions and limitations noted below) should
@@ -623,6 +624,109 @@ test7(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Test 8
+ *
+ * Benchmark. Keeps a working set of live blocks of mixed sizes, mostly
+ * small with the occasional large one, and replaces a random one at
+ * each step. Reports malloc+free pairs per second, and fragmentation:
+ * how much of the heap growth during the run was not holding live data
+ * at the peak.
+ */
+
+#define BENCH_SLOTS	1024
+#define BENCH_OPS	200000
+
+/* microseconds since S0/NS0 */
+static
+unsigned long
+usecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	return (unsigned long)(s1 - s0) * 1000000 + (ns1 - ns0) / 1000;
+}
+
+static
+void
+test8(void)
+{
+	static void *ptrs[BENCH_SLOTS];
+	static size_t psizes[BENCH_SLOTS];
+	size_t live, peak, size;
+	uintptr_t base, top;
+	time_t s0;
+	unsigned long ns0, usecs;
+	int i, n;
+
+	printf("Beginning malloc test 8 (benchmark)\n");
+	srandom(0);
+
+	for (i=0; i<BENCH_SLOTS; i++) {
+		ptrs[i] = NULL;
+		psizes[i] = 0;
+	}
+	live = peak = 0;
+	base = (uintptr_t)sbrk(0);
+
+	__time(&s0, &ns0);
+	for (i=0; i<BENCH_OPS; i++) {
+		n = random() % BENCH_SLOTS;
+		if (ptrs[n] != NULL) {
+			free(ptrs[n]);
+			live -= psizes[n];
+		}
+		if (random() % 64 == 0) {
+			size = 1024 + random() % 16384;
+		}
+		else {
+			size = 8 + random() % 248;
+		}
+		ptrs[n] = malloc(size);
+		if (ptrs[n] == NULL) {
+			printf("FAILED: malloc %lu failed\n",
+			       (unsigned long)size);
+			break;
+		}
+		psizes[n] = size;
+		live += size;
+		if (live > peak) {
+			peak = live;
+		}
+	}
+	usecs = usecs_since(s0, ns0);
+	top = (uintptr_t)sbrk(0);
+
+	for (n=0; n<BENCH_SLOTS; n++) {
+		free(ptrs[n]);
+	}
+
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	printf("%d malloc/free pairs in %lu us: %lu pairs/sec\n",
+	       i, usecs, (unsigned long)((unsigned long long)i * 1000000
+					 / usecs));
+	printf("Peak live data %lu bytes, heap grew %lu bytes",
+	       (unsigned long)peak, (unsigned long)(top - base));
+	if (top - base > peak) {
+		printf(": %lu%% fragmentation\n",
+		       (unsigned long)((top - base - peak) * 100 /
+				       (top - base)));
+	}
+	else {
+		printf("\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 static struct {
 	int num;
 	const char *desc;
@@ -635,6 +739,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Benchmark: speed and fragmentation", test8 },
 	{ -1, NULL, NULL }
 };
 
@@ -0,0 +1,186 @@
+/*
+ * mmaptest - read() and write() between a file and a fresh mapping of
+ * another file on the same volume.
+ *
+ * Usage: mmaptest [dir]
+ *
+ * Copying into or out of a mapped page that hasn't been touched yet
+ * faults partway through the read or write, and the fault reads the
+ * mapped file in from the same file system. The copies are at odd
+ * offsets, so they go through the file system's partial-block code,
+ * and they straddle two pages of the mapping. Run it on the volume to
+ * be tested, for instance "mmaptest lhd1:"; it makes mmaptest.a and
+ * mmaptest.b in DIR (default the current directory) and removes them
+ * at the end.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define ASIZE		(3 * PAGESIZE)	/* the mapped file */
+#define BSIZE		(2 * PAGESIZE)	/* the one read and written */
+#define LEN		300
+
+static char name_a[128], name_b[128];
+static char buf[BSIZE];
+
+/* What's in each file, byte by byte; they never agree. */
+static
+char
+apat(unsigned i)
+{
+	return (char)(i % 251);
+}
+
+static
+char
+bpat(unsigned i)
+{
+	return (char)(255 - i % 251);
+}
+
+static
+int
+makefile(const char *name, char (*pat)(unsigned), unsigned size)
+{
+	unsigned i;
+	int fd;
+
+	for (i=0; i<size; i++) {
+		buf[i] = pat(i);
+	}
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	if (write(fd, buf, size) != (int)size) {
+		err(1, "%s: write", name);
+	}
+	return fd;
+}
+
+static
+char *
+mapfile(int fd, int prot)
+{
+	void *map;
+
+	map = mmap(NULL, ASIZE, prot, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		err(1, "%s: mmap", name_a);
+	}
+	return map;
+}
+
+/*
+ * read() from B into a mapping of A that hasn't been touched.
+ */
+static
+void
+readtest(int afd, int bfd)
+{
+	unsigned moff = PAGESIZE - LEN / 2, boff = 100, i;
+	char *map;
+
+	map = mapfile(afd, PROT_READ|PROT_WRITE);
+	if (lseek(bfd, boff, SEEK_SET) < 0) {
+		err(1, "%s: lseek", name_b);
+	}
+	if (read(bfd, map + moff, LEN) != LEN) {
+		err(1, "%s: read into mapping", name_b);
+	}
+
+	for (i=0; i<ASIZE; i++) {
+		if (i >= moff && i < moff + LEN) {
+			if (map[i] != bpat(boff + i - moff)) {
+				errx(1, "read: byte %u of mapping is wrong", i);
+			}
+		}
+		else if (map[i] != apat(i)) {
+			errx(1, "read: byte %u of mapping was clobbered", i);
+		}
+	}
+	if (munmap(map, ASIZE) < 0) {
+		err(1, "munmap");
+	}
+	printf("mmaptest: read into a mapping passed\n");
+}
+
+/*
+ * write() to B from a mapping of A that hasn't been touched.
+ */
+static
+void
+writetest(int afd, int bfd)
+{
+	unsigned moff = 2 * PAGESIZE - LEN / 2, boff = 1000, i;
+	char *map;
+
+	map = mapfile(afd, PROT_READ);
+	if (lseek(bfd, boff, SEEK_SET) < 0) {
+		err(1, "%s: lseek", name_b);
+	}
+	if (write(bfd, map + moff, LEN) != LEN) {
+		err(1, "%s: write from mapping", name_b);
+	}
+	if (munmap(map, ASIZE) < 0) {
+		err(1, "munmap");
+	}
+
+	if (lseek(bfd, 0, SEEK_SET) < 0) {
+		err(1, "%s: lseek", name_b);
+	}
+	if (read(bfd, buf, BSIZE) != BSIZE) {
+		err(1, "%s: read back", name_b);
+	}
+	for (i=0; i<BSIZE; i++) {
+		if (i >= boff && i < boff + LEN) {
+			if (buf[i] != apat(moff + i - boff)) {
+				errx(1, "write: byte %u of %s is wrong",
+				     i, name_b);
+			}
+		}
+		else if (buf[i] != bpat(i)) {
+			errx(1, "write: byte %u of %s was clobbered",
+			     i, name_b);
+		}
+	}
+	printf("mmaptest: write from a mapping passed\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *dir = ".", *sep;
+	int afd, bfd;
+
+	if (argc > 2) {
+		errx(1, "Usage: mmaptest [dir]");
+	}
+	if (argc == 2) {
+		dir = argv[1];
+	}
+	/* "lhd1:" needs no slash */
+	sep = (dir[0] != 0 && dir[strlen(dir) - 1] == ':') ? "" : "/";
+	snprintf(name_a, sizeof(name_a), "%s%smmaptest.a", dir, sep);
+	snprintf(name_b, sizeof(name_b), "%s%smmaptest.b", dir, sep);
+
+	afd = makefile(name_a, apat, ASIZE);
+	bfd = makefile(name_b, bpat, BSIZE);
+
+	readtest(afd, bfd);
+	writetest(afd, bfd);
+
+	close(afd);
+	close(bfd);
+	remove(name_a);
+	remove(name_b);
+	printf("mmaptest: all passed\n");
+	return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * sleeptest - check nanosleep.
+ *
+ * Usage: sleeptest
+ *
+ * First sleeps for a range of intervals, from well under a clock tick
+ * to a second and a half, and checks that none of them ends early. It
+ * prints how long each one overshot. Then starts several threads that
+ * sleep for different lengths of time at once, and checks that they
+ * wake up in order of their deadlines.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <synch.h>
+#include <err.h>
+
+#define NTHREADS 6
+
+/* intervals to try, in microseconds */
+static const unsigned long intervals[] = {
+	1, 500, 5000, 10000, 25000, 100000, 333333, 1500000,
+};
+
+static struct mutex order_lock = MUTEX_INITIALIZER;
+static int order[NTHREADS];
+static int norder;
+
+/* microseconds since S0/NS0 */
+static
+unsigned long
+usecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	return (unsigned long)(s1 - s0) * 1000000 + (ns1 - ns0) / 1000;
+}
+
+static
+void
+usleep_or_die(unsigned long usecs)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = (usecs % 1000000) * 1000;
+	if (nanosleep(&ts, NULL) < 0) {
+		err(1, "nanosleep");
+	}
+}
+
+static
+void
+sleeper(void *arg)
+{
+	int n = (int)arg;
+
+	/* start them in the wrong order */
+	usleep_or_die((NTHREADS - n) * 50000);
+
+	mutex_lock(&order_lock);
+	order[norder++] = n;
+	mutex_unlock(&order_lock);
+}
+
+int
+main(void)
+{
+	struct timespec bad;
+	time_t s0;
+	unsigned long ns0, took;
+	int tids[NTHREADS];
+	unsigned i;
+	int j, status, fail;
+
+	fail = 0;
+
+	bad.tv_sec = 0;
+	bad.tv_nsec = 1000000000;
+	if (nanosleep(&bad, NULL) == 0) {
+		warnx("nanosleep with tv_nsec = 1000000000 succeeded");
+		fail = 1;
+	}
+
+	for (i=0; i<sizeof(intervals)/sizeof(intervals[0]); i++) {
+		__time(&s0, &ns0);
+		usleep_or_die(intervals[i]);
+		took = usecs_since(s0, ns0);
+		printf("%8lu us: took %8lu us, %6lu over\n", intervals[i],
+		       took, took >= intervals[i] ? took - intervals[i] : 0);
+		if (took < intervals[i]) {
+			warnx("woke %lu us early", intervals[i] - took);
+			fail = 1;
+		}
+	}
+
+	for (j=0; j<NTHREADS; j++) {
+		tids[j] = threadfork(sleeper, (void *)j);
+		if (tids[j] < 0) {
+			err(1, "threadfork");
+		}
+	}
+	for (j=0; j<NTHREADS; j++) {
+		if (threadjoin(tids[j], &status) < 0) {
+			err(1, "threadjoin");
+		}
+	}
+	for (j=0; j<NTHREADS; j++) {
+		if (order[j] != NTHREADS - 1 - j) {
+			warnx("thread %d woke %dth", order[j], j);
+			fail = 1;
+		}
+	}
+
+	printf("sleeptest %s\n", fail ? "FAILED" : "done");
+	return fail;
+}
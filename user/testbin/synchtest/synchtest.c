@@ -0,0 +1,103 @@
+/*
+ * synchtest - check the futex-based mutexes and condition variables.
+ *
+ * Usage: synchtest [threads]
+ *
+ * Each thread adds to a shared counter under a mutex many times; with
+ * a broken mutex some of the increments get lost. Then the threads pass a token around in order
+ * using one condition variable. The main thread checks the totals.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <synch.h>
+
+#define DEFAULT_THREADS	4
+#define MAXTHREADS	16
+#define NINCS		20000
+#define NROUNDS		50
+
+static struct mutex lock = MUTEX_INITIALIZER;
+static struct cond turn_cv = COND_INITIALIZER;
+static volatile int counter;
+static volatile int turn;
+static int nthreads;
+static int passes[MAXTHREADS];
+
+static
+void
+worker(void *arg)
+{
+	int me = (int)arg;
+	int i, x;
+
+	for (i=0; i<NINCS; i++) {
+		mutex_lock(&lock);
+		x = counter;
+		x++;
+		counter = x;
+		mutex_unlock(&lock);
+	}
+
+	for (i=0; i<NROUNDS; i++) {
+		mutex_lock(&lock);
+		while (turn % nthreads != me) {
+			cond_wait(&turn_cv, &lock);
+		}
+		passes[me]++;
+		turn++;
+		cond_broadcast(&turn_cv);
+		mutex_unlock(&lock);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int tids[MAXTHREADS];
+	int i, status, failures = 0;
+
+	nthreads = DEFAULT_THREADS;
+	if (argc > 1) {
+		nthreads = atoi(argv[1]);
+		if (nthreads <= 0 || nthreads > MAXTHREADS) {
+			errx(1, "Usage: synchtest [threads], at most %d",
+			     MAXTHREADS);
+		}
+	}
+
+	for (i=0; i<nthreads; i++) {
+		tids[i] = threadfork(worker, (void *)i);
+		if (tids[i] < 0) {
+			err(1, "threadfork");
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		if (threadjoin(tids[i], &status) < 0) {
+			err(1, "threadjoin %d", tids[i]);
+		}
+	}
+
+	if (counter != nthreads * NINCS) {
+		warnx("counter is %d, expected %d", counter, nthreads * NINCS);
+		failures++;
+	}
+	if (turn != nthreads * NROUNDS) {
+		warnx("turn is %d, expected %d", turn, nthreads * NROUNDS);
+		failures++;
+	}
+	for (i=0; i<nthreads; i++) {
+		if (passes[i] != NROUNDS) {
+			warnx("thread %d had %d turns", i, passes[i]);
+			failures++;
+		}
+	}
+
+	if (failures) {
+		errx(1, "FAILED");
+	}
+	printf("synchtest: passed with %d threads\n", nthreads);
+	return 0;
+}
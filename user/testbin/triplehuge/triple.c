@@ -38,25 +38,6 @@
 #include <err.h>
 #include "triple.h"
 
-static
-pid_t
-spawnv(const char *prog, char **argv)
-{
-	pid_t pid = fork();
-	switch (pid) {
-	    case -1:
-		err(1, "fork");
-	    case 0:
-		/* child */
-		execv(prog, argv);
-		err(1, "%s: execv", prog);
-	    default:
-		/* parent */
-		break;
-	}
-	return pid;
-}
-
 static
 int
 dowait(int index, int pid)
@@ -95,6 +76,9 @@ triple(const char *prog)
 
 	for (i=0; i<3; i++) {
 		pids[i]=spawnv(args[0], args);
+		if (pids[i] < 0) {
+			err(1, "%s: spawnv", prog);
+		}
 	}
 
 	for (i=0; i<3; i++) {
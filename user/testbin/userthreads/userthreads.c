@@ -38,19 +38,34 @@
  * It also makes various assumptions about the thread API. In
  * particular, it believes (1) that you create a thread by calling
  * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
+ * thread to begin at, (2) that if the parent thread leaves with
+ * threadexit() any child threads will keep running (returning from
+ * main would call exit(), which ends them all), and (3) child threads
+ * will exit if they
  * return from the function they started in. If any or all of these
  * assumptions are not met by your user-level threads, you will need
  * to patch this test accordingly.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
+ *
+ * "userthreads -e" instead forks a process in which a forked thread
+ * execs this program (as "userthreads -c") while the main thread waits
+ * for it with threadjoin. The exec must end the main thread, and the
+ * exec'ing thread must come out of the old image cleanly, stack and
+ * all, and exit from the new one with the status waitpid sees.
+ *
+ * "userthreads -k" forks a process whose main thread calls _exit while
+ * its other threads are asleep in futex_wait and threadjoin or spinning
+ * in user mode, and checks that waitpid still gets the exit code.
  */
 
 
+#include <sys/wait.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+#include <err.h>
 
 #define NTHREADS  3
 #define MAX       1<<25
@@ -61,26 +76,96 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+void ThreadRunner(void *);
+void BladeRunner(void *);
+void ExecRunner(void *);
+void SleepRunner(void *);
+void JoinRunner(void *);
+void SpinRunner(void *);
+
+/* the thread JoinRunner joins */
+static int sleeper;
+
+static
+void
+exectest(void)
+{
+    pid_t pid;
+    int tid, status;
+
+    pid = fork();
+    if (pid < 0)
+	err(1, "fork");
+    if (pid == 0) {
+	tid = threadfork(ExecRunner, NULL);
+	if (tid < 0)
+	    err(1, "threadfork");
+	/* the exec should end us here */
+	if (threadjoin(tid, &status) < 0)
+	    err(1, "threadjoin");
+	errx(1, "Main thread outlived the exec (status 0x%x)", status);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+	err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	errx(1, "Exec'd thread failed (status 0x%x)", status);
+    printf("Exec from a thread passed.\n");
+}
+
+static
+void
+killtest(void)
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0)
+	err(1, "fork");
+    if (pid == 0) {
+	sleeper = threadfork(SleepRunner, NULL);
+	if (sleeper < 0)
+	    err(1, "threadfork");
+	if (threadfork(JoinRunner, NULL) < 0)
+	    err(1, "threadfork");
+	if (threadfork(SpinRunner, NULL) < 0)
+	    err(1, "threadfork");
+	_exit(3);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+	err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 3)
+	errx(1, "Wrong exit status 0x%x", status);
+    printf("Exit with threads asleep passed.\n");
+}
 
 int
 main(int argc, char *argv[])
 {
     int i;
 
-    (void)argc;
-    (void)argv;
+    if (argc == 2 && !strcmp(argv[1], "-c")) {
+	printf("Running in the new image.\n");
+	return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "-e")) {
+	exectest();
+	return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "-k")) {
+	killtest();
+	return 0;
+    }
 
     for (i=0; i<NTHREADS; i++) {
 	if (i)
-	    threadfork(ThreadRunner);
+	    threadfork(ThreadRunner, NULL);
         else
-	    threadfork(BladeRunner);
+	    threadfork(BladeRunner, NULL);
     }
 
     printf("Parent has left.\n");
-    return 0;
+    threadexit(0);
 }
 
 /* multiple threads will simply print out the global variable.
@@ -89,8 +174,9 @@ main(int argc, char *argv[])
 */
 
 void
-BladeRunner()
+BladeRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
 	if (count % 500 == 0)
 	    printf("Blade ");
@@ -99,12 +185,56 @@ BladeRunner()
 }
 
 void
-ThreadRunner()
+ThreadRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
 	if (count % 513 == 0)
 	    printf(" Runner\n");
 	count++;
     }
 }
-    
+
+void
+ExecRunner(void *arg)
+{
+    char *args[3];
+
+    (void)arg;
+    args[0] = (char *)"userthreads";
+    args[1] = (char *)"-c";
+    args[2] = NULL;
+    execv("/testbin/userthreads", args);
+    warn("execv");
+    threadexit(1);
+}
+
+/* the threads for "-k", none of which ever finishes on its own */
+
+void
+SleepRunner(void *arg)
+{
+    static volatile int never = 0;
+
+    (void)arg;
+    while (1)
+	futex_wait(&never, 0);
+}
+
+void
+JoinRunner(void *arg)
+{
+    int status;
+
+    (void)arg;
+    threadjoin(sleeper, &status);
+    threadexit(1);
+}
+
+void
+SpinRunner(void *arg)
+{
+    (void)arg;
+    while (1)
+	count++;
+}